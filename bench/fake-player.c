@@ -0,0 +1,141 @@
+/*
+ * fake-mpv - Stub player for the MotionWall benchmarks
+ * Copyright © 2025 MotionWall Project
+ *
+ * Accepts the command line MotionWall builds for mpv, mplayer or vlc,
+ * paints the window it is given once with a solid colour and then idles
+ * until SIGTERM or a "quit" on its mpv IPC socket. Each step is appended
+ * to $MOTIONWALL_BENCH_EVENTS as "<realtime ns> <event> <window> <pid>",
+ * so the harness can time MotionWall itself without any decoding.
+ */
+#define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <X11/Xlib.h>
+
+#define NAME "fake-mpv"
+
+static volatile sig_atomic_t running = 1;
+static int events_fd = -1;
+static unsigned long target = 0;
+
+static void stop_handler(int sig) {
+   (void)sig;
+   running = 0;
+}
+
+// Una línea por evento con un solo write: O_APPEND la mantiene entera
+// aunque escriban varios reproductores a la vez
+static void record(const char *event) {
+   if (events_fd < 0) return;
+   struct timespec ts;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   char line[128];
+   int len = snprintf(line, sizeof(line), "%lld %s 0x%lx %d\n",
+                      (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec, event, target, (int)getpid());
+   if (write(events_fd, line, len) != len) {
+       // Sin registro el harness da el elemento por perdido
+   }
+}
+
+// Socket IPC mínimo: responde a todo y sale con "quit"
+static int open_ipc_server(const char *path) {
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0) return -1;
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+   unlink(path);
+   if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+       close(fd);
+       return -1;
+   }
+   return fd;
+}
+
+static void handle_ipc_client(int server) {
+   int client = accept(server, NULL, NULL);
+   if (client < 0) return;
+   char buf[1024];
+   ssize_t n = read(client, buf, sizeof(buf) - 1);
+   if (n > 0) {
+       buf[n] = '\0';
+       if (strstr(buf, "\"quit\"")) running = 0;
+       const char *reply = "{\"data\":null,\"error\":\"success\"}\n";
+       if (write(client, reply, strlen(reply)) < 0) {
+           // El cliente ya se fue
+       }
+   }
+   close(client);
+}
+
+int main(int argc, char **argv) {
+   const char *ipc_path = NULL;
+   for (int i = 1; i < argc; i++) {
+       if (strncmp(argv[i], "--wid=", 6) == 0) {
+           target = strtoul(argv[i] + 6, NULL, 0);
+       } else if (strncmp(argv[i], "--drawable-xid=", 15) == 0) {
+           target = strtoul(argv[i] + 15, NULL, 0);
+       } else if (strcmp(argv[i], "-wid") == 0 && i + 1 < argc) {
+           target = strtoul(argv[++i], NULL, 0);
+       } else if (strncmp(argv[i], "--input-ipc-server=", 19) == 0) {
+           ipc_path = argv[i] + 19;
+       }
+   }
+   if (target == 0) {
+       fprintf(stderr, NAME ": no --wid, -wid or --drawable-xid given\n");
+       return 1;
+   }
+
+   const char *events = getenv("MOTIONWALL_BENCH_EVENTS");
+   if (events) events_fd = open(events, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+   record("start");
+
+   signal(SIGTERM, stop_handler);
+   signal(SIGINT, stop_handler);
+
+   Display *display = XOpenDisplay(NULL);
+   if (!display) {
+       fprintf(stderr, NAME ": cannot open display\n");
+       return 1;
+   }
+
+   // Un color distinto por proceso para distinguir los cambios a ojo
+   XWindowAttributes attrs;
+   if (!XGetWindowAttributes(display, target, &attrs)) {
+       fprintf(stderr, NAME ": window 0x%lx not found\n", target);
+       return 1;
+   }
+   GC gc = XCreateGC(display, target, 0, NULL);
+   XSetForeground(display, gc, ((unsigned long)getpid() * 2654435761UL) & 0xffffff);
+   XFillRectangle(display, target, gc, 0, 0, attrs.width, attrs.height);
+   // XSync: el pintado ha llegado al servidor antes de anotarlo
+   XSync(display, False);
+   record("paint");
+
+   int ipc = ipc_path ? open_ipc_server(ipc_path) : -1;
+   while (running) {
+       struct pollfd pfd = { .fd = ipc, .events = POLLIN };
+       if (poll(&pfd, ipc >= 0 ? 1 : 0, 100) > 0) handle_ipc_client(ipc);
+   }
+
+   record("exit");
+   if (ipc >= 0) {
+       close(ipc);
+       unlink(ipc_path);
+   }
+   XFreeGC(display, gc);
+   XCloseDisplay(display);
+   return 0;
+}
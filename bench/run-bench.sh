@@ -0,0 +1,193 @@
+#!/bin/sh
+# MotionWall - Startup and transition latency benchmark
+# Copyright © 2025 MotionWall Project
+#
+# Runs the daemon under Xvfb with 1..16 simulated monitors (RandR 1.5
+# logical monitors made with xrandr --setmonitor) and bench/fake-mpv as the
+# player, so only MotionWall's own overhead is measured. Reports, per
+# monitor count:
+#   first_paint_ms   daemon start -> last window painted
+#   switch_ms        "motionwall-ctl next" -> last window painted again
+#   gap_ms           worst old player exit -> new player paint on a window
+#   restart_ms       SIGKILL of one player -> its replacement painted
+#   daemon_cpu_pct   daemon CPU while idle for BENCH_IDLE seconds
+#   daemon_cpu_s     daemon CPU over the whole run
+#
+# Environment: BENCH_MONITORS ("1 2 4 8 16"), BENCH_IDLE (10),
+# BENCH_OUTPUT (bench/results/latency-DATE.json), MOTIONWALL, MOTIONWALL_CTL,
+# BENCH_PLAYER.
+
+set -u
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+MOTIONWALL=${MOTIONWALL:-$top/motionwall}
+MOTIONWALL_CTL=${MOTIONWALL_CTL:-$top/motionwall-ctl}
+BENCH_PLAYER=${BENCH_PLAYER:-$top/bench/fake-mpv}
+BENCH_MONITORS=${BENCH_MONITORS:-"1 2 4 8 16"}
+BENCH_IDLE=${BENCH_IDLE:-10}
+BENCH_OUTPUT=${BENCH_OUTPUT:-$top/bench/results/latency-$(date +%Y%m%d-%H%M%S).json}
+
+# Tamaño de cada monitor simulado; se colocan en filas de 4
+TILE_W=1280
+TILE_H=720
+
+for tool in Xvfb xrandr "$MOTIONWALL" "$MOTIONWALL_CTL" "$BENCH_PLAYER"; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "run-bench: $tool not found" >&2
+        exit 1
+    fi
+done
+if [ -e /tmp/motionwall.lock ] && ! flock -n /tmp/motionwall.lock true 2>/dev/null; then
+    echo "run-bench: another motionwall is running (/tmp/motionwall.lock), stop it first" >&2
+    exit 1
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/motionwall-bench.XXXXXX")
+xvfb_pid=
+daemon_pid=
+cleanup() {
+    [ -n "$daemon_pid" ] && kill "$daemon_pid" 2>/dev/null && wait "$daemon_pid" 2>/dev/null
+    [ -n "$xvfb_pid" ] && kill "$xvfb_pid" 2>/dev/null && wait "$xvfb_pid" 2>/dev/null
+    rm -rf "$work"
+}
+trap cleanup EXIT
+trap 'exit 130' INT TERM
+
+now_ns() {
+    date +%s%N
+}
+
+# CPU del proceso en ticks (utime + stime); comm va entre paréntesis
+cpu_ticks() {
+    sed 's/.*) //' "/proc/$1/stat" | awk '{ print $12 + $13 }'
+}
+
+# Esperar hasta que haya al menos $2 eventos $1 posteriores a $3 (ns)
+wait_events() {
+    deadline=$(( $(now_ns) + 30000000000 ))
+    while :; do
+        count=$(awk -v e="$1" -v t="$3" '$2 == e && $1 >= t' "$events" | wc -l)
+        [ "$count" -ge "$2" ] && return 0
+        [ "$(now_ns)" -ge "$deadline" ] && return 1
+        sleep 0.01
+    done
+}
+
+# Último evento $1 posterior a $2 (ns), en ms desde $2
+last_after_ms() {
+    awk -v e="$1" -v t="$2" '$2 == e && $1 >= t && $1 > m { m = $1 }
+        END { printf "%.1f", m ? (m - t) / 1e6 : -1 }' "$events"
+}
+
+mkdir -p "$work/media" "$work/run" "$work/home"
+chmod 700 "$work/run"
+# El reproductor falso no lee los archivos: basta con que existan
+for n in 1 2 3; do
+    printf 'motionwall bench clip %d\n' "$n" > "$work/media/clip-$n.mp4"
+done
+cat > "$work/bench.conf" <<EOF
+media_player=$BENCH_PLAYER
+playlist_duration=0
+multi_monitor=true
+auto_resize=false
+loop_cache=false
+pause_when_covered=false
+pause_when_blanked=false
+cgroups=false
+metrics=false
+trace_file=
+EOF
+
+mkdir -p "$(dirname "$BENCH_OUTPUT")"
+hz=$(getconf CLK_TCK)
+results=
+
+for monitors in $BENCH_MONITORS; do
+    cols=$(( monitors < 4 ? monitors : 4 ))
+    rows=$(( (monitors + 3) / 4 ))
+
+    # Servidor nuevo por tamaño: -displayfd elige un número libre
+    Xvfb -displayfd 3 -screen 0 "$(( cols * TILE_W ))x$(( rows * TILE_H ))x24" -nolisten tcp \
+        3>"$work/display" >/dev/null 2>&1 &
+    xvfb_pid=$!
+    while [ ! -s "$work/display" ]; do sleep 0.05; done
+    export DISPLAY=":$(cat "$work/display")"
+
+    output=$(xrandr | awk '/ connected/ { print $1; exit }')
+    m=0
+    while [ "$m" -lt "$monitors" ]; do
+        x=$(( (m % 4) * TILE_W ))
+        y=$(( (m / 4) * TILE_H ))
+        [ "$m" -eq 0 ] && attach=$output || attach=none
+        xrandr --setmonitor "BENCH-$(( m + 1 ))" "$TILE_W/338x$TILE_H/190+$x+$y" "$attach"
+        m=$(( m + 1 ))
+    done
+
+    events="$work/events-$monitors"
+    : > "$events"
+
+    start=$(now_ns)
+    HOME="$work/home" XDG_RUNTIME_DIR="$work/run" MOTIONWALL_BENCH_EVENTS="$events" \
+        "$MOTIONWALL" -c "$work/bench.conf" --logical-monitors "$work/media" >"$work/daemon-$monitors.log" 2>&1 &
+    daemon_pid=$!
+
+    if ! wait_events paint "$monitors" "$start"; then
+        echo "run-bench: $monitors monitor(s): players never painted, see log below" >&2
+        cat "$work/daemon-$monitors.log" >&2
+        exit 1
+    fi
+    first_paint=$(last_after_ms paint "$start")
+
+    # Reposo: solo el bucle principal del demonio
+    idle_ticks=$(cpu_ticks "$daemon_pid")
+    sleep "$BENCH_IDLE"
+    idle_ticks=$(( $(cpu_ticks "$daemon_pid") - idle_ticks ))
+
+    # Cambio de elemento en todos los monitores
+    switch=$(now_ns)
+    XDG_RUNTIME_DIR="$work/run" "$MOTIONWALL_CTL" next >/dev/null
+    wait_events paint "$monitors" "$switch"
+    switch_ms=$(last_after_ms paint "$switch")
+    gap_ms=$(awk -v t="$switch" '$1 >= t && $2 == "exit" { gone[$3] = $1 }
+        $1 >= t && $2 == "paint" && ($3 in gone) { g = ($1 - gone[$3]) / 1e6; if (g > max) max = g }
+        END { printf "%.1f", max }' "$events")
+
+    # Reproductor muerto: cuánto tarda el demonio en sustituirlo
+    victim=$(awk '$2 == "paint" { pid = $4 } END { print pid }' "$events")
+    killed=$(now_ns)
+    kill -KILL "$victim"
+    wait_events paint 1 "$killed"
+    restart_ms=$(last_after_ms paint "$killed")
+
+    total_ticks=$(cpu_ticks "$daemon_pid")
+    kill "$daemon_pid"
+    wait "$daemon_pid" 2>/dev/null
+    daemon_pid=
+    kill "$xvfb_pid"
+    wait "$xvfb_pid" 2>/dev/null
+    xvfb_pid=
+    rm -f "$work/display"
+
+    result=$(awk -v m="$monitors" -v fp="$first_paint" -v sw="$switch_ms" -v gap="$gap_ms" \
+                 -v rs="$restart_ms" -v idle="$idle_ticks" -v total="$total_ticks" \
+                 -v hz="$hz" -v secs="$BENCH_IDLE" 'BEGIN {
+        printf "{\"monitors\": %d, \"first_paint_ms\": %s, \"switch_ms\": %s, \"gap_ms\": %s, " \
+               "\"restart_ms\": %s, \"daemon_cpu_pct\": %.2f, \"daemon_cpu_s\": %.2f}",
+               m, fp, sw, gap, rs, idle / hz / secs * 100, total / hz }')
+    echo "$result"
+    results="${results:+$results,
+}  $result"
+done
+
+cat > "$BENCH_OUTPUT" <<EOF
+{
+ "kernel": "$(uname -r)",
+ "cpu": "$(awk -F': ' '/^model name/ { print $2; exit }' /proc/cpuinfo)",
+ "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+ "idle_seconds": $BENCH_IDLE,
+ "results": [
+$results
+ ]
+}
+EOF
+echo "run-bench: results saved to $BENCH_OUTPUT"
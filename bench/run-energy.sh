@@ -0,0 +1,338 @@
+#!/bin/sh
+# MotionWall - CPU and energy cost per wallpaper
+# Copyright © 2025 MotionWall Project
+#
+# Generates synthetic clips with ffmpeg (testsrc2) and plays each one on a
+# single Xvfb screen of the same size through every backend available:
+# mpv, mplayer, vlc and the in-process loop cache. Every profile is tried.
+# For each run it records, over BENCH_SECONDS after BENCH_WARMUP:
+#   cpu_s / cpu_pct  daemon plus every process it started, user + system,
+#                    including ones that already exited (the loop cache's
+#                    ffmpeg decoder): read from the run's own cgroup v2
+#                    (a systemd --user scope, or a leaf made as root);
+#                    without one, descendants are sampled every second
+#   rss_mb           peak resident memory of daemon plus descendants
+#   energy_j / watts package energy from RAPL (/sys/class/powercap), when
+#                    readable (usually root only); null otherwise
+# Results go to bench/results/energy-DATE.json plus a .txt table.
+#
+# Environment: BENCH_RESOLUTIONS ("1280x720 1920x1080 2560x1440 3840x2160"),
+# BENCH_CODECS ("h264 hevc vp9"), BENCH_FPS ("30 60"),
+# BENCH_BACKENDS ("mpv mplayer vlc loop-cache"),
+# BENCH_PROFILES ("eco balanced quality"), BENCH_SECONDS (20),
+# BENCH_WARMUP (3), BENCH_CLIPS (bench/clips), BENCH_OUTPUT, MOTIONWALL.
+
+set -u
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+MOTIONWALL=${MOTIONWALL:-$top/motionwall}
+BENCH_RESOLUTIONS=${BENCH_RESOLUTIONS:-"1280x720 1920x1080 2560x1440 3840x2160"}
+BENCH_CODECS=${BENCH_CODECS:-"h264 hevc vp9"}
+BENCH_FPS=${BENCH_FPS:-"30 60"}
+BENCH_BACKENDS=${BENCH_BACKENDS:-"mpv mplayer vlc loop-cache"}
+BENCH_PROFILES=${BENCH_PROFILES:-"eco balanced quality"}
+BENCH_SECONDS=${BENCH_SECONDS:-20}
+BENCH_WARMUP=${BENCH_WARMUP:-3}
+BENCH_CLIPS=${BENCH_CLIPS:-$top/bench/clips}
+BENCH_OUTPUT=${BENCH_OUTPUT:-$top/bench/results/energy-$(date +%Y%m%d-%H%M%S).json}
+
+for tool in Xvfb ffmpeg "$MOTIONWALL"; do
+    if ! command -v "$tool" >/dev/null 2>&1; then
+        echo "run-energy: $tool not found" >&2
+        exit 1
+    fi
+done
+if [ -e /tmp/motionwall.lock ] && ! flock -n /tmp/motionwall.lock true 2>/dev/null; then
+    echo "run-energy: another motionwall is running (/tmp/motionwall.lock), stop it first" >&2
+    exit 1
+fi
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/motionwall-energy.XXXXXX")
+xvfb_pid=
+daemon_pid=
+cleanup() {
+    [ -n "$daemon_pid" ] && kill "$daemon_pid" 2>/dev/null && wait "$daemon_pid" 2>/dev/null
+    [ -n "$xvfb_pid" ] && kill "$xvfb_pid" 2>/dev/null && wait "$xvfb_pid" 2>/dev/null
+    [ -d "/sys/fs/cgroup/motionwall-energy.$$" ] && rmdir "/sys/fs/cgroup/motionwall-energy.$$" 2>/dev/null
+    rm -rf "$work"
+}
+trap cleanup EXIT
+trap 'exit 130' INT TERM
+
+# Clips de 10 s en bucle; se reutilizan entre ejecuciones
+clip_path() {
+    echo "$BENCH_CLIPS/testsrc2-$1-$2-$3.$( [ "$2" = vp9 ] && echo webm || echo mp4 )"
+}
+
+make_clip() {
+    out=$(clip_path "$1" "$2" "$3")
+    [ -s "$out" ] && return 0
+    case "$2" in
+        h264) encoder="-c:v libx264 -preset veryfast -crf 23" ;;
+        hevc) encoder="-c:v libx265 -preset veryfast -crf 26 -tag:v hvc1" ;;
+        vp9)  encoder="-c:v libvpx-vp9 -deadline realtime -cpu-used 8 -b:v 0 -crf 33" ;;
+        *)    echo "run-energy: unknown codec $2" >&2; return 1 ;;
+    esac
+    mkdir -p "$BENCH_CLIPS"
+    # shellcheck disable=SC2086
+    ffmpeg -v error -y -f lavfi -i "testsrc2=size=$1:rate=$3:duration=10" \
+        -pix_fmt yuv420p $encoder "$out.tmp.${out##*.}" && mv "$out.tmp.${out##*.}" "$out"
+}
+
+# "pid" y campos de /proc/PID/stat del demonio y de todos sus descendientes
+# vivos, tras quitar "pid (comm) ": $3 ppid, $13/$14 utime/stime,
+# $23 rss en páginas
+tree_stat() {
+    cat /proc/[0-9]*/stat 2>/dev/null | awk -v root="$1" '{
+            pid = $1; line = $0; sub(/.*\) /, "", line); split(line, f, " ")
+            parent[pid] = f[2]; stat[pid] = line
+        }
+        END {
+            for (pid in stat) {
+                p = pid
+                for (depth = 0; depth < 64 && p != root && p in parent; depth++) p = parent[p]
+                if (p == root) print pid, stat[pid]
+            }
+        }'
+}
+
+tree_rss() {
+    tree_stat "$1" | awk -v page="$(getconf PAGESIZE)" '{ sum += $23 } END { printf "%d", sum * page / 1024 }'
+}
+
+# Ticks por proceso ("pid ticks"): sin cgroup se suman muestras, y de un
+# proceso que ya terminó cuenta lo último que se le vio
+tree_ticks_by_pid() {
+    tree_stat "$1" | awk '{ print $1, $13 + $14 }'
+}
+
+# CPU de toda la ejecución en µs desde el cpu.stat de su cgroup: incluye a
+# los hijos que ya terminaron (con SIGCHLD ignorado no llegan a cutime)
+cgroup_usage_usec() {
+    awk '$1 == "usage_usec" { print $2 }' "$1/cpu.stat"
+}
+
+# Cómo aislar cada ejecución: scope de systemd --user, hoja propia (root) o
+# muestreo del árbol de procesos
+cpu_mode=sampled
+if [ -r /sys/fs/cgroup/cgroup.controllers ]; then
+    if command -v systemd-run >/dev/null 2>&1 && systemd-run --user --scope --quiet true >/dev/null 2>&1; then
+        cpu_mode=scope
+    elif [ -w /sys/fs/cgroup/cgroup.procs ]; then
+        cpu_mode=leaf
+    fi
+fi
+
+run_cgroup=
+# Arrancar el demonio ("$@") en su propio cgroup; deja daemon_pid
+start_daemon() {
+    run_cgroup=
+    case "$cpu_mode" in
+        scope)
+            # systemd-run --scope hace exec: $! es el propio demonio
+            systemd-run --user --scope --quiet --collect "$@" >"$work/daemon.log" 2>&1 &
+            daemon_pid=$!
+            ;;
+        leaf)
+            run_cgroup=/sys/fs/cgroup/motionwall-energy.$$
+            mkdir -p "$run_cgroup"
+            sh -c 'echo $$ > "$0/cgroup.procs" && exec "$@"' "$run_cgroup" "$@" >"$work/daemon.log" 2>&1 &
+            daemon_pid=$!
+            ;;
+        *)
+            "$@" >"$work/daemon.log" 2>&1 &
+            daemon_pid=$!
+            ;;
+    esac
+}
+
+# Cgroup de la ejecución ya en marcha, o vacío si no se puede leer (y entonces
+# se muestrea)
+find_run_cgroup() {
+    if [ "$cpu_mode" = scope ]; then
+        run_cgroup=/sys/fs/cgroup$(sed -n 's/^0:://p' "/proc/$daemon_pid/cgroup" 2>/dev/null)
+        case "$run_cgroup" in *.scope) ;; *) run_cgroup= ;; esac
+    fi
+    [ -n "$run_cgroup" ] && [ ! -r "$run_cgroup/cpu.stat" ] && run_cgroup=
+}
+
+# Energía de los paquetes RAPL (intel-rapl:N, sin subzonas) en µJ;
+# vacío si no hay RAPL o no se puede leer
+rapl_zones() {
+    for zone in /sys/class/powercap/intel-rapl:[0-9] /sys/class/powercap/intel-rapl:[0-9][0-9]; do
+        [ -r "$zone/energy_uj" ] && echo "$zone"
+    done
+}
+
+rapl_read() {
+    for zone in $zones; do
+        echo "$(cat "$zone/energy_uj") $(cat "$zone/max_energy_range_uj")"
+    done
+}
+
+# Diferencia en julios entre dos lecturas, con la vuelta del contador
+rapl_joules() {
+    printf '%s\n--\n%s\n' "$1" "$2" | awk '$0 == "--" { after = 1; n = 0; next }
+        { n++; if (!after) { start[n] = $1; range[n] = $2 } else {
+              d = $1 - start[n]; if (d < 0) d += range[n]; total += d } }
+        END { printf "%.3f", total / 1e6 }'
+}
+
+backend_config() {
+    case "$1" in
+        loop-cache)
+            # Mismo mpv de respaldo, pero el clip se decodifica una vez a RAM
+            echo "media_player=mpv"
+            echo "loop_cache=true"
+            echo "loop_cache_max_seconds=15"
+            ;;
+        *)
+            echo "media_player=$1"
+            echo "loop_cache=false"
+            ;;
+    esac
+}
+
+backend_available() {
+    case "$1" in
+        loop-cache) command -v mpv >/dev/null 2>&1 ;;
+        *) command -v "$1" >/dev/null 2>&1 ;;
+    esac
+}
+
+zones=$(rapl_zones)
+[ -z "$zones" ] && echo "run-energy: RAPL not readable, energy will be null (run as root for it)" >&2
+[ "$cpu_mode" = sampled ] && echo "run-energy: no cgroup v2 for the runs, sampling CPU once a second" \
+    "(processes that exit between samples are undercounted)" >&2
+
+mkdir -p "$(dirname "$BENCH_OUTPUT")" "$work/home" "$work/run"
+chmod 700 "$work/run"
+hz=$(getconf CLK_TCK)
+results=
+table="$work/table"
+printf '%-10s %-8s %-9s %-5s %-3s %8s %7s %8s %9s %7s\n' \
+    backend profile resolution codec fps cpu_s cpu_% rss_mb energy_j watts > "$table"
+
+for resolution in $BENCH_RESOLUTIONS; do
+    # Una pantalla del tamaño del clip: sin escalado en el reproductor
+    Xvfb -displayfd 3 -screen 0 "${resolution}x24" -nolisten tcp 3>"$work/display" >/dev/null 2>&1 &
+    xvfb_pid=$!
+    while [ ! -s "$work/display" ]; do sleep 0.05; done
+    export DISPLAY=":$(cat "$work/display")"
+
+    for codec in $BENCH_CODECS; do
+        for fps in $BENCH_FPS; do
+            if ! make_clip "$resolution" "$codec" "$fps"; then
+                echo "run-energy: cannot encode $codec, skipping" >&2
+                continue
+            fi
+            clip=$(clip_path "$resolution" "$codec" "$fps")
+
+            for backend in $BENCH_BACKENDS; do
+                if ! backend_available "$backend"; then
+                    echo "run-energy: $backend not installed, skipping" >&2
+                    continue
+                fi
+                for profile in $BENCH_PROFILES; do
+                    {
+                        backend_config "$backend"
+                        echo "profile=$profile"
+                        echo "playlist_duration=0"
+                        echo "multi_monitor=false"
+                        echo "auto_resize=false"
+                        echo "pause_when_covered=false"
+                        echo "pause_when_blanked=false"
+                        echo "idle_levels="
+                        echo "battery_profile=none"
+                        echo "adaptive_quality=false"
+                        echo "psi_governor=false"
+                        echo "cgroups=false"
+                        echo "metrics=false"
+                    } > "$work/energy.conf"
+
+                    # env después de systemd-run: necesita el XDG_RUNTIME_DIR real
+                    start_daemon env HOME="$work/home" XDG_RUNTIME_DIR="$work/run" \
+                        "$MOTIONWALL" -c "$work/energy.conf" "$clip"
+                    sleep "$BENCH_WARMUP"
+                    if ! kill -0 "$daemon_pid" 2>/dev/null; then
+                        echo "run-energy: $backend/$profile/$resolution/$codec/$fps: daemon exited" >&2
+                        cat "$work/daemon.log" >&2
+                        daemon_pid=
+                        continue
+                    fi
+
+                    find_run_cgroup
+                    if [ -n "$run_cgroup" ]; then
+                        usage=$(cgroup_usage_usec "$run_cgroup")
+                    else
+                        tree_ticks_by_pid "$daemon_pid" > "$work/ticks-start"
+                        : > "$work/ticks"
+                    fi
+                    energy=$(rapl_read)
+                    peak_rss=0
+                    s=0
+                    while [ "$s" -lt "$BENCH_SECONDS" ]; do
+                        sleep 1
+                        rss=$(tree_rss "$daemon_pid")
+                        [ "${rss%.*}" -gt "${peak_rss%.*}" ] && peak_rss=$rss
+                        [ -z "$run_cgroup" ] && tree_ticks_by_pid "$daemon_pid" >> "$work/ticks"
+                        s=$(( s + 1 ))
+                    done
+                    if [ -n "$run_cgroup" ]; then
+                        ticks=$(awk -v u="$(( $(cgroup_usage_usec "$run_cgroup") - usage ))" -v hz="$hz" \
+                                    'BEGIN { printf "%d", u / 1e6 * hz }')
+                    else
+                        ticks=$(awk 'FNR == NR { start[$1] = $2; next }
+                                     $2 > last[$1] { last[$1] = $2 }
+                                     END { for (pid in last) sum += last[pid] - start[pid]; print sum + 0 }' \
+                                    "$work/ticks-start" "$work/ticks")
+                    fi
+                    joules=null
+                    [ -n "$zones" ] && joules=$(rapl_joules "$energy" "$(rapl_read)")
+
+                    kill "$daemon_pid"
+                    wait "$daemon_pid" 2>/dev/null
+                    daemon_pid=
+                    [ "$cpu_mode" = leaf ] && rmdir "$run_cgroup" 2>/dev/null
+
+                    row=$(awk -v t="$ticks" -v hz="$hz" -v secs="$BENCH_SECONDS" -v rss="$peak_rss" -v j="$joules" \
+                              'BEGIN { cpu = t / hz
+                                       printf "%.2f %.1f %.1f %s %s", cpu, cpu / secs * 100, rss / 1024, j,
+                                              j == "null" ? "null" : sprintf("%.2f", j / secs) }')
+                    set -- $row
+                    printf '%-10s %-8s %-9s %-5s %-3s %8s %7s %8s %9s %7s\n' \
+                        "$backend" "$profile" "$resolution" "$codec" "$fps" "$1" "$2" "$3" "$4" "$5" | tee -a "$table"
+                    line=$(printf '{"backend": "%s", "profile": "%s", "resolution": "%s", "codec": "%s", "fps": %s, ' \
+                               "$backend" "$profile" "$resolution" "$codec" "$fps"
+                           printf '"cpu_s": %s, "cpu_pct": %s, "rss_mb": %s, "energy_j": %s, "watts": %s}' \
+                               "$1" "$2" "$3" "$4" "$5")
+                    results="${results:+$results,
+}  $line"
+                done
+            done
+        done
+    done
+
+    kill "$xvfb_pid"
+    wait "$xvfb_pid" 2>/dev/null
+    xvfb_pid=
+    rm -f "$work/display"
+done
+
+cat > "$BENCH_OUTPUT" <<EOF
+{
+ "kernel": "$(uname -r)",
+ "cpu": "$(awk -F': ' '/^model name/ { print $2; exit }' /proc/cpuinfo)",
+ "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+ "seconds": $BENCH_SECONDS,
+ "rapl": $( [ -n "$zones" ] && echo true || echo false ),
+ "cpu_source": "$cpu_mode",
+ "results": [
+$results
+ ]
+}
+EOF
+cp "$table" "${BENCH_OUTPUT%.json}.txt"
+echo
+cat "$table"
+echo "run-energy: results saved to $BENCH_OUTPUT"
@@ -0,0 +1,31 @@
+/*
+ * MotionWall - Control socket protocol
+ * Copyright © 2025 MotionWall Project
+ *
+ * One command per connection: the client writes a single line
+ * ("next HDMI-1", "set-profile eco", "status"...) and the daemon answers
+ * "ok" or "error: <reason>" on the first line, optionally followed by
+ * more lines, and closes the connection.
+ */
+#ifndef MOTIONWALL_CONTROL_H
+#define MOTIONWALL_CONTROL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define MOTIONWALL_CONTROL_REQUEST_MAX 512
+#define MOTIONWALL_CONTROL_REPLY_MAX 65536
+
+// $XDG_RUNTIME_DIR/motionwall.sock, o sin él dentro del directorio privado
+// (0700) /tmp/motionwall-$UID que crea el daemon
+static inline void motionwall_control_path(char *buf, size_t size) {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (runtime_dir && runtime_dir[0]) {
+        snprintf(buf, size, "%s/motionwall.sock", runtime_dir);
+    } else {
+        snprintf(buf, size, "/tmp/motionwall-%d/motionwall.sock", (int)getuid());
+    }
+}
+
+#endif
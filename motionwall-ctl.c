@@ -0,0 +1,104 @@
+/*
+ * motionwall-ctl - Send runtime commands to a running MotionWall
+ * Copyright © 2025 MotionWall Project
+ *
+ * Acts on the live players (skip, pause, change profile...) without
+ * restarting the daemon and losing its warm state.
+ */
+#define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "motionwall-control.h"
+
+#define NAME "motionwall-ctl"
+
+static void usage(void) {
+   fprintf(stderr, "Usage: " NAME " [-s SOCKET] COMMAND [ARGS]\n");
+   fprintf(stderr, "Commands:\n");
+   fprintf(stderr, "  next [MONITOR]              Next playlist item (only on MONITOR if given)\n");
+   fprintf(stderr, "  prev [MONITOR]              Previous playlist item\n");
+   fprintf(stderr, "  pause [MONITOR]             Pause playback\n");
+   fprintf(stderr, "  resume [MONITOR]            Resume playback paused with 'pause'\n");
+   fprintf(stderr, "  reload                      Re-read the playlist directory or pattern\n");
+   fprintf(stderr, "  set-profile NAME [MONITOR]  eco, balanced or quality\n");
+   fprintf(stderr, "  log LEVEL [SUBSYSTEMS]      Change the log level and subsystems\n");
+   fprintf(stderr, "  status                      Show the daemon and window state\n");
+   fprintf(stderr, "MONITOR is an output name (HDMI-1) or a monitor number.\n");
+}
+
+int main(int argc, char **argv) {
+   char path[108];
+   motionwall_control_path(path, sizeof(path));
+
+   int opt;
+   while ((opt = getopt(argc, argv, "s:h")) != -1) {
+       switch (opt) {
+           case 's':
+               strncpy(path, optarg, sizeof(path) - 1);
+               path[sizeof(path) - 1] = '\0';
+               break;
+           default:
+               usage();
+               return opt == 'h' ? 0 : 1;
+       }
+   }
+   if (optind >= argc) {
+       usage();
+       return 1;
+   }
+
+   char request[MOTIONWALL_CONTROL_REQUEST_MAX];
+   size_t len = 0;
+   for (int i = optind; i < argc; i++) {
+       int n = snprintf(request + len, sizeof(request) - len, "%s%s", i > optind ? " " : "", argv[i]);
+       if (n < 0 || (size_t)n >= sizeof(request) - len - 1) {
+           fprintf(stderr, NAME ": command too long\n");
+           return 1;
+       }
+       len += n;
+   }
+   request[len++] = '\n';
+
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   memcpy(addr.sun_path, path, sizeof(addr.sun_path));
+   if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+       fprintf(stderr, NAME ": %s: %s (is motionwall running?)\n", path, strerror(errno));
+       return 1;
+   }
+   if (write(fd, request, len) != (ssize_t)len) {
+       perror(NAME ": write");
+       close(fd);
+       return 1;
+   }
+   shutdown(fd, SHUT_WR);
+
+   // Primera línea "ok" o "error: ..."; el resto va tal cual a stdout
+   static char reply[MOTIONWALL_CONTROL_REPLY_MAX];
+   size_t got = 0;
+   ssize_t n;
+   while (got < sizeof(reply) - 1 && (n = read(fd, reply + got, sizeof(reply) - 1 - got)) > 0) {
+       got += n;
+   }
+   close(fd);
+   reply[got] = '\0';
+
+   char *body = strchr(reply, '\n');
+   if (body) *body++ = '\0';
+   if (strcmp(reply, "ok") != 0) {
+       fprintf(stderr, NAME ": %s\n", reply[0] ? reply : "no reply");
+       return 1;
+   }
+   if (body) fputs(body, stdout);
+   return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * motionwall-stat - Print MotionWall's live stats from shared memory
+ * Copyright © 2025 MotionWall Project
+ *
+ * Reads the seqlock-protected segment published by the daemon; never
+ * wakes the daemon up, so it can be polled at any rate.
+ */
+#define _XOPEN_SOURCE 500
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "motionwall-stats.h"
+
+#define NAME "motionwall-stat"
+
+static long long monotonic_ms(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(void) {
+   fprintf(stderr, "Usage: " NAME " [-i SECONDS] [-n COUNT] [-u UID]\n");
+   fprintf(stderr, "  -i SECONDS  Repeat every SECONDS (may be fractional)\n");
+   fprintf(stderr, "  -n COUNT    Stop after COUNT samples (with -i)\n");
+   fprintf(stderr, "  -u UID      Read another user's daemon\n");
+}
+
+static void print_stats(const motionwall_stats *stats) {
+   long long now = monotonic_ms();
+   bool alive = stats->pid > 0 && (kill(stats->pid, 0) == 0 || errno == EPERM);
+
+   printf("motionwall pid %d%s, up %.0fs, updated %.1fs ago\n", stats->pid, alive ? "" : " (not running)",
+          (now - stats->start_ms) / 1000.0, (now - stats->update_ms) / 1000.0);
+   printf("cpu %.2fs  rss %.1f MB  psi %d  battery %s  idle cap %d fps\n", stats->cpu_seconds,
+          stats->rss_bytes / (1024.0 * 1024.0), stats->psi_level, stats->on_battery ? "yes" : "no",
+          stats->idle_fps_cap);
+   printf("reconfigurations %llu (last %.2fs)  transitions %llu (last %.2fs)\n",
+          (unsigned long long)stats->reconfigurations, stats->last_reconfiguration_seconds,
+          (unsigned long long)stats->transitions, stats->last_transition_seconds);
+
+   printf("%-3s %-10s %-10s %-8s %7s %7s %6s %4s %4s %7s %8s %9s\n", "win", "monitor", "engine", "profile",
+          "pid", "fps", "drop%", "qlvl", "cap", "threads", "restarts", "uptime");
+   for (uint32_t i = 0; i < stats->window_count && i < MOTIONWALL_STATS_WINDOWS; i++) {
+       const motionwall_window_stats *win = &stats->windows[i];
+       char uptime[32] = "-";
+       if (win->started_ms > 0) {
+           snprintf(uptime, sizeof(uptime), "%.0fs", (now - win->started_ms) / 1000.0);
+       }
+       printf("%-3u %-10.10s %-10.10s %-8.8s %7d %7.1f %6.1f %4d %4d %7d %8llu %9s%s\n", i, win->monitor,
+              win->engine, win->profile, win->player_pid, win->delivered_fps, win->drop_ratio * 100.0,
+              win->quality_level, win->fps_cap, win->decoder_threads,
+              (unsigned long long)win->player_restarts, uptime, win->paused ? "  paused" : "");
+   }
+}
+
+int main(int argc, char **argv) {
+   double interval = 0;
+   long count = 0;
+   int uid = (int)getuid();
+
+   int opt;
+   while ((opt = getopt(argc, argv, "i:n:u:h")) != -1) {
+       switch (opt) {
+           case 'i': interval = atof(optarg); break;
+           case 'n': count = atol(optarg); break;
+           case 'u': uid = atoi(optarg); break;
+           default:
+               usage();
+               return opt == 'h' ? 0 : 1;
+       }
+   }
+
+   char path[64];
+   snprintf(path, sizeof(path), MOTIONWALL_STATS_PATH_FORMAT, uid);
+   int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+   if (fd < 0) {
+       fprintf(stderr, NAME ": %s: %s (is motionwall running?)\n", path, strerror(errno));
+       return 1;
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != (uid_t)uid) {
+       fprintf(stderr, NAME ": %s: not a segment published by uid %d\n", path, uid);
+       close(fd);
+       return 1;
+   }
+   if ((size_t)st.st_size < sizeof(motionwall_stats)) {
+       fprintf(stderr, NAME ": %s: segment too small\n", path);
+       close(fd);
+       return 1;
+   }
+   const motionwall_stats *shared = mmap(NULL, sizeof(motionwall_stats), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (shared == MAP_FAILED) {
+       perror(NAME ": mmap");
+       return 1;
+   }
+   if (shared->magic != MOTIONWALL_STATS_MAGIC || shared->version != MOTIONWALL_STATS_VERSION) {
+       fprintf(stderr, NAME ": %s: unknown format (version %u)\n", path, shared->version);
+       return 1;
+   }
+
+   for (long n = 0; count <= 0 || n < count; n++) {
+       motionwall_stats stats;
+       if (!motionwall_stats_read(shared, &stats)) {
+           fprintf(stderr, NAME ": could not get a consistent snapshot\n");
+           return 1;
+       }
+       if (n > 0) printf("\n");
+       print_stats(&stats);
+       fflush(stdout);
+
+       if (interval <= 0) break;
+       usleep((useconds_t)(interval * 1e6));
+   }
+   return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * MotionWall - Shared memory stats segment
+ * Copyright © 2025 MotionWall Project
+ *
+ * The daemon publishes its counters in /dev/shm/motionwall-$UID, a regular
+ * file owned by that user with mode 0600. Readers map it read-only and never
+ * talk to the daemon: a seqlock tells them when a snapshot was torn by a
+ * concurrent update and has to be copied again.
+ */
+#ifndef MOTIONWALL_STATS_H
+#define MOTIONWALL_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define MOTIONWALL_STATS_MAGIC 0x5453574dU  // "MWST"
+#define MOTIONWALL_STATS_VERSION 1
+#define MOTIONWALL_STATS_WINDOWS 16
+#define MOTIONWALL_STATS_PATH_FORMAT "/dev/shm/motionwall-%d"
+
+typedef struct {
+    char monitor[32];
+    char engine[16];           // player, gif, loop, static, slideshow, procedural
+    char profile[16];
+    int32_t player_pid;
+    uint32_t paused;
+    uint32_t pause_reasons;    // Bits: cubierto, pantalla apagada, batería, presión, usuario
+    int32_t quality_level;
+    int32_t fps_cap;           // 0 = sin límite
+    int32_t decoder_threads;
+    uint64_t player_restarts;
+    int64_t started_ms;        // CLOCK_MONOTONIC, igual que update_ms
+    double delivered_fps;
+    double drop_ratio;
+} motionwall_window_stats;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq;              // Seqlock: impar mientras el daemon escribe
+    int32_t pid;
+    int64_t start_ms;          // CLOCK_MONOTONIC en milisegundos
+    int64_t update_ms;
+    double cpu_seconds;
+    int64_t rss_bytes;
+    uint64_t reconfigurations;
+    double reconfiguration_seconds;
+    double last_reconfiguration_seconds;
+    uint64_t transitions;
+    double transition_seconds;
+    double last_transition_seconds;
+    int32_t psi_level;
+    int32_t on_battery;
+    int32_t idle_fps_cap;
+    uint32_t window_count;
+    motionwall_window_stats windows[MOTIONWALL_STATS_WINDOWS];
+} motionwall_stats;
+
+// Escritor (un solo hilo): begin, modificar, end
+static inline void motionwall_stats_begin(motionwall_stats *stats) {
+    __atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void motionwall_stats_end(motionwall_stats *stats) {
+    __atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Lector: copia consistente; false si el daemon está escribiendo sin parar
+static inline int motionwall_stats_read(const motionwall_stats *shared, motionwall_stats *copy) {
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        uint32_t before = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;
+        memcpy(copy, (const void *)shared, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == before) return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -17,6 +17,7 @@
  * appear in supporting documentation.
  */
 #define _XOPEN_SOURCE 500  // Para usleep
+#define _DEFAULT_SOURCE    // syscall(): ioprio_set y sched_setaffinity
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/Xatom.h>
@@ -24,8 +25,12 @@
 #include <X11/extensions/shape.h>
 #include <X11/extensions/Xrender.h>
 #include <X11/extensions/Xrandr.h>
+#include <X11/extensions/XShm.h>
+#include <X11/extensions/dpms.h>
+#include <X11/extensions/scrnsaver.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -34,12 +39,32 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/netlink.h>
 #include <dirent.h>
+#include <utime.h>
 #include <time.h>
 #include <glob.h>
 #include <libgen.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sys/xattr.h>
+
+#include "motionwall-stats.h"
+#include "motionwall-control.h"
 
 #define NAME "motionwall"
 #define VERSION "1.0.1"
@@ -49,6 +74,74 @@
 #define MAX_PATH 8192
 #define MAX_CMD_ARGS 64
 #define MAX_ARG_LEN 256
+#define GIF_MIN_DELAY_MS 20     // Igual que los navegadores: delays < 20ms se tratan como 100ms
+#define GIF_DEFAULT_DELAY_MS 100
+#define MAIN_LOOP_TICK_MS 100
+#define STATIC_IDLE_TICK_MS 1000 // Sin nada que animar basta con despertar cada segundo
+#define OCCLUSION_CHECK_MS 5000 // Respaldo por si se pierde algún evento de clientes
+#define OCCLUSION_EVENT_MS 100  // Agrupar ráfagas de eventos (arrastrar una ventana)
+#define IDLE_CHECK_MS 1000      // DPMS e inactividad no tienen eventos: consultar
+#define IDLE_CHECK_THROTTLED_MS 250 // Más a menudo si hay que volver a fps completos
+#define MAX_IDLE_LEVELS 4
+#define MPV_FPS_FILTER "@mwfps"  // Etiqueta del filtro fps que añadimos por IPC
+#define MPV_OUTPUT_FILTER "@mwout" // Límites del monitor, fijados al arrancar
+#define METRICS_BUFFER_SIZE 65536
+#define STATS_PUBLISH_MS 250        // Contadores en memoria compartida
+#define TRACE_RING_EVENTS 65536     // Spans guardados; los más viejos se pisan
+#define LOG_RING_ENTRIES 512        // Mensajes pendientes por hilo
+#define LOG_MESSAGE_SIZE 240
+#define LOG_MAX_THREADS 16
+#define LOG_RATE_PER_SECOND 100     // Por hilo y subsistema; el exceso se cuenta y se descarta
+#define LOG_WRITE_BUFFER 65536
+#define ACCOUNTING_ITEMS 64         // Elementos de la lista con coste medido
+#define ACCOUNTING_MIN_SECONDS 30   // Reproducción medida antes de fiarse del coste
+#define STATS_PROCESS_SAMPLE_MS 1000 // CPU y RSS propios (leen /proc)
+#define METRICS_REQUEST_WAIT_MS 100 // Esperar a ver si el cliente habla HTTP
+#define METRICS_MAX_CLIENTS 4       // Conexiones de métricas esperando su petición
+#define CONTROL_REQUEST_WAIT_MS 1000 // Plazo para que motionwall-ctl mande su línea entera
+#define CONTROL_MAX_CLIENTS 2       // Conexiones de control a medio leer
+#define MAX_WATCHED_FDS 24     // Descriptores extra que espera el bucle principal
+#define CPU_MASK_WORDS 16      // Máscara de afinidad: hasta 1024 CPUs
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#ifndef SCHED_BATCH
+#define SCHED_BATCH 3
+#endif
+#ifndef SCHED_IDLE
+#define SCHED_IDLE 5
+#endif
+#define POWER_SUPPLY_DIR "/sys/class/power_supply"
+#define PSI_WINDOW_US 2000000  // Ventana de triggers PSI (mínimo sin privilegios: 2s)
+#define PSI_SAMPLE_MS 2000     // Lectura de avg10 para recuperar (y sin triggers)
+#define PSI_ESCALATE_MS 4000   // Como mucho un escalón de degradación cada 4s
+#define PSI_RECOVER_MS 10000   // Presión baja sostenida antes de recuperar un escalón
+#define PSI_LEVEL_MAX 4
+#define CGROUP_PLAYERS_DIR "motionwall-players" // Subárbol con una hoja por ventana
+#define CGROUP_DAEMON_DIR "motionwall-daemon"   // Hoja para el propio daemon
+#define QUALITY_SAMPLE_MS 5000    // Cada cuánto medir frames perdidos por ventana
+#define QUALITY_DROP_HIGH 0.05    // >5% de frames perdidos: bajar calidad
+#define QUALITY_DROP_LOW 0.01     // <1%: hay margen
+#define QUALITY_RECOVER_SAMPLES 6 // Muestras seguidas con margen para subir (30s)
+#define QUALITY_LEVEL_MAX 3       // 1 escalador barato, 2 decodificación/resolución reducida, 3 mitad de fps
+#define QUALITY_STALL_MS 150      // Vuelta del bucle más larga: sus frames perdidos no cuentan
+#define SLIDESHOW_FADE_STEP_MS 16 // ~60 pasos por segundo durante los fundidos
+#define PRESCALED_MAGIC "MWRAW1\0\0"
+#define IMAGE_PREFETCH_AHEAD 3     // Elementos de la lista que se pre-escalan por delante
+#define PROBE_CACHE_SIZE 64        // Resultados de ffprobe guardados por ruta
+#define PROBE_MAX_RUNNING 4        // ffprobe en marcha a la vez, sin bloquear el bucle
+#define PRESCALED_HEADER_SIZE 16 // magic(8) + ancho(4) + alto(4), seguido de BGRX
+#define GENERATOR_PREFIX "generator:"
+
+// Motivos por los que una ventana se pone en pausa (se combinan)
+#define PAUSE_COVERED (1u << 0) // Tapada por completo por otros clientes
+#define PAUSE_BLANKED (1u << 1) // Monitores en DPMS off o salvapantallas activo
+#define PAUSE_BATTERY (1u << 2) // Perfil de batería (congelar o solo el primario)
+#define PAUSE_PRESSURE (1u << 3) // Gobernador PSI bajo carga del sistema
+#define PAUSE_USER (1u << 4)     // motionwall-ctl pause
+#define MAX_RENDER_THREADS 16
+#define STARFIELD_STARS 600
 #define ATOM(a) XInternAtom(display, #a, False)
 
 Display *display = NULL;
@@ -77,20 +170,236 @@ typedef enum {
     DE_AWESOME
 } desktop_environment;
 
+typedef enum {
+    ENGINE_PLAYER = 0,   // Reproductor externo (mpv, mplayer, vlc)
+    ENGINE_GIF,          // Motor GIF nativo con pixmaps pre-renderizados
+    ENGINE_LOOP_CACHE,   // Clip corto reproducido desde frames comprimidos en RAM
+    ENGINE_STATIC,       // Imagen fija pintada en el pixmap raíz, sin ventana
+    ENGINE_SLIDESHOW,    // Diapositivas con fundidos XRender desde la cache cruda
+    ENGINE_PROCEDURAL,   // Fondo generado en el proceso (plasma, estrellas...)
+} media_engine;
+
+// Animación GIF decodificada una sola vez y guardada en pixmaps del servidor
+typedef struct {
+    Pixmap *frames;
+    Picture *pictures;      // Solo si scale_on_blit: escalado por XRender en cada frame
+    Picture target;         // Picture de la ventana destino (scale_on_blit)
+    int *delays_ms;
+    int frame_count;
+    int current;
+    unsigned int frame_width, frame_height;
+    bool scale_on_blit;     // Frames a tamaño nativo porque no caben en el presupuesto
+    long long next_frame_ms;
+} gif_animation;
+
+// Información básica del stream de vídeo obtenida con ffprobe
+typedef struct {
+    unsigned int width, height;
+    double fps;
+    double duration;
+    bool has_video;
+} media_probe;
+
+typedef struct frame_sink frame_sink;
+
+// Operaciones de un destino de frames (X, descarte o archivo crudo)
+typedef struct {
+    const char *name;
+    bool (*open)(frame_sink *sink);
+    void (*present)(frame_sink *sink, int first, int last);
+    void (*close)(frame_sink *sink);
+} frame_sink_ops;
+
+// Destino de los frames BGRX de los motores internos; el motor escribe en
+// pixels y present() publica las filas cambiadas
+struct frame_sink {
+    const frame_sink_ops *ops;
+    unsigned int width, height;
+    uint32_t *pixels;
+    Window window;           // Sink X
+    Visual *visual;
+    XImage *image;
+    XShmSegmentInfo shm;
+    bool use_shm;
+    const char *path;        // Sink de archivo
+    int fd;
+    unsigned long frames;    // Frames presentados
+    unsigned long long bytes_written;
+};
+
+// Clip corto decodificado una vez a la resolución del monitor y guardado
+// en RAM como deltas XOR comprimidos contra el frame anterior
+typedef struct loop_clip {
+    char path[MAX_PATH];
+    unsigned int width, height;
+    double frame_ms;
+    uint8_t **frames;
+    uint32_t *frame_sizes;
+    int *dirty_first, *dirty_last;  // Filas cambiadas en cada frame
+    int frame_count;
+    int capacity;
+    size_t bytes;
+    bool complete;           // Primer loop decodificado entero
+    bool failed;             // No cacheable: se usa el reproductor externo
+    pid_t decoder_pid;
+    int decoder_fd;
+    uint32_t *read_buf;      // Frame crudo en curso desde ffmpeg
+    size_t read_filled;
+    uint32_t *prev_raw;      // Referencia para el delta del siguiente frame
+    uint8_t *scratch;
+    int refs;
+    long long last_used_ms;
+    double decoder_cpu_sec;
+    struct loop_clip *next;
+} loop_clip;
+
+// Estado de reproducción desde la cache de una ventana
+typedef struct {
+    loop_clip *clip;
+    frame_sink sink;         // Frame reconstruido (BGRX) y su destino
+    int index;               // Próximo frame a mostrar
+    int pending_first, pending_last; // Filas aplicadas y aún no enviadas (fps limitado)
+    long long last_present_ms;
+    int loops;
+    long long loop_start_ms;
+    double loop_cpu_start;
+} loop_playback;
+
+// Imagen ya escalada a la resolución del monitor, mapeada desde la cache
+typedef struct {
+    void *map;               // Mapeo del archivo .bgrx (NULL si no hay cache)
+    size_t map_size;
+    uint32_t *owned;         // Buffer propio cuando no se pudo escribir la cache
+    const uint32_t *pixels;
+    unsigned int width, height;
+} prescaled_image;
+
+// Estado del modo diapositivas de una ventana
+typedef struct {
+    Pixmap current, next;
+    Picture current_pic, next_pic, window_pic;
+    long long fade_start_ms;
+    bool fading;
+} slideshow_state;
+
+// Vectores de 4 lanes (SSE2 en x86-64, NEON en ARM) para los generadores
+typedef float v4f __attribute__((vector_size(16)));
+typedef int32_t v4i __attribute__((vector_size(16)));
+
+static inline v4f v4f_splat(float v) { return (v4f){v, v, v, v}; }
+static inline v4i v4i_splat(int32_t v) { return (v4i){v, v, v, v}; }
+
+// PRNG pequeño y determinista para el campo de estrellas
+static inline uint32_t xorshift32(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+typedef struct generator_state generator_state;
+
+// Un generador procedural: prepare() corre una vez por frame en el hilo
+// principal, render_rows() pinta una franja de filas en cualquier hilo
+typedef struct {
+    const char *name;
+    void (*prepare)(generator_state *gen, float t);
+    void (*render_rows)(generator_state *gen, int y0, int y1, float t);
+} generator_def;
+
+struct generator_state {
+    const generator_def *def;
+    uint32_t *pixels;        // BGRX a resolución interna
+    int width, height;
+    int stride;              // Ancho redondeado a múltiplo de 4
+    void *priv;
+    uint32_t rng;
+    float last_t;
+};
+
+typedef struct {
+    float x, y, z;
+} starfield_star;
+
+// Estado de un fondo procedural en una ventana
+typedef struct {
+    generator_state gen;
+    XImage *image;
+    Pixmap small;            // Frame a resolución interna en el servidor
+    Picture small_pic;       // Con transformación de escala hacia la ventana
+    Picture window_pic;
+    long long start_ms, next_frame_ms;
+} procedural_state;
+
 typedef struct {
     char name[256];
     int x, y;
     unsigned int width, height;
+    double refresh;          // Hz del modo actual (0 = desconocido)
     bool primary;
     bool connected;
 } monitor_info;
 
+// Perfil de rendimiento: opciones concretas por reproductor más los límites
+// que aplicamos nosotros (fps y parte de los hilos de decodificación)
+typedef struct {
+    const char *name;
+    const char *mpv[8];
+    const char *mplayer[8];
+    const char *mplayer_lavdopts;  // Se une a threads=N en un único -lavdopts
+    const char *vlc[8];
+    int fps_cap;                   // 0 = sin límite propio
+    int thread_percent;            // % de la parte de hilos de la ventana
+} performance_profile;
+
+// Opciones por monitor (monitor.<SALIDA>.clave=valor); vacío = usar la global
+typedef struct {
+    char name[64];
+    char profile[16];
+    char player_sched[16];
+    char player_ioprio[16];
+    char player_cpus[64];
+    int player_nice;
+    bool has_nice;
+    int max_fps;             // 0 = tasa de refresco del monitor
+    bool match_output;
+    bool has_match_output;
+} monitor_override;
+
+// Planificación de un reproductor, resuelta antes de fork()
+typedef struct {
+    int policy;             // SCHED_OTHER, SCHED_BATCH o SCHED_IDLE
+    int nice;
+    int ioprio;             // Valor para ioprio_set, -1 = no tocar
+    bool set_cpus;
+    unsigned long cpus[CPU_MASK_WORDS];
+} player_sched;
+
 typedef struct {
     monitor_info monitors[MAX_MONITORS];
     int count;
     int primary_index;
 } monitor_setup;
 
+// Recursos consumidos por reproductores, leídos de /proc/<pid>/{stat,status,io}
+typedef struct {
+    double cpu_seconds;
+    unsigned long long voluntary_switches;
+    unsigned long long involuntary_switches;
+    unsigned long long read_bytes;   // rchar: lecturas incluidas las servidas por la caché
+    long rss_kb;                     // Última muestra
+    long pss_kb;
+    long peak_rss_kb;
+    double play_seconds;             // Tiempo sin pausa cubierto por las muestras
+} player_usage;
+
+typedef struct {
+    char path[MAX_PATH];
+    double pixels;                   // Píxeles por frame del archivo
+    player_usage usage;              // Suma de todas las ventanas que lo reprodujeron
+} item_usage;
+
 typedef struct {
     char paths[MAX_PLAYLIST][MAX_PATH];
     int count;
@@ -114,17 +423,108 @@ typedef struct {
     bool player_active;  // Estado del reproductor
     time_t player_start_time; // Tiempo de inicio del reproductor
     bool needs_resize;   // Indica si la ventana necesita redimensionarse
+    media_engine engine; // Motor que está pintando la ventana
+    gif_animation *gif;  // Estado del motor GIF nativo (ENGINE_GIF)
+    loop_playback *loop; // Reproducción desde la cache de loops (ENGINE_LOOP_CACHE)
+    bool mapped;         // La ventana está mapeada (no lo está en modo imagen fija)
+    slideshow_state *slide; // Modo diapositivas (ENGINE_SLIDESHOW)
+    long long last_switch_us; // Duración del último cambio de imagen
+    procedural_state *procedural; // Generador procedural (ENGINE_PROCEDURAL)
+    unsigned int pause_reasons;   // Motivos de pausa activos (PAUSE_*)
+    bool paused;                  // Reproductor con SIGSTOP o motor sin avanzar
+    bool fully_obscured;          // Último VisibilityNotify de la ventana
+    int visibility;               // Su estado (VisibilityUnobscured = 0 al crearla)
+    Pixmap frozen_frame;          // Último frame, como fondo mientras está en pausa
+    long long paused_since_ms;
+    double paused_cpu_rate;       // CPU-s por segundo del motor antes de pausar
+    pid_t cpu_ref_pid;            // Referencia para estimar ese ritmo
+    double cpu_ref_sec;
+    long long cpu_ref_ms;
+    char ipc_path[108];           // Socket --input-ipc-server de mpv
+    int applied_fps_cap;          // Límite de fps aplicado al motor (0 = ninguno)
+    bool applied_reduced_res;     // Media resolución aplicada al motor
+    bool applied_cheap_scaler;    // Escalador rápido aplicado al motor
+    char saved_scale[32];         // Escaladores de mpv antes de cambiarlos
+    char saved_dscale[32];
+    char saved_skiploopfilter[16]; // Atajos del decodificador antes de activarlos
+    char saved_lavc_fast[8];
+    int quality_level;            // Control de calidad por frames perdidos (0 = completa)
+    double source_fps;            // fps del archivo según el reproductor
+    unsigned long frames_shown;   // Contadores de los motores internos
+    unsigned long frames_dropped;
+    pid_t quality_ref_pid;        // Referencias de la última muestra
+    media_engine quality_ref_engine;
+    double quality_ref_shown, quality_ref_dropped;
+    long long quality_ref_ms;
+    int quality_good_samples;
+    double delivered_fps;         // Última medida del control de calidad
+    double drop_ratio;
+    unsigned long player_restarts; // Reinicios por muerte o cuelgue del reproductor
+    long long started_ms;         // Arranque del motor o reproductor actual
+    char cgroup_path[MAX_PATH];   // Hoja cgroup v2 de los reproductores de la ventana
+    int decoder_threads;          // Parte del presupuesto de hilos de decodificación
+    char output_filter[128];      // Filtro de salida con el que arrancó el reproductor
+    const performance_profile *profile; // Perfil con el que arrancó
+    double item_pixels;           // Píxeles por frame del elemento que reproduce
+    player_usage usage;           // Suma de todos los reproductores de la ventana
+    player_usage usage_ref;       // Última muestra del reproductor actual
+    pid_t usage_pid;
+    long long usage_ms;
+    int usage_item;               // Entrada en item_usage del elemento actual, -1 = ninguna
+    int playlist_item;            // Elemento propio tras "next/prev MONITOR", -1 = el de la lista
 } window_info;
 
 typedef struct {
     bool multi_monitor;
+    bool logical_monitors; // Usar los monitores de xrandr --setmonitor en lugar de las salidas
     bool auto_resolution;
     bool playlist_mode;
     bool compositor_aware;
     bool auto_resize;    // Nueva opción para auto-resize
     char config_file[MAX_PATH];
     char media_player[256];
-    char player_args[1024];
+    char player_args[1024]; // Argumentos extra tras los del perfil (ganan a estos)
+    char profile[16];       // eco, balanced o quality
+    bool native_gif;     // Usar el motor GIF interno en lugar del reproductor
+    int gif_memory_mb;   // Presupuesto de pixmaps por ventana para frames escalados
+    bool loop_cache;     // Decodificar clips cortos una vez y repetirlos desde RAM
+    int loop_cache_mb;   // Presupuesto de RAM de toda la máquina para la cache
+    int loop_cache_max_seconds;
+    bool slideshow;      // Imágenes en la ventana con fundidos en lugar del pixmap raíz
+    int slideshow_fade_ms;
+    int image_cache_mb;  // Disco para imágenes pre-escaladas; las menos usadas se borran
+    int generator_fps;   // Frames por segundo de los fondos procedurales
+    int generator_scale; // Divisor de resolución interna (se escala en el servidor)
+    int generator_threads;
+    bool pause_when_covered; // Congelar el fondo si lo tapan ventanas a pantalla completa
+    bool pause_when_blanked; // Suspender con DPMS off o salvapantallas
+    char idle_levels[128];   // "segundos:fps,..." para bajar fps sin actividad
+    char battery_profile[16]; // none, fps, primary o freeze
+    int battery_fps;
+    bool psi_governor;       // Degradar por escalones bajo presión (PSI)
+    int psi_fps;
+    bool adaptive_quality;   // Bajar calidad de la ventana si pierde frames
+    bool cgroups;            // Una hoja cgroup v2 por reproductor con límites propios
+    char cgroup_parent[MAX_PATH]; // Cgroup delegado bajo el que crear las hojas (vacío = el propio)
+    int cgroup_cpu_percent;  // cpu.max en % de un núcleo (0 = sin límite)
+    int cgroup_cpu_weight;   // cpu.weight (0 = el del kernel, 100)
+    int cgroup_memory_high_mb; // memory.high: se frena y recupera memoria (0 = sin límite)
+    int cgroup_memory_max_mb;  // memory.max: el OOM killer actúa dentro de la hoja (0 = sin límite)
+    char player_sched[16];   // idle, batch o normal
+    int player_nice;         // Nice para batch/normal
+    char player_ioprio[16];  // idle, low o none
+    char player_cpus[64];    // Afinidad (p.ej. "2-3,6"), vacío = todas
+    int decoder_threads;     // Hilos de decodificación a repartir (0 = núcleos disponibles)
+    bool match_output;       // No decodificar más fps ni píxeles de los que muestra el monitor
+    bool metrics;            // Servir métricas de Prometheus en un socket Unix
+    bool stats_segment;      // Publicar estadísticas en /dev/shm/motionwall-$UID
+    bool control;            // Aceptar órdenes de motionwall-ctl
+    int accounting_interval; // Segundos entre muestras de /proc de los reproductores (0 = nunca)
+    char trace_file[MAX_PATH]; // Traza JSON de Chrome (vacío = sin trazado)
+    int log_level;           // error, warn, info, debug, trace (--debug sube a debug)
+    char log_subsystems[128]; // "all" o lista: core,x11,monitor,player,...
+    monitor_override monitor_overrides[MAX_MONITORS];
+    int monitor_override_count;
     desktop_environment de;
     playlist media_playlist;
     monitor_setup monitors;
@@ -133,6 +533,137 @@ typedef struct {
 } motionwall_config;
 
 static motionwall_config config = {0};
+static loop_clip *loop_cache = NULL;  // Clips cacheados (y tombstones de no cacheables)
+static size_t loop_cache_bytes = 0;
+static Display *root_display = NULL;  // Conexión RetainPermanent para el pixmap raíz
+static Pixmap root_pixmap = None;
+static unsigned int root_pixmap_width = 0, root_pixmap_height = 0;
+static Pixmap root_pixmap_retired = None;     // Se libera tras publicar el nuevo
+static Pixmap root_pixmaps_created[16];       // Ids propios: nunca XKillClient sobre ellos
+static int root_pixmaps_created_count = 0;
+
+// Tiempo y CPU ahorrados por las pausas
+static double paused_seconds_total = 0.0;
+static double paused_cpu_seconds_saved = 0.0;
+static int pause_count = 0;
+static bool occlusion_error = false;
+static bool occlusion_dirty = false;  // Algún cliente se movió, apareció o cambió de estado
+static long long quality_stall_ms = 0; // Última vez que el bucle principal se quedó bloqueado
+
+// Estado de energía de la sesión: pantallas apagadas e inactividad
+static int screensaver_event_base = -1;
+static bool screens_blanked = false;
+static int idle_fps_cap = 0;       // fps por inactividad (0 = sin límite)
+static volatile sig_atomic_t profile_cycle_pending = 0; // SIGUSR1: pasar al siguiente perfil
+static int control_playlist_step = 0; // motionwall-ctl next/prev para todas las ventanas
+
+// Lo que la línea de comandos pide además de opciones de configuración
+typedef struct {
+    char media_path[MAX_PATH];
+    const char *bench;
+    const char *sink_file;
+    bool daemon_mode;
+    bool save_config;
+} command_line;
+
+// Recarga en caliente: SIGHUP o un cambio en los archivos de configuración
+static volatile sig_atomic_t config_reload_pending = 0;
+static int saved_argc = 0;
+static char **saved_argv = NULL;
+static char config_sources[4][MAX_PATH]; // Archivos leídos (el por defecto y -c)
+static int config_source_count = 0;
+static int config_watch_fd = -1;
+
+// Socket de control (motionwall-ctl)
+static int control_fd = -1;
+static char control_path[108] = "";
+// Conexiones aceptadas cuya línea aún no llegó entera
+static struct {
+    int fd;
+    long long deadline_ms;   // Sin línea completa para entonces: se cierra sin ejecutar
+    size_t length;
+    char request[MOTIONWALL_CONTROL_REQUEST_MAX];
+} control_clients[CONTROL_MAX_CLIENTS];
+static int control_client_count = 0;
+static char playlist_source[MAX_PATH] = ""; // Ruta con la que se creó la lista, para "reload"
+
+// Elementos ya mostrados, para volver atrás también en modo aleatorio
+static int playlist_history[32];
+static int playlist_history_count = 0;
+
+// Contadores del daemon para el endpoint de métricas
+static struct {
+    long long start_ms;
+    unsigned long reconfigurations;
+    double reconfiguration_seconds, last_reconfiguration_seconds;
+    unsigned long transitions;
+    double transition_seconds, last_transition_seconds;
+} daemon_stats;
+static int metrics_fd = -1;
+static char metrics_path[108] = "";
+// Conexiones aceptadas que aún no dijeron si hablan HTTP
+static struct {
+    int fd;
+    long long deadline_ms;   // Sin petición para entonces: respuesta en texto plano
+} metrics_clients[METRICS_MAX_CLIENTS];
+static int metrics_client_count = 0;
+
+// Segmento de estadísticas en /dev/shm para lectores sin llamadas al daemon
+static motionwall_stats *stats_segment = NULL;
+static char stats_segment_path[64] = "";
+static int idle_level_seconds[MAX_IDLE_LEVELS];
+static int idle_level_fps[MAX_IDLE_LEVELS];
+static int idle_level_count = 0;
+static bool on_battery = false;
+static int uevent_fd = -1;
+
+// Gobernador PSI: recursos vigilados y umbral de avg10 (%) que cuenta como presión
+static const struct {
+    const char *resource;
+    int high_percent;
+} psi_resources[] = {
+    {"cpu", 20},
+    {"memory", 10},
+    {"io", 20},
+};
+#define PSI_RESOURCES (int)(sizeof(psi_resources) / sizeof(psi_resources[0]))
+static int psi_fds[PSI_RESOURCES] = {-1, -1, -1};
+static bool psi_have_triggers = false;
+static int psi_level = 0;          // 0 normal, 1 fps, 2 resolución, 3 secundarios, 4 todo
+static long long psi_last_change_ms = 0;
+static long long psi_calm_since_ms = 0;
+static long long psi_last_sample_ms = 0;
+
+// Cgroup v2 donde van los reproductores ("" = sin cgroups)
+static char cgroup_players[MAX_PATH] = "";
+static bool cgroup_has_cpu = false, cgroup_has_memory = false;
+// Raíz delegada y hoja a la que se movió el daemon, para deshacerlo al salir
+static char cgroup_base[MAX_PATH] = "";
+static char cgroup_daemon[MAX_PATH] = "";
+static char cgroup_enabled[32] = "";  // Controladores que activamos nosotros en la raíz
+
+// Descriptores que el bucle principal espera junto a la conexión X
+typedef void (*fd_handler)(int fd, short revents);
+static struct {
+    int fd;
+    short events;
+    fd_handler handler;
+} watched_fds[MAX_WATCHED_FDS];
+static int watched_fd_count = 0;
+
+// Pool de hilos compartido por los generadores procedurales
+static struct {
+    pthread_t threads[MAX_RENDER_THREADS];
+    int count;               // Hilos que reparten cada frame (1 = sin hilos)
+    int started;
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned long generation;
+    int pending;
+    generator_state *gen;
+    float t;
+    bool quit;
+} render_pool;
 
 // Function prototypes
 static void init_x11(void);
@@ -152,22 +683,208 @@ static void terminate_all_players(void);
 static void terminate_player(int window_index);
 static bool is_process_healthy(pid_t pid);
 static void playlist_next(void);
+static void playlist_prev(void);
+static void launch_media_player(int window_index);
+static void apply_profile_change(void);
+static void init_control_server(void);
+static int parse_arguments(int argc, char **argv, command_line *cl);
+static void init_config_watch(void);
+static void reload_configuration(void);
+static void config_reload_signal_handler(int sig);
+static void shutdown_control_server(void);
 static void signal_handler(int sig);
+static void profile_signal_handler(int sig);
 static void cleanup_and_exit(void);
+static void config_defaults(void);
+static void load_default_config(void);
 static void load_config_file(const char *config_path);
 static void save_config_file(void);
 static bool safe_path_join(char *dest, size_t dest_size, const char *base, const char *append);
 static int create_lock_file(void);
 static void force_windows_to_background(void);
 static void handle_randr_event(XEvent *event);
+static long long monotonic_ms(void);
+static bool is_native_gif_item(const char *path);
+static gif_animation *load_gif_animation(const char *path, unsigned int width, unsigned int height);
+static void free_gif_animation(gif_animation *gif);
+static bool start_gif_engine(int window_index);
+static void draw_gif_frame(window_info *win);
+static long long service_inprocess_engines(long long now);
+static void handle_expose_event(XExposeEvent *event);
+static void wait_for_activity(long long next_deadline);
+static double read_process_cpu_seconds(pid_t pid);
+static double self_cpu_seconds(void);
+static long self_rss_kb(void);
+static int spawn_reader(char *const argv[], pid_t *pid_out);
+static bool cached_probe(const char *path, media_probe *info);
+static void prefetch_media_probes(void);
+static bool start_loop_cache_engine(int window_index);
+static void stop_loop_cache_engine(window_info *win);
+static long long service_loop_playback(int window_index, long long now);
+static bool frame_sink_open(frame_sink *sink);
+static void frame_sink_present(frame_sink *sink, int first, int last);
+static void frame_sink_close(frame_sink *sink);
+static int bench_sinks(const char *file_path);
+static bool is_image_item(const char *path);
+static bool start_static_engine(int window_index);
+static bool all_windows_static(void);
+static void ensure_window_mapped(window_info *win);
+static long long monotonic_us(void);
+static bool load_prescaled_image(const char *path, unsigned int width, unsigned int height,
+                                 prescaled_image *img, bool *cache_hit);
+static void release_prescaled_image(prescaled_image *img);
+static void prefetch_image_cache(void);
+static bool start_slideshow_engine(int window_index);
+static void stop_slideshow_engine(window_info *win);
+static bool slideshow_show_current(int window_index);
+static long long service_slideshow(window_info *win, long long now);
+static void switch_playlist_item(int direction);
+static bool is_generator_item(const char *path);
+static bool start_procedural_engine(int window_index);
+static void stop_procedural_engine(window_info *win);
+static void present_procedural_frame(window_info *win);
+static long long service_procedural(window_info *win, long long now);
+static void shutdown_render_pool(void);
+static int bench_generators(void);
+static void set_pause_reason(int window_index, unsigned int reason, bool active);
+static void apply_pause_state(int window_index);
+static void update_occlusion(void);
+static void select_occlusion_events(void);
+static void report_pause_savings(void);
+static bool mpv_ipc_request(window_info *win, const char *command, char *reply, size_t reply_size);
+static int window_fps_cap(window_info *win);
+static void apply_window_limits(int window_index);
+static void init_power_monitoring(void);
+static void update_power_state(void);
+static bool watch_fd(int fd, short events, fd_handler handler);
+static void unwatch_fd(int fd);
+static void init_battery_monitoring(void);
+static void update_battery_state(void);
+static bool window_reduced_resolution(window_info *win);
+static void init_psi_governor(void);
+static void service_psi_governor(long long now);
+static void shutdown_psi_governor(void);
+static void update_quality_control(long long now);
+static void init_player_cgroups(void);
+static bool prepare_window_cgroup(int window_index);
+static bool read_player_usage(window_info *win, double *cpu_seconds, long long *memory_bytes);
+static void release_player_cgroups(void);
+static bool parse_monitor_key(const char *key, const char *value);
+static void save_monitor_overrides(FILE *file);
+static void resolve_player_sched(const char *monitor_name, player_sched *ps);
+static void apply_player_sched(const player_sched *ps);
+static int bench_sched(void);
+static int window_decoder_threads(int window_index);
+static void sample_player_accounting(long long now);
+static void account_player(int window_index, long long now);
+static int find_item_usage(const char *path, bool create);
+static void report_item_usage(void);
+static void restart_outdated_players(void);
+static bool build_output_filter(int window_index, bool mpv_syntax, char *buf, size_t size);
+static const performance_profile *find_profile(const char *name);
+static const performance_profile *resolve_window_profile(int window_index);
+static void cycle_profile(void);
+static void init_metrics_server(void);
+static void shutdown_metrics_server(void);
+static long long expire_metrics_clients(long long now_ms);
+static long long expire_control_clients(long long now_ms);
+static void init_stats_segment(void);
+static void publish_stats(long long now);
+static void shutdown_stats_segment(void);
+static void init_tracing(void);
+static void configure_tracing(void);
+static void dump_trace(void);
+static void trace_signal_handler(int sig);
+static void init_logger(void);
+static void shutdown_logger(void);
+static bool parse_log_subsystems(const char *list);
+static int parse_log_level(const char *name);
+
+// Traza para chrome://tracing / Perfetto: un span completo ("X") por
+// ámbito, en un anillo que solo existe con --trace. Solo el hilo principal
+typedef struct {
+    const char *name;
+    long long start_us;
+    long long duration_us;
+    int arg;                 // Ventana o monitor, -1 = ninguno
+} trace_event;
+
+static struct {
+    trace_event *events;     // NULL = trazado desactivado
+    unsigned long count;     // Total registrado (el anillo guarda los últimos)
+} trace;
+static volatile sig_atomic_t trace_dump_pending = 0; // SIGUSR2: volcar la traza
+static volatile sig_atomic_t in_main_loop = 0;       // SIGTERM/SIGINT: salir por el bucle
+static volatile sig_atomic_t exiting_from_signal = 0; // Limpieza dentro de un handler
+
+typedef struct {
+    const char *name;
+    long long start_us;
+    int arg;
+} trace_span;
+
+static inline trace_span trace_scope_begin(const char *name, int arg) {
+    trace_span span = { name, trace.events ? monotonic_us() : -1, arg };
+    return span;
+}
+
+static inline void trace_scope_end(trace_span *span) {
+    if (span->start_us < 0 || !trace.events) return;
+    trace_event *event = &trace.events[trace.count++ % TRACE_RING_EVENTS];
+    event->name = span->name;
+    event->start_us = span->start_us;
+    event->duration_us = monotonic_us() - span->start_us;
+    event->arg = span->arg;
+}
+
+// Span desde aquí hasta el final del ámbito, salga por donde salga
+#define TRACE_SCOPE(name, arg) \
+    trace_span trace_span_ __attribute__((cleanup(trace_scope_end))) = trace_scope_begin(name, arg)
+
+// Logger asíncrono: cada hilo formatea en su propio anillo (un productor,
+// un consumidor, sin locks) y un hilo escritor lo vuelca a stderr. Nivel y
+// subsistemas se pueden cambiar en marcha
+typedef enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_TRACE,
+} log_level;
+
+typedef enum {
+    SUBSYS_CORE = 0,     // Arranque, configuración, señales
+    SUBSYS_X11,          // Ventanas, compositor, fondo
+    SUBSYS_MONITOR,      // RandR, hotplug, límites de salida
+    SUBSYS_PLAYER,       // Reproductores externos y su supervisión
+    SUBSYS_PLAYLIST,
+    SUBSYS_ENGINE,       // Motores internos (GIF, loop, imagen, generadores)
+    SUBSYS_POWER,        // Pausas, batería, PSI, calidad, límites de fps
+    SUBSYS_COUNT
+} log_subsystem;
+
+static volatile sig_atomic_t log_level_setting = LOG_LEVEL_WARN;
+static volatile unsigned int log_subsystem_mask = (1u << SUBSYS_COUNT) - 1;
+
+static inline bool log_enabled(log_level level, log_subsystem subsystem) {
+    return (int)level <= log_level_setting && (log_subsystem_mask & (1u << subsystem));
+}
+
+static void log_write(log_level level, log_subsystem subsystem, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+// Los argumentos no se evalúan si el nivel o el subsistema están apagados
+#define LOG(level, subsystem, ...) \
+    do { if (log_enabled(level, subsystem)) log_write(level, subsystem, __VA_ARGS__); } while (0)
+#define LOG_WARN(subsystem, ...) LOG(LOG_LEVEL_WARN, subsystem, __VA_ARGS__)
+#define LOG_INFO(subsystem, ...) LOG(LOG_LEVEL_INFO, subsystem, __VA_ARGS__)
+#define LOG_DEBUG(subsystem, ...) LOG(LOG_LEVEL_DEBUG, subsystem, __VA_ARGS__)
 
 // Función para crear archivo de lock de instancia única
 static int create_lock_file(void) {
     int fd = open("/tmp/motionwall.lock", O_CREAT | O_RDWR, 0666);
     if (fd < 0) {
-        if (debug) {
-            perror(NAME ": open lock file");
-        }
+        LOG_DEBUG(SUBSYS_CORE, "open lock file: %s\n", strerror(errno));
         return -1;
     }
 
@@ -175,8 +892,8 @@ static int create_lock_file(void) {
         close(fd);
         if (errno == EWOULDBLOCK) {
             fprintf(stderr, NAME ": Another instance is already running\n");
-        } else if (debug) {
-            perror(NAME ": flock");
+        } else {
+            LOG_DEBUG(SUBSYS_CORE, "flock: %s\n", strerror(errno));
         }
         return -1;
     }
@@ -185,9 +902,7 @@ static int create_lock_file(void) {
     char pid_str[32];
     snprintf(pid_str, sizeof(pid_str), "%d\n", getpid());
     if (write(fd, pid_str, strlen(pid_str)) < 0) {
-        if (debug) {
-            perror(NAME ": write lock file");
-        }
+        LOG_DEBUG(SUBSYS_CORE, "write lock file: %s\n", strerror(errno));
     }
 
     return fd;
@@ -209,10 +924,8 @@ static void init_randr(void) {
         return;
     }
 
-    if (debug) {
-        fprintf(stderr, NAME ": RandR version %d.%d detected\n", randr_major, randr_minor);
-        fprintf(stderr, NAME ": RandR event base: %d, error base: %d\n", randr_event_base, randr_error_base);
-    }
+    LOG_DEBUG(SUBSYS_X11, "RandR version %d.%d detected\n", randr_major, randr_minor);
+    LOG_DEBUG(SUBSYS_X11, "RandR event base: %d, error base: %d\n", randr_event_base, randr_error_base);
 
     // Registrar para notificaciones de cambios de pantalla
     XRRSelectInput(display, DefaultRootWindow(display),
@@ -222,17 +935,13 @@ static void init_randr(void) {
 
     config.auto_resize = true;
 
-    if (debug) {
-        fprintf(stderr, NAME ": RandR screen change detection enabled\n");
-    }
+    LOG_DEBUG(SUBSYS_X11, "RandR screen change detection enabled\n");
 }
 
 // Comparar configuraciones de monitores para detectar cambios
 static bool compare_monitor_setups(monitor_setup *old, monitor_setup *new) {
     if (old->count != new->count) {
-        if (debug) {
-            fprintf(stderr, NAME ": Monitor count changed: %d -> %d\n", old->count, new->count);
-        }
+        LOG_DEBUG(SUBSYS_MONITOR, "Monitor count changed: %d -> %d\n", old->count, new->count);
         return false;
     }
 
@@ -244,13 +953,12 @@ static bool compare_monitor_setups(monitor_setup *old, monitor_setup *new) {
             old_mon->y != new_mon->y ||
             old_mon->width != new_mon->width ||
             old_mon->height != new_mon->height ||
+            (int)(old_mon->refresh + 0.5) != (int)(new_mon->refresh + 0.5) ||
             old_mon->connected != new_mon->connected) {
 
-            if (debug) {
-                fprintf(stderr, NAME ": Monitor %d changed: %dx%d+%d+%d (connected:%d) -> %dx%d+%d+%d (connected:%d)\n",
-                        i, old_mon->width, old_mon->height, old_mon->x, old_mon->y, old_mon->connected,
-                        new_mon->width, new_mon->height, new_mon->x, new_mon->y, new_mon->connected);
-            }
+            LOG_DEBUG(SUBSYS_MONITOR, "Monitor %d changed: %dx%d+%d+%d (connected:%d) -> %dx%d+%d+%d (connected:%d)\n",
+                      i, old_mon->width, old_mon->height, old_mon->x, old_mon->y, old_mon->connected,
+                      new_mon->width, new_mon->height, new_mon->x, new_mon->y, new_mon->connected);
             return false;
         }
     }
@@ -269,18 +977,14 @@ static void resize_window_for_monitor(int window_index, int monitor_id) {
     monitor_info *mon = &config.monitors.monitors[monitor_id];
 
     if (win->window == None) {
-        if (debug) {
-            fprintf(stderr, NAME ": Window %d is invalid, recreating\n", window_index);
-        }
+        LOG_DEBUG(SUBSYS_X11, "Window %d is invalid, recreating\n", window_index);
         create_window_for_monitor(monitor_id);
         return;
     }
 
-    if (debug) {
-        fprintf(stderr, NAME ": Resizing window %d from %dx%d+%d+%d to %dx%d+%d+%d\n",
-                window_index, win->width, win->height, win->x, win->y,
-                mon->width, mon->height, mon->x, mon->y);
-    }
+    LOG_DEBUG(SUBSYS_X11, "Resizing window %d from %dx%d+%d+%d to %dx%d+%d+%d\n",
+              window_index, win->width, win->height, win->x, win->y,
+              mon->width, mon->height, mon->x, mon->y);
 
     // Terminar reproductor actual si está activo
     bool was_playing = win->player_active;
@@ -325,16 +1029,13 @@ static void resize_window_for_monitor(int window_index, int monitor_id) {
         start_media_player(window_index);
     }
 
-    if (debug) {
-        fprintf(stderr, NAME ": Window %d resized successfully\n", window_index);
-    }
+    LOG_DEBUG(SUBSYS_X11, "Window %d resized successfully\n", window_index);
 }
 
 // Recrear todas las ventanas (para cambios drásticos de configuración)
 static void recreate_all_windows(void) {
-    if (debug) {
-        fprintf(stderr, NAME ": Recreating all windows due to major screen changes\n");
-    }
+    TRACE_SCOPE("recreate_all_windows", -1);
+    LOG_DEBUG(SUBSYS_X11, "Recreating all windows due to major screen changes\n");
 
     // Terminar todos los reproductores
     terminate_all_players();
@@ -396,16 +1097,13 @@ static void recreate_all_windows(void) {
     // Forzar al fondo
     force_windows_to_background();
 
-    if (debug) {
-        fprintf(stderr, NAME ": Window recreation complete\n");
-    }
+    LOG_DEBUG(SUBSYS_X11, "Window recreation complete\n");
 }
 
 // Manejar cambios de configuración de pantalla
 static void handle_screen_change(void) {
-    if (debug) {
-        fprintf(stderr, NAME ": Handling screen configuration change\n");
-    }
+    TRACE_SCOPE("handle_screen_change", -1);
+    LOG_DEBUG(SUBSYS_MONITOR, "Handling screen configuration change\n");
 
     // Guardar configuración anterior
     monitor_setup old_setup = config.monitors;
@@ -421,15 +1119,12 @@ static void handle_screen_change(void) {
     bool setup_changed = !compare_monitor_setups(&old_setup, &config.monitors);
 
     if (!setup_changed) {
-        if (debug) {
-            fprintf(stderr, NAME ": Screen change detected but no actual changes found\n");
-        }
+        LOG_DEBUG(SUBSYS_MONITOR, "Screen change detected but no actual changes found\n");
         return;
     }
 
-    if (debug) {
-        fprintf(stderr, NAME ": Significant screen changes detected, adapting windows\n");
-    }
+    LOG_DEBUG(SUBSYS_MONITOR, "Significant screen changes detected, adapting windows\n");
+    long long start_us = monotonic_us();
 
     // Decidir si hacer resize o recreación completa
     bool need_recreation = false;
@@ -454,7 +1149,27 @@ static void handle_screen_change(void) {
     }
 
     if (need_recreation) {
+        // Las ventanas nuevas empiezan sin motivos de pausa: conservar el
+        // "motionwall-ctl pause" de cada monitor que sigue conectado
+        bool user_paused[MAX_MONITORS] = { false };
+        for (int i = 0; i < config.window_count && i < MAX_MONITORS; i++) {
+            if (!(config.windows[i].pause_reasons & PAUSE_USER)) continue;
+            int old_id = config.windows[i].monitor_id;
+            for (int j = 0; j < config.monitors.count && j < MAX_MONITORS; j++) {
+                if (!config.multi_monitor ||
+                    (old_id >= 0 && old_id < old_setup.count &&
+                     strcmp(old_setup.monitors[old_id].name, config.monitors.monitors[j].name) == 0)) {
+                    user_paused[j] = true;
+                }
+            }
+        }
+
         recreate_all_windows();
+
+        for (int i = 0; i < config.window_count; i++) {
+            int id = config.windows[i].monitor_id;
+            if (id >= 0 && id < MAX_MONITORS && user_paused[id]) set_pause_reason(i, PAUSE_USER, true);
+        }
     } else {
         // Solo redimensionar ventanas existentes
         for (int i = 0; i < config.window_count; i++) {
@@ -463,24 +1178,33 @@ static void handle_screen_change(void) {
                 resize_window_for_monitor(i, monitor_id);
             }
         }
+        restart_outdated_players();
     }
 
+    // Las ventanas pueden tener otra resolución: pre-escalar de nuevo
+    prefetch_image_cache();
+    prefetch_media_probes();
+
+    // Las ventanas nuevas no tienen motivos de pausa; el de batería solo
+    // llega con uevents, así que reaplicarlo (el primario puede haber cambiado)
+    update_battery_state();
+
     // Pequeña pausa para estabilizar
     usleep(500000); // 500ms
 
-    if (debug) {
-        fprintf(stderr, NAME ": Screen change handling complete\n");
-    }
+    daemon_stats.last_reconfiguration_seconds = (monotonic_us() - start_us) / 1e6;
+    daemon_stats.reconfiguration_seconds += daemon_stats.last_reconfiguration_seconds;
+    daemon_stats.reconfigurations++;
+
+    LOG_DEBUG(SUBSYS_MONITOR, "Screen change handling complete\n");
 }
 
 // Manejar evento RandR específico
 static void handle_randr_event(XEvent *event) {
     if (event->type == randr_event_base + RRScreenChangeNotify) {
         XRRScreenChangeNotifyEvent *se = (XRRScreenChangeNotifyEvent *)event;
-        if (debug) {
-            fprintf(stderr, NAME ": RandR screen change event: %dx%d -> %dx%d\n",
-                    se->width, se->height, se->width, se->height);
-        }
+        LOG_DEBUG(SUBSYS_MONITOR, "RandR screen change event: %dx%d -> %dx%d\n",
+                  se->width, se->height, se->width, se->height);
 
         // Actualizar información de RandR
         XRRUpdateConfiguration(event);
@@ -517,17 +1241,48 @@ static bool is_process_healthy(pid_t pid) {
 
 // Terminar reproductor específico
 static void terminate_player(int window_index) {
+    TRACE_SCOPE("terminate_player", window_index);
     if (window_index < 0 || window_index >= config.window_count) {
         return;
     }
 
     window_info *win = &config.windows[window_index];
 
-    if (win->player_active && win->player_pid > 0) {
-        if (debug) {
-            fprintf(stderr, NAME ": Terminating player PID %d for window %d\n",
-                    win->player_pid, window_index);
+    // Un proceso con SIGSTOP no atiende SIGTERM: reanudar antes de terminar.
+    // Los motivos de pausa siguen activos y el siguiente elemento se pausará
+    if (win->paused) {
+        unsigned int reasons = win->pause_reasons;
+        win->pause_reasons = 0;
+        apply_pause_state(window_index);
+        win->pause_reasons = reasons;
+    }
+
+    // Motores internos: solo liberar recursos propios y del servidor X
+    if (win->engine != ENGINE_PLAYER) {
+        LOG_DEBUG(SUBSYS_PLAYER, "Stopping in-process engine for window %d\n", window_index);
+        if (win->engine == ENGINE_GIF) {
+            free_gif_animation(win->gif);
+            win->gif = NULL;
+        } else if (win->engine == ENGINE_LOOP_CACHE) {
+            stop_loop_cache_engine(win);
+        } else if (win->engine == ENGINE_SLIDESHOW) {
+            stop_slideshow_engine(win);
+        } else if (win->engine == ENGINE_PROCEDURAL) {
+            stop_procedural_engine(win);
         }
+        // ENGINE_STATIC: el fondo queda en el pixmap raíz hasta el próximo elemento
+        win->engine = ENGINE_PLAYER;
+        win->player_active = false;
+        win->player_start_time = 0;
+        return;
+    }
+
+    if (win->player_active && win->player_pid > 0) {
+        LOG_DEBUG(SUBSYS_PLAYER, "Terminating player PID %d for window %d\n",
+                  win->player_pid, window_index);
+
+        // Última muestra: lo gastado desde la anterior cuenta para este elemento
+        account_player(window_index, monotonic_ms());
 
         // Terminación amigable primero
         kill(win->player_pid, SIGTERM);
@@ -535,15 +1290,20 @@ static void terminate_player(int window_index) {
 
         // Verificar si aún vive
         if (kill(win->player_pid, 0) == 0) {
-            if (debug) {
-                fprintf(stderr, NAME ": Force killing player PID %d\n", win->player_pid);
-            }
+            LOG_DEBUG(SUBSYS_PLAYER, "Force killing player PID %d\n", win->player_pid);
             kill(win->player_pid, SIGKILL);
         }
 
         // Limpiar zombie
         waitpid(win->player_pid, NULL, WNOHANG);
 
+        // mpv no borra su socket IPC si muere con SIGKILL
+        if (win->ipc_path[0] != '\0') {
+            unlink(win->ipc_path);
+            win->ipc_path[0] = '\0';
+        }
+        win->applied_fps_cap = 0;
+
         win->player_pid = 0;
         win->player_active = false;
         win->player_start_time = 0;
@@ -552,9 +1312,7 @@ static void terminate_player(int window_index) {
 
 // Terminar todos los reproductores
 static void terminate_all_players(void) {
-    if (debug) {
-        fprintf(stderr, NAME ": Terminating all players\n");
-    }
+    LOG_DEBUG(SUBSYS_PLAYER, "Terminating all players\n");
 
     for (int i = 0; i < config.window_count; i++) {
         terminate_player(i);
@@ -574,10 +1332,8 @@ static void check_and_restart_players(void) {
         if (win->player_active && win->player_pid > 0) {
             // Verificar si el proceso está vivo y saludable
             if (!is_process_healthy(win->player_pid)) {
-                if (debug) {
-                    fprintf(stderr, NAME ": Player for window %d (PID %d) is unhealthy or dead\n",
-                            i, win->player_pid);
-                }
+                LOG_DEBUG(SUBSYS_PLAYER, "Player for window %d (PID %d) is unhealthy or dead\n",
+                          i, win->player_pid);
 
                 // Limpiar proceso muerto
                 waitpid(win->player_pid, NULL, WNOHANG);
@@ -589,29 +1345,33 @@ static void check_and_restart_players(void) {
                 sleep(1);
 
                 // Reiniciar SOLO este reproductor
-                if (debug) {
-                    fprintf(stderr, NAME ": Restarting player for window %d\n", i);
-                }
+                LOG_DEBUG(SUBSYS_PLAYER, "Restarting player for window %d\n", i);
+                win->player_restarts++;
                 start_media_player(i);
             }
         } else if (!win->player_active && win->window != None) {
             // Ventana sin reproductor activo - reiniciar si es necesario
-            if (debug) {
-                fprintf(stderr, NAME ": Window %d has no active player, starting one\n", i);
-            }
+            LOG_DEBUG(SUBSYS_PLAYER, "Window %d has no active player, starting one\n", i);
             start_media_player(i);
         }
 
         // Verificar si un reproductor ha estado ejecutándose demasiado tiempo sin respuesta
-        if (win->player_active && win->player_start_time > 0) {
+        if (win->player_active && win->player_pid > 0 && win->player_start_time > 0) {
             if (now - win->player_start_time > 300) { // 5 minutos
-                if (debug) {
-                    fprintf(stderr, NAME ": Player for window %d running too long, checking health\n", i);
+                if (log_enabled(LOG_LEVEL_DEBUG, SUBSYS_PLAYER)) {
+                    LOG_DEBUG(SUBSYS_PLAYER, "Player for window %d running too long, checking health\n", i);
+                    double cpu;
+                    long long memory;
+                    if (read_player_usage(win, &cpu, &memory)) {
+                        LOG_DEBUG(SUBSYS_PLAYER, "Window %d cgroup: %.1f CPU-s, %lld MB\n",
+                                  i, cpu, memory >= 0 ? memory >> 20 : -1LL);
+                    }
                 }
 
                 if (!is_process_healthy(win->player_pid)) {
                     terminate_player(i);
                     usleep(500000); // 500ms
+                    win->player_restarts++;
                     start_media_player(i);
                 }
 
@@ -630,9 +1390,7 @@ static bool safe_path_join(char *dest, size_t dest_size, const char *base, const
 
     int ret = snprintf(dest, dest_size, "%s/%s", base, append);
     if (ret < 0 || ret >= (int)dest_size) {
-        if (debug) {
-            fprintf(stderr, NAME ": Error: Path too long when joining '%s' and '%s'\n", base, append);
-        }
+        LOG_DEBUG(SUBSYS_CORE, "Error: Path too long when joining '%s' and '%s'\n", base, append);
         return false;
     }
 
@@ -664,14 +1422,13 @@ static void detect_desktop_environment(void) {
         else if (strstr(session, "i3")) config.de = DE_I3;
     }
 
-    if (debug) {
-        const char *de_names[] = {"Unknown", "GNOME", "KDE", "XFCE", "Cinnamon", "MATE", "LXDE", "i3", "Awesome"};
-        fprintf(stderr, NAME ": Detected desktop environment: %s\n", de_names[config.de]);
-    }
+    const char *de_names[] = {"Unknown", "GNOME", "KDE", "XFCE", "Cinnamon", "MATE", "LXDE", "i3", "Awesome"};
+    LOG_DEBUG(SUBSYS_X11, "Detected desktop environment: %s\n", de_names[config.de]);
 }
 
 // Multi-monitor detection using Xrandr
 static int detect_monitors(void) {
+    TRACE_SCOPE("detect_monitors", -1);
     XRRScreenResources *screen_resources;
     XRROutputInfo *output_info;
     XRRCrtcInfo *crtc_info;
@@ -703,6 +1460,18 @@ static int detect_monitors(void) {
                 mon->height = crtc_info->height;
                 mon->connected = true;
 
+                // Tasa de refresco del modo activo
+                mon->refresh = 0;
+                for (int m = 0; m < screen_resources->nmode; m++) {
+                    XRRModeInfo *mode = &screen_resources->modes[m];
+                    if (mode->id != crtc_info->mode || !mode->hTotal || !mode->vTotal) continue;
+                    double vtotal = mode->vTotal;
+                    if (mode->modeFlags & RR_DoubleScan) vtotal *= 2;
+                    if (mode->modeFlags & RR_Interlace) vtotal /= 2;
+                    mon->refresh = mode->dotClock / (mode->hTotal * vtotal);
+                    break;
+                }
+
                 // Check if this is the primary monitor
                 RROutput primary = XRRGetOutputPrimary(display, DefaultRootWindow(display));
                 mon->primary = (screen_resources->outputs[i] == primary);
@@ -711,11 +1480,9 @@ static int detect_monitors(void) {
                     config.monitors.primary_index = config.monitors.count;
                 }
 
-                if (debug) {
-                    fprintf(stderr, NAME ": Monitor %d: %s (%dx%d+%d+%d) %s\n",
-                            config.monitors.count, mon->name, mon->width, mon->height,
-                            mon->x, mon->y, mon->primary ? "(primary)" : "");
-                }
+                LOG_DEBUG(SUBSYS_MONITOR, "Monitor %d: %s (%dx%d+%d+%d @ %.2f Hz) %s\n",
+                          config.monitors.count, mon->name, mon->width, mon->height,
+                          mon->x, mon->y, mon->refresh, mon->primary ? "(primary)" : "");
 
                 config.monitors.count++;
                 XRRFreeCrtcInfo(crtc_info);
@@ -726,6 +1493,60 @@ static int detect_monitors(void) {
 
     XRRFreeScreenResources(screen_resources);
 
+    // Monitores lógicos de RandR 1.5 (xrandr --setmonitor), solo con
+    // --logical-monitors: si el usuario ha definido alguno mandan sobre las
+    // salidas. Sirve para partir una pantalla ancha y para simular varios
+    // monitores bajo Xvfb (make bench)
+    int randr_major = 0, randr_minor = 0;
+    if (config.logical_monitors && XRRQueryVersion(display, &randr_major, &randr_minor) &&
+        (randr_major > 1 || (randr_major == 1 && randr_minor >= 5))) {
+        int nmonitors = 0;
+        XRRMonitorInfo *logical = XRRGetMonitors(display, DefaultRootWindow(display), True, &nmonitors);
+        bool user_defined = false;
+        for (i = 0; logical && i < nmonitors; i++) {
+            if (!logical[i].automatic) user_defined = true;
+        }
+
+        if (user_defined) {
+            monitor_info outputs[MAX_MONITORS];
+            int output_count = config.monitors.count;
+            memcpy(outputs, config.monitors.monitors, sizeof(outputs));
+            config.monitors.count = 0;
+            config.monitors.primary_index = -1;
+
+            for (i = 0; i < nmonitors && config.monitors.count < MAX_MONITORS; i++) {
+                monitor_info *mon = &config.monitors.monitors[config.monitors.count];
+                char *name = XGetAtomName(display, logical[i].name);
+                snprintf(mon->name, sizeof(mon->name), "%s", name ? name : "monitor");
+                if (name) XFree(name);
+                mon->x = logical[i].x;
+                mon->y = logical[i].y;
+                mon->width = logical[i].width;
+                mon->height = logical[i].height;
+                mon->connected = true;
+                mon->primary = logical[i].primary;
+
+                // Refresco de la salida que contiene su esquina
+                mon->refresh = 0;
+                for (int o = 0; o < output_count; o++) {
+                    if (mon->x >= outputs[o].x && mon->x < outputs[o].x + (int)outputs[o].width &&
+                        mon->y >= outputs[o].y && mon->y < outputs[o].y + (int)outputs[o].height) {
+                        mon->refresh = outputs[o].refresh;
+                        break;
+                    }
+                }
+
+                if (mon->primary && config.monitors.primary_index == -1) {
+                    config.monitors.primary_index = config.monitors.count;
+                }
+                LOG_DEBUG(SUBSYS_MONITOR, "Logical monitor %d: %s (%dx%d+%d+%d)\n",
+                          config.monitors.count, mon->name, mon->width, mon->height, mon->x, mon->y);
+                config.monitors.count++;
+            }
+        }
+        if (logical) XRRFreeMonitors(logical);
+    }
+
     if (config.monitors.primary_index == -1 && config.monitors.count > 0) {
         config.monitors.primary_index = 0;
         config.monitors.monitors[0].primary = true;
@@ -736,12 +1557,24 @@ static int detect_monitors(void) {
 
 // Playlist creation from directory or file list
 static void create_playlist(const char *path) {
+    TRACE_SCOPE("create_playlist", -1);
     struct stat path_stat;
     glob_t glob_result;
     int i;
 
     config.media_playlist.count = 0;
     config.media_playlist.current = 0;
+    if (path != playlist_source) {
+        strncpy(playlist_source, path, sizeof(playlist_source) - 1);
+    }
+
+    // Generador procedural: no hay archivo que buscar
+    if (is_generator_item(path)) {
+        strncpy(config.media_playlist.paths[0], path, MAX_PATH - 1);
+        config.media_playlist.paths[0][MAX_PATH - 1] = '\0';
+        config.media_playlist.count = 1;
+        return;
+    }
 
     if (stat(path, &path_stat) != 0) {
         fprintf(stderr, NAME ": Error: Cannot access path: %s\n", path);
@@ -751,7 +1584,8 @@ static void create_playlist(const char *path) {
     if (S_ISDIR(path_stat.st_mode)) {
         // Directory - find all video files
         char pattern[MAX_PATH];
-        const char *extensions[] = {"*.mp4", "*.avi", "*.mkv", "*.mov", "*.webm", "*.gif", "*.mp3", "*.wav"};
+        const char *extensions[] = {"*.mp4", "*.avi", "*.mkv", "*.mov", "*.webm", "*.gif", "*.mp3", "*.wav",
+                                    "*.png", "*.jpg", "*.jpeg", "*.bmp", "*.webp"};
         const int ext_count = sizeof(extensions) / sizeof(extensions[0]);
 
         for (int ext = 0; ext < ext_count; ext++) {
@@ -776,33 +1610,29 @@ static void create_playlist(const char *path) {
         config.media_playlist.count = 1;
     }
 
-    if (debug) {
-        fprintf(stderr, NAME ": Created playlist with %d items\n", config.media_playlist.count);
+    LOG_DEBUG(SUBSYS_PLAYLIST, "Created playlist with %d items\n", config.media_playlist.count);
+    // Una línea por entrada solo en nivel trace: con listas grandes inunda el log
+    if (log_enabled(LOG_LEVEL_TRACE, SUBSYS_PLAYLIST)) {
         for (i = 0; i < config.media_playlist.count; i++) {
-            fprintf(stderr, "  %d: %s\n", i, config.media_playlist.paths[i]);
+            LOG(LOG_LEVEL_TRACE, SUBSYS_PLAYLIST, "  %d: %s\n", i, config.media_playlist.paths[i]);
         }
     }
 }
 
 // Setup compositor integration
 static void setup_compositor_integration(void) {
-    if (debug) {
-        fprintf(stderr, NAME ": Setting up compositor integration to place window below desktop\n");
-    }
+    TRACE_SCOPE("setup_compositor_integration", -1);
+    LOG_DEBUG(SUBSYS_X11, "Setting up compositor integration to place window below desktop\n");
 
     // Verificar que tenemos ventanas válidas
    if (!config.windows || config.window_count == 0) {
-       if (debug) {
-           fprintf(stderr, NAME ": No windows to configure\n");
-       }
+       LOG_DEBUG(SUBSYS_X11, "No windows to configure\n");
        return;
    }
 
    for (int i = 0; i < config.window_count; i++) {
        if (config.windows[i].window == None) {
-           if (debug) {
-               fprintf(stderr, NAME ": Skipping invalid window %d\n", i);
-           }
+           LOG_DEBUG(SUBSYS_X11, "Skipping invalid window %d\n", i);
            continue;
        }
 
@@ -895,9 +1725,7 @@ static void setup_compositor_integration(void) {
                      SubstructureRedirectMask | SubstructureNotifyMask, &xev);
        }
 
-       if (debug) {
-           fprintf(stderr, NAME ": Configured window %d (0x%lx) for desktop background\n", i, window);
-       }
+       LOG_DEBUG(SUBSYS_X11, "Configured window %d (0x%lx) for desktop background\n", i, window);
    }
 
    XSync(display, False);
@@ -914,13 +1742,12 @@ static void setup_compositor_integration(void) {
 
    XSync(display, False);
 
-   if (debug) {
-       fprintf(stderr, NAME ": Compositor integration setup complete\n");
-   }
+   LOG_DEBUG(SUBSYS_X11, "Compositor integration setup complete\n");
 }
 
 // Create window for monitor
 static void create_window_for_monitor(int monitor_id) {
+   TRACE_SCOPE("create_window_for_monitor", monitor_id);
    if (monitor_id >= config.monitors.count || monitor_id < 0) {
        fprintf(stderr, NAME ": Error: Invalid monitor ID %d\n", monitor_id);
        return;
@@ -929,14 +1756,14 @@ static void create_window_for_monitor(int monitor_id) {
    monitor_info *mon = &config.monitors.monitors[monitor_id];
    window_info *win = &config.windows[monitor_id];
 
-   if (debug) {
-       fprintf(stderr, NAME ": Creating window for monitor %d: %s (%dx%d+%d+%d)\n",
-               monitor_id, mon->name, mon->width, mon->height, mon->x, mon->y);
-   }
+   LOG_DEBUG(SUBSYS_X11, "Creating window for monitor %d: %s (%dx%d+%d+%d)\n",
+             monitor_id, mon->name, mon->width, mon->height, mon->x, mon->y);
 
    // Inicializar estructura de ventana
    memset(win, 0, sizeof(window_info));
    win->monitor_id = monitor_id;
+   win->usage_item = -1;
+   win->playlist_item = -1;
    win->x = mon->x;
    win->y = mon->y;
    win->width = mon->width;
@@ -959,7 +1786,7 @@ static void create_window_for_monitor(int monitor_id) {
    attrs.background_pixel = BlackPixel(display, screen);
    attrs.backing_store = NotUseful;
    attrs.save_under = False;
-   attrs.event_mask = StructureNotifyMask | ExposureMask;
+   attrs.event_mask = StructureNotifyMask | ExposureMask | VisibilityChangeMask;
    attrs.override_redirect = False;  // False para permitir WM control
    attrs.colormap = win->colourmap;
 
@@ -1003,6 +1830,7 @@ static void create_window_for_monitor(int monitor_id) {
 
    // Mapear ventana
    XMapWindow(display, win->window);
+   win->mapped = true;
 
    // Inmediatamente bajar la ventana
    XLowerWindow(display, win->window);
@@ -1010,168 +1838,6065 @@ static void create_window_for_monitor(int monitor_id) {
    // Sincronizar con servidor X
    XSync(display, False);
 
-   if (debug) {
-       fprintf(stderr, NAME ": Window created successfully: 0x%lx\n", win->window);
-   }
+   LOG_DEBUG(SUBSYS_X11, "Window created successfully: 0x%lx\n", win->window);
 
    // Pausa para que la ventana se establezca
    usleep(200000); // 200ms
 }
 
-// Start media player for specific window - VERSIÓN MEJORADA
-static void start_media_player(int window_index) {
-   if (window_index < 0 || window_index >= config.window_count) {
-       fprintf(stderr, NAME ": Error: Invalid window index %d\n", window_index);
-       return;
-   }
+// Tiempo monotónico en milisegundos para temporizar frames
+static long long monotonic_ms(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-   window_info *win = &config.windows[window_index];
+// Tiempo monotónico en microsegundos para medir latencias
+static long long monotonic_us(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-   // Verificar si ya hay un reproductor activo para esta ventana
-   if (win->player_active && win->player_pid > 0) {
-       if (is_process_healthy(win->player_pid)) {
-           if (debug) {
-               fprintf(stderr, NAME ": Player already active for window %d (PID %d)\n",
-                       window_index, win->player_pid);
+// Verificar si un elemento de la playlist debe ir al motor GIF nativo
+static bool is_native_gif_item(const char *path) {
+   if (!config.native_gif || !path) return false;
+
+   const char *dot = strrchr(path, '.');
+   return dot && strcasecmp(dot, ".gif") == 0;
+}
+
+// Decodificador LZW de GIF: expande los códigos en índices de paleta
+static bool gif_decode_lzw(const uint8_t *data, size_t len, int min_code_size,
+                           uint8_t *out, size_t out_len) {
+   if (min_code_size < 2 || min_code_size > 8) return false;
+
+   static uint16_t prefix[4096];
+   static uint8_t suffix[4096];
+   static uint8_t stack[4097];
+
+   const int clear = 1 << min_code_size;
+   const int eoi = clear + 1;
+   int code_size = min_code_size + 1;
+   int next_code = eoi + 1;
+   int prev = -1;
+   uint8_t first = 0;
+   uint32_t bits = 0;
+   int nbits = 0;
+   size_t pos = 0, outpos = 0;
+
+   while (outpos < out_len) {
+       while (nbits < code_size) {
+           if (pos >= len) goto done;
+           bits |= (uint32_t)data[pos++] << nbits;
+           nbits += 8;
+       }
+       int code = bits & ((1 << code_size) - 1);
+       bits >>= code_size;
+       nbits -= code_size;
+
+       if (code == clear) {
+           code_size = min_code_size + 1;
+           next_code = eoi + 1;
+           prev = -1;
+           continue;
+       }
+       if (code == eoi) break;
+
+       if (prev == -1) {
+           if (code >= clear) return false;
+           out[outpos++] = (uint8_t)code;
+           prev = code;
+           first = (uint8_t)code;
+           continue;
+       }
+
+       int in_code = code;
+       int sp = 0;
+       if (code >= next_code) {
+           if (code > next_code) return false;
+           stack[sp++] = first;
+           code = prev;
+       }
+       while (code >= clear) {
+           if (sp >= (int)sizeof(stack) - 1) return false;
+           stack[sp++] = suffix[code];
+           code = prefix[code];
+       }
+       first = (uint8_t)code;
+       stack[sp++] = first;
+
+       while (sp > 0 && outpos < out_len) {
+           out[outpos++] = stack[--sp];
+       }
+
+       if (next_code < 4096) {
+           prefix[next_code] = (uint16_t)prev;
+           suffix[next_code] = first;
+           next_code++;
+           if (next_code == (1 << code_size) && code_size < 12) {
+               code_size++;
            }
-           return; // Ya hay un reproductor saludable ejecutándose
-       } else {
-           // El proceso existe pero no está saludable, terminarlo
-           terminate_player(window_index);
-           usleep(500000); // 500ms para limpieza
        }
+       prev = in_code;
    }
 
-   if (config.media_playlist.count == 0) {
-       fprintf(stderr, NAME ": Error: No media files in playlist\n");
-       return;
+done:
+   // GIFs truncados: rellenar con el índice 0 en lugar de fallar
+   if (outpos < out_len) {
+       memset(out + outpos, 0, out_len - outpos);
    }
+   return true;
+}
 
-   if (win->window == None) {
-       fprintf(stderr, NAME ": Error: Invalid window for index %d\n", window_index);
-       return;
+// Leer sub-bloques de datos GIF concatenándolos en un buffer
+static uint8_t *gif_read_sub_blocks(const uint8_t *buf, size_t size, size_t *pos, size_t *out_len) {
+   size_t total = 0, cap = 4096;
+   uint8_t *out = malloc(cap);
+   if (!out) return NULL;
+
+   while (*pos < size) {
+       uint8_t block = buf[(*pos)++];
+       if (block == 0) break;
+       if (*pos + block > size) break;
+       if (total + block > cap) {
+           while (total + block > cap) cap *= 2;
+           uint8_t *grown = realloc(out, cap);
+           if (!grown) {
+               free(out);
+               return NULL;
+           }
+           out = grown;
+       }
+       memcpy(out + total, buf + *pos, block);
+       total += block;
+       *pos += block;
    }
 
-   char wid_arg[64];
-   char *args[MAX_CMD_ARGS];
-   int argc = 0;
+   *out_len = total;
+   return out;
+}
 
-   int ret = snprintf(wid_arg, sizeof(wid_arg), "0x%lx", win->window);
-   if (ret >= (int)sizeof(wid_arg)) {
-       fprintf(stderr, NAME ": Error: Window ID too long\n");
-       return;
+// Subir un buffer BGRX (0x00RRGGBB) a un pixmap nuevo del servidor
+static Pixmap upload_bgrx_pixmap(const uint32_t *pixels, unsigned int width, unsigned int height) {
+   Pixmap pixmap = XCreatePixmap(display, DefaultRootWindow(display), width, height,
+                                 DefaultDepth(display, screen));
+   XImage *image = XCreateImage(display, DefaultVisual(display, screen), DefaultDepth(display, screen),
+                                ZPixmap, 0, (char *)pixels, width, height, 32, width * 4);
+   if (!image) {
+       XFreePixmap(display, pixmap);
+       return None;
    }
 
-   // Build command line
-   args[argc++] = config.media_player;
+   // Los datos están en el orden de bytes del cliente
+   const uint16_t probe = 1;
+   image->byte_order = (*(const uint8_t *)&probe == 1) ? LSBFirst : MSBFirst;
 
-   // Add player-specific arguments
-  if (strstr(config.media_player, "mpv")) {
-      char mpv_wid_arg[64];
-      snprintf(mpv_wid_arg, sizeof(mpv_wid_arg), "--wid=0x%lx", win->window);
-      args[argc++] = mpv_wid_arg;
-      args[argc++] = "--really-quiet";
-      args[argc++] = "--no-audio";
-      args[argc++] = "--loop-file=inf";
-      args[argc++] = "--panscan=1.0";
-      args[argc++] = "--keepaspect=no";
-      args[argc++] = "--no-input-default-bindings";
-      args[argc++] = "--no-osc";
-      args[argc++] = "--no-input-cursor";
-      args[argc++] = "--no-cursor-autohide";
-      args[argc++] = "--hwdec=auto";
-      args[argc++] = "--no-terminal";
-      args[argc++] = "--no-config";
-  } else if (strstr(config.media_player, "mplayer")) {
-      args[argc++] = "-wid";
-      args[argc++] = wid_arg;
-      args[argc++] = "-nosound";
-      args[argc++] = "-quiet";
-      args[argc++] = "-vo";
-      args[argc++] = "xv";
-      args[argc++] = "-zoom";
-      args[argc++] = "-panscan";
-      args[argc++] = "1.0";
-      args[argc++] = "-framedrop";
-      args[argc++] = "-cache";
-      args[argc++] = "8192";
-      args[argc++] = "-fs";
-      if (config.media_playlist.loop) {
-          args[argc++] = "-loop";
-          args[argc++] = "0";
-      }
-  } else if (strstr(config.media_player, "vlc")) {
-      char drawable_arg[64];
-      snprintf(drawable_arg, sizeof(drawable_arg), "--drawable-xid=0x%lx", win->window);
+   GC gc = XCreateGC(display, pixmap, 0, NULL);
+   XPutImage(display, pixmap, gc, image, 0, 0, 0, 0, width, height);
+   XFreeGC(display, gc);
 
-      args[argc++] = "--intf";
-      args[argc++] = "dummy";
-      args[argc++] = "--no-video-title-show";
-      args[argc++] = "--no-audio";
-      args[argc++] = "--quiet";
-      args[argc++] = "--no-osd";
-      args[argc++] = "--no-spu";
-      args[argc++] = "--no-stats";
-      args[argc++] = "--no-snapshot-preview";
-      args[argc++] = "--vout";
-      args[argc++] = "x11";
-      args[argc++] = drawable_arg;
-      args[argc++] = "--no-embedded-video";
-      args[argc++] = "--video-on-top";
-      args[argc++] = "--fullscreen";
-      if (config.media_playlist.loop) {
-          args[argc++] = "--loop";
-      }
-  }
+   image->data = NULL; // El buffer pertenece al llamador
+   XDestroyImage(image);
+   return pixmap;
+}
 
-  // Add current media file
-  if (argc < MAX_CMD_ARGS - 1) {
-      args[argc++] = config.media_playlist.paths[config.media_playlist.current];
-      args[argc] = NULL;
-  } else {
-      fprintf(stderr, NAME ": Error: Too many command arguments\n");
-      return;
-  }
+// Crear un Picture de XRender que escala src (sw x sh) a dw x dh al componer
+static Picture create_scaled_picture(Drawable src, unsigned int sw, unsigned int sh,
+                                     unsigned int dw, unsigned int dh) {
+   XRenderPictFormat *format = XRenderFindVisualFormat(display, DefaultVisual(display, screen));
+   if (!format) return None;
+
+   Picture picture = XRenderCreatePicture(display, src, format, 0, NULL);
+   XTransform transform = {{
+       {XDoubleToFixed((double)sw / dw), XDoubleToFixed(0), XDoubleToFixed(0)},
+       {XDoubleToFixed(0), XDoubleToFixed((double)sh / dh), XDoubleToFixed(0)},
+       {XDoubleToFixed(0), XDoubleToFixed(0), XDoubleToFixed(1.0)}
+   }};
+   XRenderSetPictureTransform(display, picture, &transform);
+   XRenderSetPictureFilter(display, picture, FilterBilinear, NULL, 0);
+   return picture;
+}
 
-  // Debug: print the complete command line
-  if (debug) {
-      fprintf(stderr, NAME ": Starting player for window %d: ", window_index);
-      for (int i = 0; i < argc; i++) {
-          fprintf(stderr, "%s ", args[i]);
-      }
-      fprintf(stderr, "\n");
-  }
+// Escalar un pixmap en el servidor una sola vez; devuelve un pixmap nuevo
+static Pixmap scale_pixmap(Pixmap src, unsigned int sw, unsigned int sh,
+                           unsigned int dw, unsigned int dh) {
+   XRenderPictFormat *format = XRenderFindVisualFormat(display, DefaultVisual(display, screen));
+   if (!format) return None;
 
-  pid_t pid = fork();
-  if (pid == 0) {
-      // Child process
-      // Redirigir stderr y stdout si no estamos en debug
-      if (!debug) {
-          int devnull = open("/dev/null", O_WRONLY);
-          if (devnull != -1) {
-              dup2(devnull, STDOUT_FILENO);
-              dup2(devnull, STDERR_FILENO);
-              close(devnull);
-          }
-      }
+   Pixmap dst = XCreatePixmap(display, DefaultRootWindow(display), dw, dh,
+                              DefaultDepth(display, screen));
+   Picture src_pic = create_scaled_picture(src, sw, sh, dw, dh);
+   Picture dst_pic = XRenderCreatePicture(display, dst, format, 0, NULL);
 
-      // Establecer nueva sesión para evitar señales del padre
-      setsid();
+   XRenderComposite(display, PictOpSrc, src_pic, None, dst_pic, 0, 0, 0, 0, 0, 0, dw, dh);
 
-      execvp(args[0], args);
-      perror(args[0]);
+   XRenderFreePicture(display, src_pic);
+   XRenderFreePicture(display, dst_pic);
+   return dst;
+}
+
+// Liberar todos los recursos de una animación GIF
+static void free_gif_animation(gif_animation *gif) {
+   if (!gif) return;
+
+   if (display) {
+       for (int i = 0; i < gif->frame_count; i++) {
+           if (gif->pictures && gif->pictures[i] != None) {
+               XRenderFreePicture(display, gif->pictures[i]);
+           }
+           if (gif->frames[i] != None) {
+               XFreePixmap(display, gif->frames[i]);
+           }
+       }
+       if (gif->target != None) {
+           XRenderFreePicture(display, gif->target);
+       }
+   }
+
+   free(gif->frames);
+   free(gif->pictures);
+   free(gif->delays_ms);
+   free(gif);
+}
+
+// Añadir un frame compuesto (canvas completo) a la animación
+static bool gif_append_frame(gif_animation *gif, int *capacity, const uint32_t *canvas,
+                             unsigned int canvas_w, unsigned int canvas_h,
+                             unsigned int width, unsigned int height, int delay_ms) {
+   if (gif->frame_count == *capacity) {
+       int new_cap = *capacity ? *capacity * 2 : 16;
+       Pixmap *frames = realloc(gif->frames, new_cap * sizeof(Pixmap));
+       if (!frames) return false;
+       gif->frames = frames;
+       int *delays = realloc(gif->delays_ms, new_cap * sizeof(int));
+       if (!delays) return false;
+       gif->delays_ms = delays;
+       *capacity = new_cap;
+   }
+
+   Pixmap native = upload_bgrx_pixmap(canvas, canvas_w, canvas_h);
+   if (native == None) return false;
+
+   Pixmap stored = native;
+   if (!gif->scale_on_blit && (canvas_w != width || canvas_h != height)) {
+       stored = scale_pixmap(native, canvas_w, canvas_h, width, height);
+       XFreePixmap(display, native);
+       if (stored == None) return false;
+   }
+
+   if (delay_ms < GIF_MIN_DELAY_MS) delay_ms = GIF_DEFAULT_DELAY_MS;
+
+   gif->frames[gif->frame_count] = stored;
+   gif->delays_ms[gif->frame_count] = delay_ms;
+   gif->frame_count++;
+   return true;
+}
+
+// Decodificar un GIF completo, componer los modos de disposal y guardar
+// cada frame como pixmap del servidor escalado al tamaño del monitor
+static gif_animation *load_gif_animation(const char *path, unsigned int width, unsigned int height) {
+   FILE *file = fopen(path, "rb");
+   if (!file) {
+       fprintf(stderr, NAME ": Error: Cannot open GIF: %s\n", path);
+       return NULL;
+   }
+
+   fseek(file, 0, SEEK_END);
+   long file_size = ftell(file);
+   fseek(file, 0, SEEK_SET);
+   if (file_size < 13) {
+       fclose(file);
+       return NULL;
+   }
+
+   uint8_t *buf = malloc(file_size);
+   if (!buf || fread(buf, 1, file_size, file) != (size_t)file_size) {
+       free(buf);
+       fclose(file);
+       return NULL;
+   }
+   fclose(file);
+
+   size_t size = (size_t)file_size;
+   if (memcmp(buf, "GIF87a", 6) != 0 && memcmp(buf, "GIF89a", 6) != 0) {
+       fprintf(stderr, NAME ": Error: Not a GIF file: %s\n", path);
+       free(buf);
+       return NULL;
+   }
+
+   unsigned int canvas_w = buf[6] | (buf[7] << 8);
+   unsigned int canvas_h = buf[8] | (buf[9] << 8);
+   uint8_t screen_flags = buf[10];
+   size_t pos = 13;
+
+   if (canvas_w == 0 || canvas_h == 0) {
+       free(buf);
+       return NULL;
+   }
+
+   uint8_t global_palette[256 * 3] = {0};
+   int global_colors = 0;
+   if (screen_flags & 0x80) {
+       global_colors = 2 << (screen_flags & 0x07);
+       if (pos + global_colors * 3 > size) {
+           free(buf);
+           return NULL;
+       }
+       memcpy(global_palette, buf + pos, global_colors * 3);
+       pos += global_colors * 3;
+   }
+
+   gif_animation *gif = calloc(1, sizeof(gif_animation));
+   uint32_t *canvas = calloc((size_t)canvas_w * canvas_h, sizeof(uint32_t));
+   uint32_t *saved = calloc((size_t)canvas_w * canvas_h, sizeof(uint32_t));
+   uint8_t *indices = malloc((size_t)canvas_w * canvas_h);
+   if (!gif || !canvas || !saved || !indices) {
+       free(gif);
+       free(canvas);
+       free(saved);
+       free(indices);
+       free(buf);
+       return NULL;
+   }
+
+   // Si los frames escalados no caben en el presupuesto, guardarlos a tamaño
+   // nativo y dejar que XRender escale en cada blit (sigue sin usar CPU)
+   gif->frame_width = width;
+   gif->frame_height = height;
+
+   int capacity = 0;
+   int delay_ms = 0, disposal = 0, transparent = -1;
+   int prev_disposal = 0;
+   unsigned int prev_x = 0, prev_y = 0, prev_w = 0, prev_h = 0;
+   size_t frame_budget = (size_t)config.gif_memory_mb * 1024 * 1024;
+   bool ok = true;
+
+   while (pos < size && ok) {
+       uint8_t block = buf[pos++];
+
+       if (block == 0x3B) { // Trailer
+           break;
+       } else if (block == 0x21) { // Extension
+           if (pos >= size) break;
+           uint8_t label = buf[pos++];
+           if (label == 0xF9 && pos + 6 <= size && buf[pos] == 4) {
+               uint8_t flags = buf[pos + 1];
+               disposal = (flags >> 2) & 0x07;
+               delay_ms = (buf[pos + 2] | (buf[pos + 3] << 8)) * 10;
+               transparent = (flags & 0x01) ? buf[pos + 4] : -1;
+               pos += 5;
+           }
+           // Saltar el resto de sub-bloques
+           while (pos < size && buf[pos] != 0) {
+               pos += buf[pos] + 1;
+           }
+           pos++;
+       } else if (block == 0x2C) { // Image descriptor
+           if (pos + 9 > size) break;
+           unsigned int fx = buf[pos] | (buf[pos + 1] << 8);
+           unsigned int fy = buf[pos + 2] | (buf[pos + 3] << 8);
+           unsigned int fw = buf[pos + 4] | (buf[pos + 5] << 8);
+           unsigned int fh = buf[pos + 6] | (buf[pos + 7] << 8);
+           uint8_t flags = buf[pos + 8];
+           pos += 9;
+
+           const uint8_t *palette = global_palette;
+           int colors = global_colors;
+           uint8_t local_palette[256 * 3];
+           if (flags & 0x80) {
+               colors = 2 << (flags & 0x07);
+               if (pos + colors * 3 > size) break;
+               memcpy(local_palette, buf + pos, colors * 3);
+               palette = local_palette;
+               pos += colors * 3;
+           }
+
+           if (pos >= size) break;
+           int min_code_size = buf[pos++];
+           size_t data_len = 0;
+           uint8_t *data = gif_read_sub_blocks(buf, size, &pos, &data_len);
+           if (!data) {
+               ok = false;
+               break;
+           }
+
+           // Decidir dónde escalar según el presupuesto de memoria
+           if (gif->frame_count == 0 && capacity == 0) {
+               size_t scaled_bytes = (size_t)width * height * 4;
+               if (scaled_bytes > 0 && frame_budget / scaled_bytes < 2) {
+                   gif->scale_on_blit = true;
+               }
+           } else if (!gif->scale_on_blit &&
+                      (size_t)(gif->frame_count + 1) * width * height * 4 > frame_budget) {
+               // Demasiados frames: reiniciar en modo escalado por blit
+               LOG_DEBUG(SUBSYS_ENGINE, "GIF exceeds %d MB at %ux%u, scaling on blit instead\n",
+                         config.gif_memory_mb, width, height);
+               free(data);
+               for (int i = 0; i < gif->frame_count; i++) {
+                   XFreePixmap(display, gif->frames[i]);
+               }
+               gif->frame_count = 0;
+               gif->scale_on_blit = true;
+               pos = 13 + global_colors * 3;
+               memset(canvas, 0, (size_t)canvas_w * canvas_h * sizeof(uint32_t));
+               prev_disposal = 0;
+               delay_ms = 0;
+               disposal = 0;
+               transparent = -1;
+               continue;
+           }
+
+           // Aplicar el disposal del frame anterior
+           if (prev_disposal == 2) {
+               for (unsigned int y = prev_y; y < prev_y + prev_h && y < canvas_h; y++) {
+                   for (unsigned int x = prev_x; x < prev_x + prev_w && x < canvas_w; x++) {
+                       canvas[(size_t)y * canvas_w + x] = 0;
+                   }
+               }
+           } else if (prev_disposal == 3) {
+               memcpy(canvas, saved, (size_t)canvas_w * canvas_h * sizeof(uint32_t));
+           }
+           if (disposal == 3) {
+               memcpy(saved, canvas, (size_t)canvas_w * canvas_h * sizeof(uint32_t));
+           }
+
+           size_t pixel_count = (size_t)fw * fh;
+           uint8_t *frame_indices = indices;
+           if (pixel_count > (size_t)canvas_w * canvas_h) {
+               frame_indices = malloc(pixel_count);
+           }
+           if (!frame_indices || !gif_decode_lzw(data, data_len, min_code_size, frame_indices, pixel_count)) {
+               if (frame_indices != indices) free(frame_indices);
+               free(data);
+               ok = gif->frame_count > 0;
+               break;
+           }
+           free(data);
+
+           // Componer sobre el canvas (con soporte de entrelazado)
+           bool interlaced = (flags & 0x40) != 0;
+           static const unsigned int pass_start[] = {0, 4, 2, 1};
+           static const unsigned int pass_step[] = {8, 8, 4, 2};
+           unsigned int pass = 0, row = 0;
+           for (unsigned int i = 0; i < fh; i++) {
+               unsigned int y;
+               if (interlaced) {
+                   while (pass < 4 && pass_start[pass] + row * pass_step[pass] >= fh) {
+                       pass++;
+                       row = 0;
+                   }
+                   if (pass >= 4) break;
+                   y = pass_start[pass] + row * pass_step[pass];
+                   row++;
+               } else {
+                   y = i;
+               }
+
+               unsigned int cy = fy + y;
+               if (cy >= canvas_h) continue;
+               const uint8_t *src = frame_indices + (size_t)i * fw;
+               uint32_t *dst = canvas + (size_t)cy * canvas_w;
+               for (unsigned int x = 0; x < fw; x++) {
+                   unsigned int cx = fx + x;
+                   if (cx >= canvas_w) break;
+                   int index = src[x];
+                   if (index == transparent || index >= colors) continue;
+                   const uint8_t *rgb = palette + index * 3;
+                   dst[cx] = ((uint32_t)rgb[0] << 16) | ((uint32_t)rgb[1] << 8) | rgb[2];
+               }
+           }
+           if (frame_indices != indices) free(frame_indices);
+
+           if (!gif_append_frame(gif, &capacity, canvas, canvas_w, canvas_h, width, height, delay_ms)) {
+               ok = false;
+               break;
+           }
+
+           prev_disposal = disposal;
+           prev_x = fx;
+           prev_y = fy;
+           prev_w = fw;
+           prev_h = fh;
+           delay_ms = 0;
+           disposal = 0;
+           transparent = -1;
+       } else {
+           // Bloque desconocido: archivo corrupto, quedarse con lo decodificado
+           break;
+       }
+   }
+
+   free(canvas);
+   free(saved);
+   free(indices);
+   free(buf);
+
+   if (!ok || gif->frame_count == 0) {
+       free_gif_animation(gif);
+       return NULL;
+   }
+
+   if (gif->scale_on_blit) {
+       gif->frame_width = canvas_w;
+       gif->frame_height = canvas_h;
+       gif->pictures = calloc(gif->frame_count, sizeof(Picture));
+       if (!gif->pictures) {
+           free_gif_animation(gif);
+           return NULL;
+       }
+       for (int i = 0; i < gif->frame_count; i++) {
+           gif->pictures[i] = create_scaled_picture(gif->frames[i], canvas_w, canvas_h, width, height);
+       }
+   }
+
+   LOG_DEBUG(SUBSYS_ENGINE, "Decoded GIF %s: %d frames, %ux%u -> %ux%u (%s)\n",
+             path, gif->frame_count, canvas_w, canvas_h, width, height,
+             gif->scale_on_blit ? "scaled on blit" : "pre-scaled pixmaps");
+
+   return gif;
+}
+
+// Iniciar el motor GIF nativo para una ventana
+static bool start_gif_engine(int window_index) {
+   window_info *win = &config.windows[window_index];
+   const char *path = config.media_playlist.paths[config.media_playlist.current];
+
+   int render_major, render_minor;
+   if (!XRenderQueryExtension(display, &render_major, &render_minor)) {
+       LOG_DEBUG(SUBSYS_ENGINE, "XRender not available, using %s for GIF\n", config.media_player);
+       return false;
+   }
+
+   Visual *visual = DefaultVisual(display, screen);
+   if (DefaultDepth(display, screen) < 24 || visual->red_mask != 0xff0000 ||
+       visual->green_mask != 0x00ff00 || visual->blue_mask != 0x0000ff) {
+       LOG_DEBUG(SUBSYS_ENGINE, "Unsupported visual for native GIF, using %s\n", config.media_player);
+       return false;
+   }
+
+   gif_animation *gif = load_gif_animation(path, win->width, win->height);
+   if (!gif) {
+       return false;
+   }
+
+   if (gif->scale_on_blit) {
+       XRenderPictFormat *format = XRenderFindVisualFormat(display, win->visual);
+       gif->target = XRenderCreatePicture(display, win->window, format, 0, NULL);
+   }
+
+   win->gif = gif;
+   win->engine = ENGINE_GIF;
+   win->player_pid = 0;
+   win->player_active = true;
+   win->player_start_time = time(NULL);
+   win->started_ms = monotonic_ms();
+
+   gif->current = 0;
+   draw_gif_frame(win);
+   gif->next_frame_ms = monotonic_ms() + gif->delays_ms[0];
+
+   LOG_DEBUG(SUBSYS_ENGINE, "Native GIF engine started for window %d with file: %s\n",
+             window_index, path);
+   return true;
+}
+
+// Copiar el frame actual del GIF a la ventana
+static void draw_gif_frame(window_info *win) {
+   gif_animation *gif = win->gif;
+   if (!gif || win->window == None) return;
+
+   if (gif->scale_on_blit) {
+       XRenderComposite(display, PictOpSrc, gif->pictures[gif->current], None, gif->target,
+                        0, 0, 0, 0, 0, 0, win->width, win->height);
+   } else {
+       GC gc = DefaultGC(display, screen);
+       XCopyArea(display, gif->frames[gif->current], win->window, gc,
+                 0, 0, gif->frame_width, gif->frame_height, 0, 0);
+   }
+}
+
+// Leer el tiempo de CPU (user+system) de un proceso desde /proc, en segundos
+static double read_process_cpu_seconds(pid_t pid) {
+   char path[64];
+   snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+   FILE *file = fopen(path, "r");
+   if (!file) return -1.0;
+
+   char buf[1024];
+   size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+   fclose(file);
+   buf[len] = '\0';
+
+   // El nombre del proceso puede contener espacios: empezar tras el último ')'
+   char *p = strrchr(buf, ')');
+   if (!p) return -1.0;
+
+   unsigned long utime = 0, stime = 0;
+   if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+       return -1.0;
+   }
+   return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// CPU consumida por el propio daemon, en segundos
+static double self_cpu_seconds(void) {
+   struct rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+          usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+// RSS actual del daemon en KB
+static long self_rss_kb(void) {
+   FILE *file = fopen("/proc/self/statm", "r");
+   if (!file) return -1;
+
+   long pages_total = 0, pages_resident = 0;
+   if (fscanf(file, "%ld %ld", &pages_total, &pages_resident) != 2) {
+       pages_resident = -1;
+   }
+   fclose(file);
+   return pages_resident < 0 ? -1 : pages_resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Lanzar un programa auxiliar con su stdout conectado a un pipe
+static int spawn_reader(char *const argv[], pid_t *pid_out) {
+   int fds[2];
+   if (pipe(fds) != 0) {
+       LOG_DEBUG(SUBSYS_CORE, "pipe: %s\n", strerror(errno));
+       return -1;
+   }
+
+   pid_t pid = fork();
+   if (pid == 0) {
+       int devnull = open("/dev/null", O_RDWR);
+       if (devnull != -1) {
+           dup2(devnull, STDIN_FILENO);
+           if (!debug) dup2(devnull, STDERR_FILENO);
+           close(devnull);
+       }
+       dup2(fds[1], STDOUT_FILENO);
+       close(fds[0]);
+       close(fds[1]);
+
+       execvp(argv[0], argv);
+       _exit(127);
+   } else if (pid < 0) {
+       perror("fork");
+       close(fds[0]);
+       close(fds[1]);
+       return -1;
+   }
+
+   close(fds[1]);
+   fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+   *pid_out = pid;
+   return fds[0];
+}
+
+static bool parse_probe_output(char *output, media_probe *info);
+
+// Interpretar la salida de ffprobe
+static bool parse_probe_output(char *output, media_probe *info) {
+   memset(info, 0, sizeof(*info));
+   for (char *line = strtok(output, "\n"); line; line = strtok(NULL, "\n")) {
+       if (strncmp(line, "width=", 6) == 0) {
+           info->width = (unsigned int)atoi(line + 6);
+       } else if (strncmp(line, "height=", 7) == 0) {
+           info->height = (unsigned int)atoi(line + 7);
+       } else if (strncmp(line, "avg_frame_rate=", 15) == 0) {
+           int num = 0, den = 0;
+           if (sscanf(line + 15, "%d/%d", &num, &den) == 2 && num > 0 && den > 0) {
+               info->fps = (double)num / den;
+           }
+       } else if (strncmp(line, "duration=", 9) == 0) {
+           info->duration = atof(line + 9);
+       }
+   }
+
+   info->has_video = info->width > 0 && info->height > 0;
+   return info->has_video;
+}
+
+// Caché de ffprobe por ruta (validada con mtime y tamaño). Las consultas no
+// esperan: si falta, se lanza ffprobe y su salida se recoge desde el bucle
+// principal; hasta entonces el elemento se trata como sin datos
+typedef struct {
+    char path[MAX_PATH];
+    time_t mtime;
+    off_t size;
+    media_probe info;
+    bool done;
+    int fd;                  // Salida de ffprobe mientras corre (-1 = ninguno)
+    char output[1024];
+    size_t length;
+    long long used_ms;
+} probe_entry;
+
+static probe_entry probe_cache[PROBE_CACHE_SIZE];
+static int probe_cache_count = 0;
+
+static void finish_probe(probe_entry *entry) {
+   unwatch_fd(entry->fd);
+   close(entry->fd);
+   entry->fd = -1;
+   entry->output[entry->length] = '\0';
+   parse_probe_output(entry->output, &entry->info);
+   entry->done = true;
+   LOG_DEBUG(SUBSYS_PLAYER, "Probed %s: %ux%u@%.2f\n", entry->path,
+             entry->info.width, entry->info.height, entry->info.fps);
+}
+
+// Leer lo que haya sin bloquear; EOF = ffprobe terminó
+static void drain_probe(probe_entry *entry) {
+   while (entry->fd >= 0) {
+       ssize_t n = read(entry->fd, entry->output + entry->length, sizeof(entry->output) - 1 - entry->length);
+       if (n > 0) {
+           entry->length += n;
+           if (entry->length < sizeof(entry->output) - 1) continue;
+       } else if (n < 0 && errno == EINTR) {
+           continue;
+       } else if (n < 0 && errno == EAGAIN) {
+           return;
+       }
+       finish_probe(entry);
+   }
+}
+
+static void handle_probe_output(int fd, short revents) {
+   (void)revents;
+   for (int i = 0; i < probe_cache_count; i++) {
+       if (probe_cache[i].fd == fd) {
+           drain_probe(&probe_cache[i]);
+           return;
+       }
+   }
+}
+
+// Hueco para una ruta nueva: uno libre o el terminado que menos se usó
+static probe_entry *probe_slot(void) {
+   if (probe_cache_count < PROBE_CACHE_SIZE) return &probe_cache[probe_cache_count];
+   probe_entry *oldest = NULL;
+   for (int i = 0; i < probe_cache_count; i++) {
+       if (probe_cache[i].fd >= 0) continue;
+       if (!oldest || probe_cache[i].used_ms < oldest->used_ms) oldest = &probe_cache[i];
+   }
+   return oldest;
+}
+
+static void start_probe(probe_entry *entry, const char *path, const struct stat *st) {
+   int running = 0;
+   for (int i = 0; i < probe_cache_count; i++) {
+       if (probe_cache[i].fd >= 0) running++;
+   }
+   if (running >= PROBE_MAX_RUNNING) return;
+
+   char *argv[] = {
+       "ffprobe", "-v", "error", "-select_streams", "v:0",
+       "-show_entries", "stream=width,height,avg_frame_rate:format=duration",
+       "-of", "default=noprint_wrappers=1", (char *)path, NULL
+   };
+   pid_t pid;
+   int fd = spawn_reader(argv, &pid);
+   if (fd < 0) return;
+   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+   if (!watch_fd(fd, POLLIN, handle_probe_output)) {
+       close(fd);
+       kill(pid, SIGTERM);
+       return;
+   }
+
+   memset(entry, 0, sizeof(*entry));
+   strncpy(entry->path, path, sizeof(entry->path) - 1);
+   entry->mtime = st->st_mtime;
+   entry->size = st->st_size;
+   entry->fd = fd;
+   entry->used_ms = monotonic_ms();
+   if (entry == &probe_cache[probe_cache_count]) probe_cache_count++;
+}
+
+// Resultado de ffprobe si ya está; si no, lo pide y devuelve false
+static bool cached_probe(const char *path, media_probe *info) {
+   memset(info, 0, sizeof(*info));
+   struct stat st;
+   if (stat(path, &st) != 0) return false;
+
+   for (int i = 0; i < probe_cache_count; i++) {
+       probe_entry *entry = &probe_cache[i];
+       if (strcmp(entry->path, path) != 0) continue;
+       if (entry->mtime != st.st_mtime || entry->size != st.st_size) {
+           // El archivo cambió: volver a preguntar cuando acabe el anterior
+           if (entry->fd >= 0) return false;
+           start_probe(entry, path, &st);
+           return false;
+       }
+       drain_probe(entry);
+       if (!entry->done) return false;
+       entry->used_ms = monotonic_ms();
+       *info = entry->info;
+       return info->has_video;
+   }
+
+   probe_entry *entry = probe_slot();
+   if (entry) start_probe(entry, path, &st);
+   return false;
+}
+
+// Tener sondeados el elemento actual, los siguientes y los fijados por
+// ventana antes de arrancar sus reproductores
+static void prefetch_media_probes(void) {
+   int count = config.media_playlist.count;
+   media_probe info;
+   for (int ahead = 0; ahead <= IMAGE_PREFETCH_AHEAD && ahead < count; ahead++) {
+       const char *path = config.media_playlist.paths[(config.media_playlist.current + ahead) % count];
+       if (!is_image_item(path)) cached_probe(path, &info);
+   }
+   for (int w = 0; config.windows && w < config.window_count; w++) {
+       int item = config.windows[w].playlist_item;
+       if (item >= 0 && item < count && !is_image_item(config.media_playlist.paths[item])) {
+           cached_probe(config.media_playlist.paths[item], &info);
+       }
+   }
+}
+
+// Codificar un entero sin signo como varint (LEB128)
+static uint8_t *put_varint(uint8_t *p, size_t value) {
+   while (value >= 0x80) {
+       *p++ = (uint8_t)(value | 0x80);
+       value >>= 7;
+   }
+   *p++ = (uint8_t)value;
+   return p;
+}
+
+static size_t get_varint(const uint8_t **p, const uint8_t *end) {
+   size_t value = 0;
+   int shift = 0;
+   while (*p < end && shift < 63) {
+       uint8_t byte = *(*p)++;
+       value |= (size_t)(byte & 0x7f) << shift;
+       if (!(byte & 0x80)) break;
+       shift += 7;
+   }
+   return value;
+}
+
+// Comprimir un frame como delta XOR contra el anterior: pares
+// (píxeles sin cambios, píxeles cambiados) seguidos del BGR de los cambiados.
+// Los huecos de un solo píxel se absorben en el literal para acotar el tamaño.
+static uint32_t loop_encode_frame(const uint32_t *cur, const uint32_t *prev, size_t count,
+                                  uint8_t *out, size_t *first_changed, size_t *last_changed) {
+   uint8_t *p = out;
+   size_t pos = 0;
+
+   *first_changed = count;
+   *last_changed = 0;
+
+   while (pos < count) {
+       size_t skip = 0;
+       while (pos + skip < count && ((cur[pos + skip] ^ prev[pos + skip]) & 0xffffff) == 0) {
+           skip++;
+       }
+       if (pos + skip == count) break;
+
+       size_t start = pos + skip;
+       size_t end = start;
+       while (end < count) {
+           if ((cur[end] ^ prev[end]) & 0xffffff) {
+               end++;
+           } else if (end + 1 < count && ((cur[end + 1] ^ prev[end + 1]) & 0xffffff)) {
+               end += 2;
+           } else {
+               break;
+           }
+       }
+
+       p = put_varint(p, skip);
+       p = put_varint(p, end - start);
+       for (size_t i = start; i < end; i++) {
+           uint32_t delta = cur[i] ^ prev[i];
+           *p++ = (uint8_t)delta;
+           *p++ = (uint8_t)(delta >> 8);
+           *p++ = (uint8_t)(delta >> 16);
+       }
+
+       if (start < *first_changed) *first_changed = start;
+       *last_changed = end - 1;
+       pos = end;
+   }
+
+   return (uint32_t)(p - out);
+}
+
+// Aplicar un frame comprimido sobre el frame anterior ya reconstruido
+static void loop_apply_frame(const uint8_t *data, uint32_t size, uint32_t *pixels, size_t count) {
+   const uint8_t *p = data;
+   const uint8_t *end = data + size;
+   size_t pos = 0;
+
+   while (p < end) {
+       pos += get_varint(&p, end);
+       size_t literal = get_varint(&p, end);
+       if (pos + literal > count || p + literal * 3 > end) return;
+
+       uint32_t *dst = pixels + pos;
+       for (size_t i = 0; i < literal; i++, p += 3) {
+           dst[i] ^= (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+       }
+       pos += literal;
+   }
+}
+
+// Liberar los frames y buffers de un clip (queda como tombstone si failed)
+static void loop_clip_release_data(loop_clip *clip) {
+   if (clip->decoder_fd >= 0) {
+       close(clip->decoder_fd);
+       clip->decoder_fd = -1;
+   }
+   if (clip->decoder_pid > 0) {
+       kill(clip->decoder_pid, SIGTERM);
+       clip->decoder_pid = 0;
+   }
+
+   for (int i = 0; i < clip->frame_count; i++) {
+       free(clip->frames[i]);
+   }
+   free(clip->frames);
+   free(clip->frame_sizes);
+   free(clip->dirty_first);
+   free(clip->dirty_last);
+   free(clip->read_buf);
+   free(clip->prev_raw);
+   free(clip->scratch);
+   clip->frames = NULL;
+   clip->frame_sizes = NULL;
+   clip->dirty_first = NULL;
+   clip->dirty_last = NULL;
+   clip->read_buf = NULL;
+   clip->prev_raw = NULL;
+   clip->scratch = NULL;
+
+   loop_cache_bytes -= clip->bytes;
+   clip->bytes = 0;
+   clip->frame_count = 0;
+   clip->capacity = 0;
+}
+
+// Marcar un clip como no cacheable; las ventanas vuelven al reproductor
+static void loop_clip_fail(loop_clip *clip, const char *reason) {
+   LOG_DEBUG(SUBSYS_ENGINE, "Loop cache disabled for %s (%ux%u): %s\n",
+             clip->path, clip->width, clip->height, reason);
+   loop_clip_release_data(clip);
+   clip->failed = true;
+   clip->complete = false;
+}
+
+// Buscar un clip en la cache por ruta y resolución
+static loop_clip *loop_cache_find(const char *path, unsigned int width, unsigned int height) {
+   for (loop_clip *clip = loop_cache; clip; clip = clip->next) {
+       if (clip->width == width && clip->height == height && strcmp(clip->path, path) == 0) {
+           return clip;
+       }
+   }
+   return NULL;
+}
+
+// Hacer sitio en la cache desalojando clips completos sin uso (LRU)
+static bool loop_cache_reserve(size_t bytes) {
+   size_t budget = (size_t)config.loop_cache_mb * 1024 * 1024;
+
+   while (loop_cache_bytes + bytes > budget) {
+       loop_clip *victim = NULL;
+       for (loop_clip *clip = loop_cache; clip; clip = clip->next) {
+           if (clip->complete && clip->refs == 0 &&
+               (!victim || clip->last_used_ms < victim->last_used_ms)) {
+               victim = clip;
+           }
+       }
+       if (!victim) return false;
+
+       LOG_DEBUG(SUBSYS_ENGINE, "Evicting %s from loop cache (%zu KB)\n",
+                 victim->path, victim->bytes / 1024);
+
+       loop_clip_release_data(victim);
+       victim->complete = false;
+
+       // Quitar de la lista: se volverá a decodificar si se necesita
+       loop_clip **link = &loop_cache;
+       while (*link != victim) link = &(*link)->next;
+       *link = victim->next;
+       free(victim);
+   }
+
+   return true;
+}
+
+// Comprimir y guardar el frame crudo recién leído del decodificador
+static void loop_clip_add_frame(loop_clip *clip) {
+   size_t count = (size_t)clip->width * clip->height;
+
+   if (clip->frame_count == clip->capacity) {
+       int new_cap = clip->capacity ? clip->capacity * 2 : 64;
+       uint8_t **frames = realloc(clip->frames, new_cap * sizeof(uint8_t *));
+       if (frames) clip->frames = frames;
+       uint32_t *sizes = realloc(clip->frame_sizes, new_cap * sizeof(uint32_t));
+       if (sizes) clip->frame_sizes = sizes;
+       int *first = realloc(clip->dirty_first, new_cap * sizeof(int));
+       if (first) clip->dirty_first = first;
+       int *last = realloc(clip->dirty_last, new_cap * sizeof(int));
+       if (last) clip->dirty_last = last;
+       if (!frames || !sizes || !first || !last) {
+           loop_clip_fail(clip, "out of memory");
+           return;
+       }
+       clip->capacity = new_cap;
+   }
+
+   size_t first_changed, last_changed;
+   uint32_t size = loop_encode_frame(clip->read_buf, clip->prev_raw, count, clip->scratch,
+                                     &first_changed, &last_changed);
+
+   if (!loop_cache_reserve(size)) {
+       loop_clip_fail(clip, "memory budget exceeded");
+       return;
+   }
+
+   uint8_t *data = malloc(size ? size : 1);
+   if (!data) {
+       loop_clip_fail(clip, "out of memory");
+       return;
+   }
+   memcpy(data, clip->scratch, size);
+
+   int index = clip->frame_count++;
+   clip->frames[index] = data;
+   clip->frame_sizes[index] = size;
+   clip->dirty_first[index] = first_changed < count ? (int)(first_changed / clip->width) : 0;
+   clip->dirty_last[index] = first_changed < count ? (int)(last_changed / clip->width) : -1;
+   clip->bytes += size;
+   loop_cache_bytes += size;
+
+   // El frame actual pasa a ser la referencia del siguiente delta
+   uint32_t *tmp = clip->prev_raw;
+   clip->prev_raw = clip->read_buf;
+   clip->read_buf = tmp;
+
+   if (clip->frame_count % 30 == 0 && clip->decoder_pid > 0) {
+       double cpu = read_process_cpu_seconds(clip->decoder_pid);
+       if (cpu >= 0) clip->decoder_cpu_sec = cpu;
+   }
+}
+
+// Leer del decodificador (sin bloquear) hasta tener el frame pedido
+static void loop_clip_pump(loop_clip *clip, int wanted_index) {
+   size_t frame_bytes = (size_t)clip->width * clip->height * 4;
+   int max_frames = (int)(config.loop_cache_max_seconds * 1000.0 / clip->frame_ms) + 2;
+
+   while (clip->frame_count <= wanted_index && !clip->complete && !clip->failed) {
+       ssize_t n = read(clip->decoder_fd, (uint8_t *)clip->read_buf + clip->read_filled,
+                        frame_bytes - clip->read_filled);
+       if (n > 0) {
+           clip->read_filled += n;
+           if (clip->read_filled == frame_bytes) {
+               clip->read_filled = 0;
+               loop_clip_add_frame(clip);
+               if (clip->frame_count > max_frames) {
+                   loop_clip_fail(clip, "clip longer than loop_cache_max_seconds");
+               }
+           }
+       } else if (n == 0) {
+           // EOF: el primer loop está completo, los siguientes salen de la cache
+           if (clip->frame_count == 0) {
+               loop_clip_fail(clip, "decoder produced no frames");
+               break;
+           }
+           close(clip->decoder_fd);
+           clip->decoder_fd = -1;
+           clip->decoder_pid = 0;
+           free(clip->read_buf);
+           free(clip->prev_raw);
+           free(clip->scratch);
+           clip->read_buf = NULL;
+           clip->prev_raw = NULL;
+           clip->scratch = NULL;
+           clip->complete = true;
+
+           if (log_enabled(LOG_LEVEL_DEBUG, SUBSYS_ENGINE)) {
+               size_t raw = (size_t)clip->frame_count * frame_bytes;
+               log_write(LOG_LEVEL_DEBUG, SUBSYS_ENGINE, "Loop cache complete for %s: %d frames, %zu KB "
+                         "(%.1fx smaller than raw), decoder CPU %.2fs, cache total %zu KB\n",
+                         clip->path, clip->frame_count, clip->bytes / 1024,
+                         clip->bytes ? (double)raw / clip->bytes : 0.0,
+                         clip->decoder_cpu_sec, loop_cache_bytes / 1024);
+           }
+       } else if (errno == EINTR) {
+           continue;
+       } else {
+           if (errno != EAGAIN && errno != EWOULDBLOCK) {
+               loop_clip_fail(clip, "decoder read error");
+           }
+           break;
+       }
+   }
+}
+
+// Crear un clip nuevo y lanzar ffmpeg para decodificarlo a la resolución del monitor
+static loop_clip *loop_clip_create(const char *path, unsigned int width, unsigned int height,
+                                   const media_probe *info) {
+   loop_clip *clip = calloc(1, sizeof(loop_clip));
+   if (!clip) return NULL;
+
+   strncpy(clip->path, path, sizeof(clip->path) - 1);
+   clip->width = width;
+   clip->height = height;
+   clip->decoder_fd = -1;
+   clip->next = loop_cache;
+   loop_cache = clip;
+
+   if (info->duration <= 0 || info->duration > config.loop_cache_max_seconds || info->fps <= 0) {
+       loop_clip_fail(clip, "not a short clip");
+       return clip;
+   }
+
+   size_t count = (size_t)width * height;
+   clip->frame_ms = 1000.0 / info->fps;
+   clip->read_buf = malloc(count * sizeof(uint32_t));
+   clip->prev_raw = calloc(count, sizeof(uint32_t));
+   clip->scratch = malloc(count * 8 + 16);
+   if (!clip->read_buf || !clip->prev_raw || !clip->scratch) {
+       loop_clip_fail(clip, "out of memory");
+       return clip;
+   }
+
+   char scale[64];
+   snprintf(scale, sizeof(scale), "scale=%u:%u", width, height);
+   char *argv[] = {
+       "ffmpeg", "-v", "error", "-nostdin", "-i", (char *)path, "-an", "-sn",
+       "-vf", scale, "-pix_fmt", "bgr0", "-f", "rawvideo", "-", NULL
+   };
+
+   clip->decoder_fd = spawn_reader(argv, &clip->decoder_pid);
+   if (clip->decoder_fd < 0) {
+       loop_clip_fail(clip, "could not start ffmpeg");
+       return clip;
+   }
+   fcntl(clip->decoder_fd, F_SETFL, fcntl(clip->decoder_fd, F_GETFL) | O_NONBLOCK);
+
+   LOG_DEBUG(SUBSYS_ENGINE, "Decoding %s once at %ux%u, %.2f fps, %.1fs into loop cache\n",
+             path, width, height, info->fps, info->duration);
+   return clip;
+}
+
+// Capturar errores de XShmAttach (servidor remoto) sin abortar
+static bool shm_attach_failed = false;
+static int shm_error_trap(Display *dpy, XErrorEvent *event) {
+   (void)dpy;
+   (void)event;
+   shm_attach_failed = true;
+   return 0;
+}
+
+// Sink X: imagen de la ventana, en memoria compartida si es posible
+static bool x_sink_open(frame_sink *sink) {
+   int depth = DefaultDepth(display, screen);
+
+   if (XShmQueryExtension(display)) {
+       sink->image = XShmCreateImage(display, sink->visual, depth, ZPixmap, NULL, &sink->shm,
+                                     sink->width, sink->height);
+       if (sink->image && sink->image->bytes_per_line == (int)sink->width * 4) {
+           sink->shm.shmid = shmget(IPC_PRIVATE, (size_t)sink->image->bytes_per_line * sink->height,
+                                    IPC_CREAT | 0600);
+           if (sink->shm.shmid >= 0) {
+               sink->shm.shmaddr = shmat(sink->shm.shmid, NULL, 0);
+               sink->shm.readOnly = False;
+               if (sink->shm.shmaddr != (char *)-1) {
+                   XErrorHandler old_handler = XSetErrorHandler(shm_error_trap);
+                   shm_attach_failed = false;
+                   XShmAttach(display, &sink->shm);
+                   XSync(display, False);
+                   XSetErrorHandler(old_handler);
+
+                   // Se borra en cuanto ambos extremos se desconecten
+                   shmctl(sink->shm.shmid, IPC_RMID, NULL);
+
+                   if (!shm_attach_failed) {
+                       sink->image->data = sink->shm.shmaddr;
+                       sink->pixels = (uint32_t *)sink->shm.shmaddr;
+                       sink->use_shm = true;
+                       memset(sink->pixels, 0, (size_t)sink->width * sink->height * 4);
+                       return true;
+                   }
+                   shmdt(sink->shm.shmaddr);
+               } else {
+                   shmctl(sink->shm.shmid, IPC_RMID, NULL);
+               }
+           }
+       }
+       if (sink->image) {
+           XDestroyImage(sink->image);
+           sink->image = NULL;
+       }
+   }
+
+   sink->pixels = calloc((size_t)sink->width * sink->height, sizeof(uint32_t));
+   if (!sink->pixels) return false;
+
+   sink->image = XCreateImage(display, sink->visual, depth, ZPixmap, 0, (char *)sink->pixels,
+                              sink->width, sink->height, 32, sink->width * 4);
+   if (!sink->image) {
+       free(sink->pixels);
+       sink->pixels = NULL;
+       return false;
+   }
+   const uint16_t probe = 1;
+   sink->image->byte_order = (*(const uint8_t *)&probe == 1) ? LSBFirst : MSBFirst;
+   return true;
+}
+
+// Enviar filas [first, last] de la imagen al servidor
+static void x_sink_present(frame_sink *sink, int first, int last) {
+   if (first > last || sink->window == None) return;
+
+   GC gc = DefaultGC(display, screen);
+   unsigned int rows = (unsigned int)(last - first + 1);
+   if (sink->use_shm) {
+       XShmPutImage(display, sink->window, gc, sink->image, 0, first, 0, first, sink->width, rows, False);
+   } else {
+       XPutImage(display, sink->window, gc, sink->image, 0, first, 0, first, sink->width, rows);
+   }
+}
+
+static void x_sink_close(frame_sink *sink) {
+   if (!sink->image) return;
+
+   if (sink->use_shm) {
+       XShmDetach(display, &sink->shm);
+       XSync(display, False);
+       shmdt(sink->shm.shmaddr);
+       sink->image->data = NULL;
+   }
+   // XDestroyImage libera también los píxeles en el caso sin shm
+   XDestroyImage(sink->image);
+   sink->image = NULL;
+   sink->pixels = NULL;
+}
+
+// Sink null: el frame se construye igual pero no se publica
+static bool null_sink_open(frame_sink *sink) {
+   sink->pixels = calloc((size_t)sink->width * sink->height, sizeof(uint32_t));
+   return sink->pixels != NULL;
+}
+
+static void null_sink_present(frame_sink *sink, int first, int last) {
+   (void)sink;
+   (void)first;
+   (void)last;
+}
+
+static void null_sink_close(frame_sink *sink) {
+   free(sink->pixels);
+   sink->pixels = NULL;
+}
+
+// Sink de archivo: frames BGRX completos uno tras otro (rawvideo bgr0)
+static bool file_sink_open(frame_sink *sink) {
+   if (!sink->path) return false;
+
+   sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (sink->fd < 0) {
+       LOG_DEBUG(SUBSYS_ENGINE, "open sink file: %s\n", strerror(errno));
+       return false;
+   }
+   if (!null_sink_open(sink)) {
+       close(sink->fd);
+       sink->fd = -1;
+       return false;
+   }
+   return true;
+}
+
+static void file_sink_present(frame_sink *sink, int first, int last) {
+   (void)first;
+   (void)last;
+
+   // Un stream crudo necesita todos los frames, aunque no cambien
+   const uint8_t *data = (const uint8_t *)sink->pixels;
+   size_t left = (size_t)sink->width * sink->height * 4;
+   while (left > 0) {
+       ssize_t n = write(sink->fd, data, left);
+       if (n < 0) {
+           if (errno == EINTR) continue;
+           LOG_DEBUG(SUBSYS_ENGINE, "write sink file: %s\n", strerror(errno));
+           return;
+       }
+       data += n;
+       left -= n;
+       sink->bytes_written += n;
+   }
+}
+
+static void file_sink_close(frame_sink *sink) {
+   if (sink->fd >= 0) {
+       close(sink->fd);
+       sink->fd = -1;
+   }
+   null_sink_close(sink);
+}
+
+static const frame_sink_ops x_sink = {"x", x_sink_open, x_sink_present, x_sink_close};
+static const frame_sink_ops null_sink = {"null", null_sink_open, null_sink_present, null_sink_close};
+static const frame_sink_ops file_sink = {"file", file_sink_open, file_sink_present, file_sink_close};
+
+// Abrir un sink con ops, tamaño y destino (ventana o ruta) ya rellenados
+static bool frame_sink_open(frame_sink *sink) {
+   sink->pixels = NULL;
+   sink->image = NULL;
+   sink->use_shm = false;
+   sink->fd = -1;
+   sink->frames = 0;
+   sink->bytes_written = 0;
+   return sink->ops->open(sink);
+}
+
+static void frame_sink_present(frame_sink *sink, int first, int last) {
+   sink->ops->present(sink, first, last);
+   sink->frames++;
+}
+
+static void frame_sink_close(frame_sink *sink) {
+   if (sink->ops) sink->ops->close(sink);
+}
+
+// Detener la reproducción desde cache de una ventana
+static void stop_loop_cache_engine(window_info *win) {
+   loop_playback *lp = win->loop;
+   if (!lp) return;
+
+   frame_sink_close(&lp->sink);
+
+   loop_clip *clip = lp->clip;
+   if (clip && --clip->refs == 0) {
+       clip->last_used_ms = monotonic_ms();
+       if (!clip->complete && !clip->failed) {
+           // Decodificación a medias sin nadie mirando: descartar
+           loop_clip_fail(clip, "playback stopped before first loop finished");
+       }
+   }
+
+   free(lp);
+   win->loop = NULL;
+}
+
+// Iniciar la reproducción de un clip corto desde la cache en RAM
+static bool start_loop_cache_engine(int window_index) {
+   TRACE_SCOPE("start_loop_cache_engine", window_index);
+   window_info *win = &config.windows[window_index];
+   const char *path = config.media_playlist.paths[config.media_playlist.current];
+
+   if (!config.loop_cache || is_native_gif_item(path)) return false;
+
+   Visual *visual = DefaultVisual(display, screen);
+   if (DefaultDepth(display, screen) < 24 || visual->red_mask != 0xff0000 ||
+       visual->green_mask != 0x00ff00 || visual->blue_mask != 0x0000ff) {
+       return false;
+   }
+
+   loop_clip *clip = loop_cache_find(path, win->width, win->height);
+   if (!clip) {
+       // Sin ffprobe todavía (o sin vídeo): esta vez con el reproductor
+       media_probe info;
+       if (!cached_probe(path, &info)) return false;
+       clip = loop_clip_create(path, win->width, win->height, &info);
+       if (!clip) return false;
+   }
+   if (clip->failed) return false;
+
+   loop_playback *lp = calloc(1, sizeof(loop_playback));
+   if (!lp) return false;
+   lp->sink.ops = &x_sink;
+   lp->sink.width = win->width;
+   lp->sink.height = win->height;
+   lp->sink.window = win->window;
+   lp->sink.visual = win->visual;
+   if (!frame_sink_open(&lp->sink)) {
+       free(lp);
+       return false;
+   }
+
+   lp->clip = clip;
+   lp->index = 0;
+   lp->pending_last = -1;
+   lp->loop_start_ms = monotonic_ms();
+   lp->loop_cpu_start = self_cpu_seconds();
+   clip->refs++;
+
+   win->loop = lp;
+   win->engine = ENGINE_LOOP_CACHE;
+   win->frames_shown = 0;
+   win->frames_dropped = 0;
+   win->player_pid = 0;
+   win->player_active = true;
+   win->player_start_time = time(NULL);
+   win->started_ms = monotonic_ms();
+
+   LOG_DEBUG(SUBSYS_ENGINE, "Window %d playing %s from loop cache (%s)\n", window_index, path,
+             clip->complete ? "cached" : "first loop, decoding");
+   return true;
+}
+
+// Avanzar un frame de la cache; devuelve el próximo deadline
+static long long service_loop_playback(int window_index, long long now) {
+   window_info *win = &config.windows[window_index];
+   loop_playback *lp = win->loop;
+   loop_clip *clip = lp->clip;
+
+   long long due = lp->loop_start_ms + (long long)(lp->index * clip->frame_ms);
+   if (now < due) return due;
+
+   if (lp->index >= clip->frame_count) {
+       if (!clip->complete && !clip->failed) {
+           loop_clip_pump(clip, lp->index);
+       }
+
+       if (clip->failed) {
+           // No cabe o no es un clip corto: volver al reproductor externo
+           terminate_player(window_index);
+           start_media_player(window_index);
+           return -1;
+       }
+
+       if (lp->index >= clip->frame_count) {
+           if (!clip->complete) {
+               return now + 5; // El decodificador aún no ha entregado el frame
+           }
+
+           // Fin del loop: volver al frame 0 (delta contra negro)
+           lp->loops++;
+           if (log_enabled(LOG_LEVEL_DEBUG, SUBSYS_ENGINE) && (lp->loops <= 2 || lp->loops % 100 == 0)) {
+               double cpu = self_cpu_seconds();
+               log_write(LOG_LEVEL_DEBUG, SUBSYS_ENGINE, "Window %d loop %d: daemon CPU %.1f ms%s, RSS %ld KB, "
+                         "cache %zu KB (first loop decoder CPU %.2fs)\n",
+                         window_index, lp->loops, (cpu - lp->loop_cpu_start) * 1000.0,
+                         lp->loops == 1 ? " (decoding)" : " (from cache)",
+                         self_rss_kb(), loop_cache_bytes / 1024, clip->decoder_cpu_sec);
+               lp->loop_cpu_start = cpu;
+           }
+           memset(lp->sink.pixels, 0, (size_t)win->width * win->height * 4);
+           lp->index = 0;
+           lp->loop_start_ms = due;
+       }
+   }
+
+   loop_apply_frame(clip->frames[lp->index], clip->frame_sizes[lp->index], lp->sink.pixels,
+                    (size_t)win->width * win->height);
+   // Con fps limitado los deltas se aplican todos (son acumulativos) pero
+   // solo se envía la unión de filas cambiadas al ritmo permitido
+   int first = clip->dirty_first[lp->index], last = clip->dirty_last[lp->index];
+   if (lp->pending_first <= lp->pending_last) {
+       if (first > last) {
+           first = lp->pending_first;
+           last = lp->pending_last;
+       } else {
+           if (lp->pending_first < first) first = lp->pending_first;
+           if (lp->pending_last > last) last = lp->pending_last;
+       }
+   }
+   int cap = window_fps_cap(win);
+   if (cap > 0 && cap * clip->frame_ms < 1000.0 && now - lp->last_present_ms < 1000 / cap) {
+       lp->pending_first = first;
+       lp->pending_last = last;
+   } else {
+       frame_sink_present(&lp->sink, first, last);
+       lp->pending_first = 0;
+       lp->pending_last = -1;
+       lp->last_present_ms = now;
+   }
+   win->frames_shown++;
+   lp->index++;
+
+   // Si vamos muy retrasados no intentar recuperar frames perdidos
+   long long next = lp->loop_start_ms + (long long)(lp->index * clip->frame_ms);
+   if (now - next > 250) {
+       win->frames_dropped += (unsigned long)((now - next) / clip->frame_ms);
+       lp->loop_start_ms = now - (long long)(lp->index * clip->frame_ms);
+       next = now;
+   }
+   clip->last_used_ms = now;
+   return next;
+}
+
+// Verificar si un elemento de la playlist es una imagen fija
+static bool is_image_item(const char *path) {
+   if (!path) return false;
+
+   const char *dot = strrchr(path, '.');
+   if (!dot) return false;
+
+   const char *extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".webp"};
+   for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+       if (strcasecmp(dot, extensions[i]) == 0) return true;
+   }
+   return false;
+}
+
+// Decodificar una imagen con ffmpeg, escalada y recortada a width x height (BGRX)
+static uint32_t *decode_image_scaled(const char *path, unsigned int width, unsigned int height) {
+   char filter[128];
+   snprintf(filter, sizeof(filter),
+            "scale=%u:%u:force_original_aspect_ratio=increase,crop=%u:%u",
+            width, height, width, height);
+   char *argv[] = {
+       "ffmpeg", "-v", "error", "-nostdin", "-i", (char *)path, "-frames:v", "1",
+       "-vf", filter, "-pix_fmt", "bgr0", "-f", "rawvideo", "-", NULL
+   };
+
+   size_t size = (size_t)width * height * 4;
+   uint32_t *pixels = malloc(size);
+   if (!pixels) return NULL;
+
+   pid_t pid;
+   int fd = spawn_reader(argv, &pid);
+   if (fd < 0) {
+       free(pixels);
+       return NULL;
+   }
+
+   size_t total = 0;
+   while (total < size) {
+       ssize_t n = read(fd, (uint8_t *)pixels + total, size - total);
+       if (n > 0) {
+           total += n;
+       } else if (n < 0 && errno == EINTR) {
+           continue;
+       } else {
+           break;
+       }
+   }
+   close(fd);
+
+   if (total != size) {
+       LOG_DEBUG(SUBSYS_ENGINE, "Could not decode image %s at %ux%u\n", path, width, height);
+       free(pixels);
+       return NULL;
+   }
+   return pixels;
+}
+
+// Conexión propia con RetainPermanent: el pixmap raíz sobrevive al daemon
+static bool open_root_pixmap(void) {
+   unsigned int width = DisplayWidth(display, screen);
+   unsigned int height = DisplayHeight(display, screen);
+
+   if (!root_display) {
+       root_display = XOpenDisplay(DisplayString(display));
+       if (!root_display) {
+           fprintf(stderr, NAME ": Error: couldn't open display for root pixmap\n");
+           return false;
+       }
+       XSetCloseDownMode(root_display, RetainPermanent);
+   }
+
+   if (root_pixmap != None && root_pixmap_width == width && root_pixmap_height == height) {
+       return true;
+   }
+
+   // La pantalla cambió de tamaño: empezar un pixmap nuevo. El viejo sigue
+   // publicado hasta que publish_root_pixmap ponga este en su lugar
+   if (root_pixmap_retired != None) {
+       XFreePixmap(root_display, root_pixmap_retired);
+   }
+   root_pixmap_retired = root_pixmap;
+   root_pixmap = XCreatePixmap(root_display, RootWindow(root_display, screen), width, height,
+                               DefaultDepth(root_display, screen));
+   root_pixmap_width = width;
+   root_pixmap_height = height;
+   root_pixmaps_created[root_pixmaps_created_count++ % 16] = root_pixmap;
+
+   GC gc = XCreateGC(root_display, root_pixmap, 0, NULL);
+   XSetForeground(root_display, gc, BlackPixel(root_display, screen));
+   XFillRectangle(root_display, root_pixmap, gc, 0, 0, width, height);
+   XFreeGC(root_display, gc);
+   return true;
+}
+
+// ¿Lo creamos nosotros? Matar su cliente sería matar nuestra propia conexión
+static bool is_own_root_pixmap(Pixmap pixmap) {
+   int count = root_pixmaps_created_count < 16 ? root_pixmaps_created_count : 16;
+   for (int i = 0; i < count; i++) {
+       if (root_pixmaps_created[i] == pixmap) return true;
+   }
+   return false;
+}
+
+// XKillClient sobre un id que ya no existe da BadValue: no debe tumbar el daemon
+static int root_kill_error_trap(Display *dpy, XErrorEvent *event) {
+   (void)dpy;
+   (void)event;
+   return 0;
+}
+
+// Publicar el pixmap raíz vía _XROOTPMAP_ID/ESETROOT_PMAP_ID (convención Esetroot)
+static void publish_root_pixmap(void) {
+   Window root = RootWindow(root_display, screen);
+   Atom prop_root = XInternAtom(root_display, "_XROOTPMAP_ID", False);
+   Atom prop_esetroot = XInternAtom(root_display, "ESETROOT_PMAP_ID", False);
+
+   Atom type;
+   int format;
+   unsigned long length, after;
+   unsigned char *data_root = NULL, *data_esetroot = NULL;
+
+   // Liberar el fondo retenido por otro programa (o por una ejecución anterior)
+   if (XGetWindowProperty(root_display, root, prop_root, 0L, 1L, False, AnyPropertyType,
+                          &type, &format, &length, &after, &data_root) == Success &&
+       type == XA_PIXMAP && data_root) {
+       if (XGetWindowProperty(root_display, root, prop_esetroot, 0L, 1L, False, AnyPropertyType,
+                              &type, &format, &length, &after, &data_esetroot) == Success &&
+           type == XA_PIXMAP && data_esetroot) {
+           Pixmap old = *(Pixmap *)data_root;
+           if (old == *(Pixmap *)data_esetroot && !is_own_root_pixmap(old)) {
+               XSync(root_display, False);
+               XErrorHandler old_handler = XSetErrorHandler(root_kill_error_trap);
+               XKillClient(root_display, old);
+               XSync(root_display, False);
+               XSetErrorHandler(old_handler);
+           }
+       }
+   }
+   if (data_root) XFree(data_root);
+   if (data_esetroot) XFree(data_esetroot);
+
+   XChangeProperty(root_display, root, prop_root, XA_PIXMAP, 32, PropModeReplace,
+                   (unsigned char *)&root_pixmap, 1);
+   XChangeProperty(root_display, root, prop_esetroot, XA_PIXMAP, 32, PropModeReplace,
+                   (unsigned char *)&root_pixmap, 1);
+   XSetWindowBackgroundPixmap(root_display, root, root_pixmap);
+   XClearWindow(root_display, root);
+
+   // El anterior ya no está publicado: ahora sí se puede liberar
+   if (root_pixmap_retired != None) {
+       XFreePixmap(root_display, root_pixmap_retired);
+       root_pixmap_retired = None;
+   }
+   XSync(root_display, False);
+}
+
+// Modo imagen fija: pintar la imagen en el pixmap raíz y ocultar la ventana
+static bool start_static_engine(int window_index) {
+   window_info *win = &config.windows[window_index];
+   const char *path = config.media_playlist.paths[config.media_playlist.current];
+
+   if (!is_image_item(path)) return false;
+
+   Visual *visual = DefaultVisual(display, screen);
+   if (DefaultDepth(display, screen) < 24 || visual->red_mask != 0xff0000 ||
+       visual->green_mask != 0x00ff00 || visual->blue_mask != 0x0000ff) {
+       return false;
+   }
+
+   prescaled_image img;
+   if (!load_prescaled_image(path, win->width, win->height, &img, NULL)) return false;
+
+   if (!open_root_pixmap()) {
+       release_prescaled_image(&img);
+       return false;
+   }
+
+   XImage *image = XCreateImage(root_display, DefaultVisual(root_display, screen),
+                                DefaultDepth(root_display, screen), ZPixmap, 0, (char *)img.pixels,
+                                win->width, win->height, 32, win->width * 4);
+   if (!image) {
+       release_prescaled_image(&img);
+       return false;
+   }
+   const uint16_t probe = 1;
+   image->byte_order = (*(const uint8_t *)&probe == 1) ? LSBFirst : MSBFirst;
+
+   GC gc = XCreateGC(root_display, root_pixmap, 0, NULL);
+   XPutImage(root_display, root_pixmap, gc, image, 0, 0, win->x, win->y, win->width, win->height);
+   XFreeGC(root_display, gc);
+   image->data = NULL; // Los píxeles pertenecen al mapeo de la cache
+   XDestroyImage(image);
+   release_prescaled_image(&img);
+
+   publish_root_pixmap();
+
+   // Sin ventana encima: el fondo es el propio root
+   if (win->window != None && win->mapped) {
+       XUnmapWindow(display, win->window);
+       XSync(display, False);
+       win->mapped = false;
+   }
+
+   win->engine = ENGINE_STATIC;
+   win->player_pid = 0;
+   win->player_active = true;
+   win->player_start_time = time(NULL);
+   win->started_ms = monotonic_ms();
+
+   LOG_DEBUG(SUBSYS_ENGINE, "Window %d: %s set as root background at %ux%u+%d+%d\n",
+             window_index, path, win->width, win->height, win->x, win->y);
+   return true;
+}
+
+// Mapear de nuevo una ventana que estaba oculta por el modo imagen fija
+static void ensure_window_mapped(window_info *win) {
+   if (win->mapped || win->window == None) return;
+
+   XMapWindow(display, win->window);
+   XLowerWindow(display, win->window);
+   XSync(display, False);
+   win->mapped = true;
+}
+
+// Verificar si todas las ventanas están en modo imagen fija (nada que animar)
+static bool all_windows_static(void) {
+   if (config.window_count == 0) return false;
+
+   for (int i = 0; i < config.window_count; i++) {
+       if (config.windows[i].engine != ENGINE_STATIC) return false;
+   }
+   return true;
+}
+
+// Directorio de la cache de imágenes pre-escaladas ($XDG_CACHE_HOME/motionwall)
+static bool get_cache_dir(char *dest, size_t dest_size) {
+   const char *xdg = getenv("XDG_CACHE_HOME");
+   const char *home = getenv("HOME");
+   char base[MAX_PATH];
+
+   if (xdg && xdg[0] == '/') {
+       snprintf(base, sizeof(base), "%s", xdg);
+   } else if (home && safe_path_join(base, sizeof(base), home, ".cache")) {
+       mkdir(base, 0755);
+   } else {
+       return false;
+   }
+
+   if (!safe_path_join(dest, dest_size, base, NAME)) return false;
+   if (mkdir(dest, 0755) != 0 && errno != EEXIST) {
+       LOG_DEBUG(SUBSYS_ENGINE, "mkdir cache dir: %s\n", strerror(errno));
+       return false;
+   }
+   return true;
+}
+
+// Ruta del archivo crudo para (imagen, mtime, tamaño, resolución)
+static bool prescaled_cache_path(const char *path, unsigned int width, unsigned int height,
+                                 char *dest, size_t dest_size) {
+   struct stat st;
+   char cache_dir[MAX_PATH];
+
+   if (stat(path, &st) != 0 || !get_cache_dir(cache_dir, sizeof(cache_dir))) {
+       return false;
+   }
+
+   // FNV-1a sobre la ruta, mtime y tamaño: se invalida si la imagen cambia
+   uint64_t hash = 1469598103934665603ULL;
+   for (const char *c = path; *c; c++) {
+       hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+   }
+   uint64_t extra[2] = {(uint64_t)st.st_mtime, (uint64_t)st.st_size};
+   const uint8_t *bytes = (const uint8_t *)extra;
+   for (size_t i = 0; i < sizeof(extra); i++) {
+       hash = (hash ^ bytes[i]) * 1099511628211ULL;
+   }
+
+   char name[96];
+   snprintf(name, sizeof(name), "%016llx-%ux%u.bgrx", (unsigned long long)hash, width, height);
+   return safe_path_join(dest, dest_size, cache_dir, name);
+}
+
+// Mapear una imagen cruda de la cache; false si no existe o no es válida
+static bool map_prescaled_file(const char *cache_path, unsigned int width, unsigned int height,
+                               prescaled_image *img) {
+   int fd = open(cache_path, O_RDONLY);
+   if (fd < 0) return false;
+
+   size_t expected = PRESCALED_HEADER_SIZE + (size_t)width * height * 4;
+   struct stat st;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size != expected) {
+       close(fd);
+       return false;
+   }
+
+   void *map = mmap(NULL, expected, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) return false;
+
+   const uint8_t *header = map;
+   uint32_t w, h;
+   memcpy(&w, header + 8, 4);
+   memcpy(&h, header + 12, 4);
+   if (memcmp(header, PRESCALED_MAGIC, 8) != 0 || w != width || h != height) {
+       munmap(map, expected);
+       return false;
+   }
+
+   img->map = map;
+   img->map_size = expected;
+   img->pixels = (const uint32_t *)(header + PRESCALED_HEADER_SIZE);
+   img->width = width;
+   img->height = height;
+   return true;
+}
+
+// Obtener una imagen decodificada y escalada a width x height. Solo se
+// decodifica la primera vez; después se mapea el archivo crudo de la cache.
+static bool load_prescaled_image(const char *path, unsigned int width, unsigned int height,
+                                 prescaled_image *img, bool *cache_hit) {
+   char cache_path[MAX_PATH];
+   bool have_cache = prescaled_cache_path(path, width, height, cache_path, sizeof(cache_path));
+
+   memset(img, 0, sizeof(*img));
+   if (cache_hit) *cache_hit = false;
+
+   if (have_cache && map_prescaled_file(cache_path, width, height, img)) {
+       if (cache_hit) *cache_hit = true;
+       utime(cache_path, NULL); // mtime = último uso, para la expulsión LRU
+       return true;
+   }
+
+   uint32_t *pixels = decode_image_scaled(path, width, height);
+   if (!pixels) return false;
+
+   if (have_cache) {
+       // Escribir a un temporal y renombrar: nunca se mapea un archivo a medias
+       char tmp_path[MAX_PATH + 32];
+       snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", cache_path, getpid());
+
+       int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+       if (fd >= 0) {
+           uint8_t header[PRESCALED_HEADER_SIZE] = {0};
+           uint32_t w = width, h = height;
+           memcpy(header, PRESCALED_MAGIC, 8);
+           memcpy(header + 8, &w, 4);
+           memcpy(header + 12, &h, 4);
+
+           size_t size = (size_t)width * height * 4;
+           bool ok = write(fd, header, sizeof(header)) == (ssize_t)sizeof(header) &&
+                     write(fd, pixels, size) == (ssize_t)size;
+           close(fd);
+
+           if (ok && rename(tmp_path, cache_path) == 0) {
+               free(pixels);
+               return map_prescaled_file(cache_path, width, height, img);
+           }
+           unlink(tmp_path);
+       }
+   }
+
+   // Sin cache en disco: usar el buffer decodificado directamente
+   img->map = NULL;
+   img->owned = pixels;
+   img->pixels = pixels;
+   img->width = width;
+   img->height = height;
+   return true;
+}
+
+static void release_prescaled_image(prescaled_image *img) {
+   if (img->map) {
+       munmap(img->map, img->map_size);
+   }
+   free(img->owned);
+   memset(img, 0, sizeof(*img));
+}
+
+typedef struct {
+   time_t mtime;
+   off_t size;
+   char name[128];
+} cache_entry;
+
+static int compare_cache_entry(const void *a, const void *b) {
+   time_t ma = ((const cache_entry *)a)->mtime, mb = ((const cache_entry *)b)->mtime;
+   return ma < mb ? -1 : ma > mb;
+}
+
+// Mantener la cache de imágenes dentro de image_cache_mb: se borran primero
+// las usadas hace más tiempo (las de imágenes que cambiaron ya no se usan) y
+// los temporales abandonados
+static void trim_image_cache(void) {
+   char cache_dir[MAX_PATH];
+   if (config.image_cache_mb <= 0 || !get_cache_dir(cache_dir, sizeof(cache_dir))) return;
+
+   DIR *dir = opendir(cache_dir);
+   if (!dir) return;
+   cache_entry *entries = NULL;
+   size_t count = 0, capacity = 0;
+   long long total = 0;
+   time_t now = time(NULL);
+   struct dirent *entry;
+   while ((entry = readdir(dir)) != NULL) {
+       const char *ext = strstr(entry->d_name, ".bgrx");
+       if (!ext || strlen(entry->d_name) >= sizeof(entries[0].name)) continue;
+
+       char path[MAX_PATH];
+       struct stat st;
+       if (!safe_path_join(path, sizeof(path), cache_dir, entry->d_name) ||
+           lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+           continue;
+       }
+       if (ext[5] != '\0') {
+           // "*.bgrx.tmp.PID" de una escritura interrumpida
+           if (now - st.st_mtime > 3600) unlink(path);
+           continue;
+       }
+       if (count == capacity) {
+           capacity = capacity ? capacity * 2 : 64;
+           cache_entry *grown = realloc(entries, capacity * sizeof(*entries));
+           if (!grown) break;
+           entries = grown;
+       }
+       entries[count].mtime = st.st_mtime;
+       entries[count].size = st.st_size;
+       strcpy(entries[count].name, entry->d_name);
+       total += st.st_size;
+       count++;
+   }
+   closedir(dir);
+
+   long long budget = (long long)config.image_cache_mb * 1024 * 1024;
+   if (total > budget) {
+       qsort(entries, count, sizeof(*entries), compare_cache_entry);
+       for (size_t i = 0; i < count && total > budget; i++) {
+           char path[MAX_PATH];
+           if (safe_path_join(path, sizeof(path), cache_dir, entries[i].name) && unlink(path) == 0) {
+               total -= entries[i].size;
+               LOG_DEBUG(SUBSYS_ENGINE, "Image cache over budget, evicted %s\n", entries[i].name);
+           }
+       }
+   }
+   free(entries);
+}
+
+// Pre-escalar en un proceso hijo el elemento actual y los IMAGE_PREFETCH_AHEAD
+// siguientes, para que los cambios de imagen no tengan que decodificar nada.
+// Solo hay un hijo a la vez: si el anterior sigue trabajando no se lanza otro
+static pid_t prefetch_pid = 0;
+
+static void prefetch_image_cache(void) {
+   TRACE_SCOPE("prefetch_image_cache", -1);
+   int count = config.media_playlist.count;
+   if (count == 0 || config.window_count == 0) return;
+
+   // Elementos candidatos: los de la lista más los fijados por ventana
+   int items[IMAGE_PREFETCH_AHEAD + 1 + MAX_MONITORS];
+   int item_count = 0;
+   for (int ahead = 0; ahead <= IMAGE_PREFETCH_AHEAD && ahead < count; ahead++) {
+       items[item_count++] = (config.media_playlist.current + ahead) % count;
+   }
+   for (int w = 0; w < config.window_count && w < MAX_MONITORS; w++) {
+       if (config.windows[w].playlist_item >= 0 && config.windows[w].playlist_item < count) {
+           items[item_count++] = config.windows[w].playlist_item;
+       }
+   }
+   bool has_images = false;
+   for (int i = 0; i < item_count && !has_images; i++) {
+       has_images = is_image_item(config.media_playlist.paths[items[i]]);
+   }
+   if (!has_images) return;
+
+   // SIGCHLD ignorado: el hijo se recoge solo y kill(pid, 0) falla al acabar
+   if (prefetch_pid > 0 && kill(prefetch_pid, 0) == 0) {
+       LOG_DEBUG(SUBSYS_ENGINE, "Image prefetch %d still running, skipping\n", prefetch_pid);
+       return;
+   }
+
+   pid_t pid = fork();
+   if (pid != 0) {
+       if (pid < 0) LOG_DEBUG(SUBSYS_ENGINE, "fork prefetch: %s\n", strerror(errno));
+       else prefetch_pid = pid;
+       return;
+   }
+
+   // Proceso hijo: no tocar la conexión X del padre ni heredar su limpieza
+   signal(SIGTERM, SIG_DFL);
+   signal(SIGINT, SIG_DFL);
+   if (nice(10) == -1) {
+       LOG_DEBUG(SUBSYS_ENGINE, "nice: %s\n", strerror(errno));
+   }
+   for (int i = 0; i < item_count; i++) {
+       const char *path = config.media_playlist.paths[items[i]];
+       if (!is_image_item(path)) continue;
+
+       for (int w = 0; w < config.window_count; w++) {
+           bool duplicate = false;
+           for (int prev = 0; prev < w && !duplicate; prev++) {
+               duplicate = config.windows[prev].width == config.windows[w].width &&
+                           config.windows[prev].height == config.windows[w].height;
+           }
+           if (duplicate) continue;
+
+           prescaled_image img;
+           if (load_prescaled_image(path, config.windows[w].width, config.windows[w].height, &img, NULL)) {
+               release_prescaled_image(&img);
+           }
+       }
+   }
+   trim_image_cache();
+   _exit(0);
+}
+
+// Subir una imagen pre-escalada a un pixmap nuevo del servidor
+static Pixmap upload_prescaled_image(const prescaled_image *img) {
+   // XPutImage solo lee el buffer: se puede pasar el mapeo de solo lectura
+   return upload_bgrx_pixmap(img->pixels, img->width, img->height);
+}
+
+// Liberar los recursos de servidor del motor de diapositivas
+static void stop_slideshow_engine(window_info *win) {
+   slideshow_state *slide = win->slide;
+   if (!slide) return;
+
+   if (slide->window_pic != None) XRenderFreePicture(display, slide->window_pic);
+   if (slide->current_pic != None) XRenderFreePicture(display, slide->current_pic);
+   if (slide->next_pic != None) XRenderFreePicture(display, slide->next_pic);
+   if (slide->current != None) XFreePixmap(display, slide->current);
+   if (slide->next != None) XFreePixmap(display, slide->next);
+
+   if (win->window != None) {
+       XSetWindowBackground(display, win->window, BlackPixel(display, screen));
+   }
+
+   free(slide);
+   win->slide = NULL;
+}
+
+// Cargar la imagen actual de la playlist y empezar el fundido hacia ella
+static bool slideshow_show_current(int window_index) {
+   window_info *win = &config.windows[window_index];
+   slideshow_state *slide = win->slide;
+   const char *path = config.media_playlist.paths[config.media_playlist.current];
+
+   long long t0 = monotonic_us();
+   prescaled_image img;
+   bool cache_hit = false;
+   if (!load_prescaled_image(path, win->width, win->height, &img, &cache_hit)) {
+       return false;
+   }
+   long long t1 = monotonic_us();
+
+   Pixmap pixmap = upload_prescaled_image(&img);
+   release_prescaled_image(&img);
+   if (pixmap == None) return false;
+   XSync(display, False);
+   long long t2 = monotonic_us();
+
+   // Un fundido a medias termina de golpe en la imagen que se estaba mostrando
+   if (slide->next != None) {
+       if (slide->current_pic != None) XRenderFreePicture(display, slide->current_pic);
+       if (slide->current != None) XFreePixmap(display, slide->current);
+       slide->current = slide->next;
+       slide->current_pic = slide->next_pic;
+       slide->next = None;
+       slide->next_pic = None;
+   }
+
+   XRenderPictFormat *format = XRenderFindVisualFormat(display, win->visual);
+   slide->next = pixmap;
+   slide->next_pic = XRenderCreatePicture(display, pixmap, format, 0, NULL);
+   slide->fade_start_ms = monotonic_ms();
+   slide->fading = true;
+
+   win->last_switch_us = t2 - t0;
+
+   LOG_DEBUG(SUBSYS_ENGINE, "Slideshow window %d: %s ready in %.2f ms (%s %.2f ms, upload %.2f ms)\n",
+             window_index, path, (t2 - t0) / 1000.0,
+             cache_hit ? "cache mmap" : "decode", (t1 - t0) / 1000.0, (t2 - t1) / 1000.0);
+   return true;
+}
+
+// Iniciar el modo diapositivas en una ventana mapeada
+static bool start_slideshow_engine(int window_index) {
+   window_info *win = &config.windows[window_index];
+   const char *path = config.media_playlist.paths[config.media_playlist.current];
+
+   if (!config.slideshow || !is_image_item(path)) return false;
+
+   int render_major, render_minor;
+   Visual *visual = DefaultVisual(display, screen);
+   if (!XRenderQueryExtension(display, &render_major, &render_minor) ||
+       DefaultDepth(display, screen) < 24 || visual->red_mask != 0xff0000 ||
+       visual->green_mask != 0x00ff00 || visual->blue_mask != 0x0000ff) {
+       return false;
+   }
+
+   win->slide = calloc(1, sizeof(slideshow_state));
+   if (!win->slide) return false;
+
+   XRenderPictFormat *format = XRenderFindVisualFormat(display, win->visual);
+   win->slide->window_pic = XRenderCreatePicture(display, win->window, format, 0, NULL);
+
+   if (!slideshow_show_current(window_index)) {
+       stop_slideshow_engine(win);
+       return false;
+   }
+
+   win->engine = ENGINE_SLIDESHOW;
+   win->player_pid = 0;
+   win->player_active = true;
+   win->player_start_time = time(NULL);
+   win->started_ms = monotonic_ms();
+   return true;
+}
+
+// Avanzar el fundido cruzado; devuelve el próximo deadline (-1 si terminó)
+static long long service_slideshow(window_info *win, long long now) {
+   slideshow_state *slide = win->slide;
+   if (!slide->fading) return -1;
+
+   double t = config.slideshow_fade_ms > 0 ?
+              (double)(now - slide->fade_start_ms) / config.slideshow_fade_ms : 1.0;
+
+   if (t >= 1.0) {
+       // Fundido terminado: la imagen queda como fondo de la ventana y el
+       // servidor la repinta solo, sin más trabajo del daemon
+       if (slide->current_pic != None) XRenderFreePicture(display, slide->current_pic);
+       if (slide->current != None) XFreePixmap(display, slide->current);
+       slide->current = slide->next;
+       slide->current_pic = slide->next_pic;
+       slide->next = None;
+       slide->next_pic = None;
+       slide->fading = false;
+
+       XSetWindowBackgroundPixmap(display, win->window, slide->current);
+       XClearWindow(display, win->window);
+       return -1;
+   }
+
+   if (slide->current_pic != None) {
+       XRenderComposite(display, PictOpSrc, slide->current_pic, None, slide->window_pic,
+                        0, 0, 0, 0, 0, 0, win->width, win->height);
+   } else {
+       XRenderColor black = {0, 0, 0, 0xffff};
+       XRenderFillRectangle(display, PictOpSrc, slide->window_pic, &black, 0, 0,
+                            win->width, win->height);
+   }
+
+   XRenderColor alpha = {0, 0, 0, (unsigned short)(t * 0xffff)};
+   Picture mask = XRenderCreateSolidFill(display, &alpha);
+   XRenderComposite(display, PictOpOver, slide->next_pic, mask, slide->window_pic,
+                    0, 0, 0, 0, 0, 0, win->width, win->height);
+   XRenderFreePicture(display, mask);
+
+   return now + SLIDESHOW_FADE_STEP_MS;
+}
+
+// ---------------------------------------------------------------------------
+// Fondos procedurales: generadores sin archivos ni decodificador
+// ---------------------------------------------------------------------------
+
+// sin(x) aproximado para 4 floats (error < 0.001): reducción a [-pi, pi]
+// y aproximación parabólica con un paso de refinamiento
+static inline v4f v4_sin(v4f x) {
+   const v4f round_magic = v4f_splat(12582912.0f); // 1.5 * 2^23
+   v4f k = x * v4f_splat(0.15915494f) + round_magic - round_magic;
+   x = x - k * v4f_splat(6.2831853f);
+
+   v4f abs_x = (v4f)((v4i)x & v4i_splat(0x7fffffff));
+   v4f y = x * v4f_splat(1.2732395f) - x * abs_x * v4f_splat(0.40528473f);
+   v4f abs_y = (v4f)((v4i)y & v4i_splat(0x7fffffff));
+   return (y * abs_y - y) * v4f_splat(0.225f) + y;
+}
+
+// Convertir canales en [0,1] a 4 píxeles BGRX
+static inline v4i v4_pack_rgb(v4f r, v4f g, v4f b) {
+   v4i ri = __builtin_convertvector(r * v4f_splat(255.0f), v4i);
+   v4i gi = __builtin_convertvector(g * v4f_splat(255.0f), v4i);
+   v4i bi = __builtin_convertvector(b * v4f_splat(255.0f), v4i);
+   return (ri << 16) | (gi << 8) | bi;
+}
+
+// Coordenadas normalizadas x/width de 4 columnas consecutivas
+static inline v4f v4_columns(int x, float inv_width) {
+   v4f lanes = {0.0f, 1.0f, 2.0f, 3.0f};
+   return (v4f_splat((float)x) + lanes) * v4f_splat(inv_width);
+}
+
+static inline void v4_store(uint32_t *dst, v4i pixels) {
+   memcpy(dst, &pixels, sizeof(pixels));
+}
+
+// Plasma clásico: suma de ondas en x, y, diagonal y radial
+static void render_plasma(generator_state *gen, int y0, int y1, float t) {
+   const float inv_w = 1.0f / gen->width;
+   const float aspect = (float)gen->height / gen->width;
+   const v4f phase_g = v4f_splat(2.0943951f), phase_b = v4f_splat(4.1887902f);
+   const v4f half = v4f_splat(0.5f), pi = v4f_splat(3.1415927f);
+   const v4f tv = v4f_splat(t);
+
+   for (int y = y0; y < y1; y++) {
+       uint32_t *row = gen->pixels + (size_t)y * gen->stride;
+       v4f v = v4f_splat((float)y * inv_w);
+       v4f wave_y = v4_sin(v * v4f_splat(9.0f) + tv * v4f_splat(0.7f));
+
+       for (int x = 0; x < gen->stride; x += 4) {
+           v4f u = v4_columns(x, inv_w);
+           v4f cx = u - half;
+           v4f cy = v - v4f_splat(0.5f * aspect);
+           v4f value = v4_sin(u * v4f_splat(10.0f) + tv) + wave_y +
+                       v4_sin((u + v) * v4f_splat(7.0f) + tv * v4f_splat(0.5f)) +
+                       v4_sin((cx * cx + cy * cy) * v4f_splat(40.0f) - tv * v4f_splat(1.3f));
+           value = value * pi * v4f_splat(0.5f);
+
+           v4f r = half + half * v4_sin(value);
+           v4f g = half + half * v4_sin(value + phase_g);
+           v4f b = half + half * v4_sin(value + phase_b);
+           v4_store(row + x, v4_pack_rgb(r, g, b));
+       }
+   }
+}
+
+// Campo de flujo: ondas deformadas por un campo vectorial que se desplaza
+static void render_flow(generator_state *gen, int y0, int y1, float t) {
+   const float inv_w = 1.0f / gen->width;
+   const v4f half = v4f_splat(0.5f), tv = v4f_splat(t);
+
+   for (int y = y0; y < y1; y++) {
+       uint32_t *row = gen->pixels + (size_t)y * gen->stride;
+       v4f v = v4f_splat((float)y * inv_w);
+       v4f warp_x = v4_sin(v * v4f_splat(3.0f) + tv * v4f_splat(0.4f));
+
+       for (int x = 0; x < gen->stride; x += 4) {
+           v4f u = v4_columns(x, inv_w);
+           v4f warp_y = v4_sin(u * v4f_splat(3.0f) - tv * v4f_splat(0.3f) + v4f_splat(1.5707963f));
+           v4f fu = u + warp_x * v4f_splat(0.35f);
+           v4f fv = v + warp_y * v4f_splat(0.35f);
+           v4f field = v4_sin(fu * v4f_splat(8.0f) + tv) * v4_sin(fv * v4f_splat(8.0f) - tv * v4f_splat(0.6f) +
+                                                                   v4f_splat(1.5707963f));
+
+           v4f r = half + half * v4_sin(field * v4f_splat(2.0f) + tv * v4f_splat(0.2f));
+           v4f g = half * (half + half * field) + v4f_splat(0.15f);
+           v4f b = half + half * v4_sin(field * v4f_splat(3.0f) + v4f_splat(2.5f));
+           v4_store(row + x, v4_pack_rgb(r * v4f_splat(0.6f), g, b));
+       }
+   }
+}
+
+// Degradado que rota y cambia de tono lentamente
+static void render_gradient(generator_state *gen, int y0, int y1, float t) {
+   const float inv_w = 1.0f / gen->width;
+   const float angle = t * 0.05f;
+   // cos/sin escalares con la misma aproximación vectorial
+   v4f trig = v4_sin((v4f){angle + 1.5707963f, angle, 0.0f, 0.0f});
+   const v4f ca = v4f_splat(trig[0]), sa = v4f_splat(trig[1]);
+   const v4f half = v4f_splat(0.5f), tv = v4f_splat(t * 0.1f);
+
+   for (int y = y0; y < y1; y++) {
+       uint32_t *row = gen->pixels + (size_t)y * gen->stride;
+       v4f v = v4f_splat((float)y * inv_w) - half;
+
+       for (int x = 0; x < gen->stride; x += 4) {
+           v4f u = v4_columns(x, inv_w) - half;
+           v4f s = u * ca + v * sa;
+           v4f r = half + half * v4_sin(s * v4f_splat(2.0f) + tv);
+           v4f g = half + half * v4_sin(s * v4f_splat(2.0f) + tv + v4f_splat(2.0f));
+           v4f b = half + half * v4_sin(s * v4f_splat(2.0f) + tv + v4f_splat(4.0f));
+           v4_store(row + x, v4_pack_rgb(r * v4f_splat(0.8f), g * v4f_splat(0.8f), b));
+       }
+   }
+}
+
+// Campo de estrellas: posiciones actualizadas una vez por frame en el hilo principal
+static void prepare_starfield(generator_state *gen, float t) {
+   starfield_star *stars = gen->priv;
+   if (!stars) {
+       stars = calloc(STARFIELD_STARS, sizeof(starfield_star));
+       if (!stars) return;
+       gen->priv = stars;
+       gen->rng = 0x9e3779b9u;
+       for (int i = 0; i < STARFIELD_STARS; i++) {
+           stars[i].x = (int)(xorshift32(&gen->rng) % 2001) / 1000.0f - 1.0f;
+           stars[i].y = (int)(xorshift32(&gen->rng) % 2001) / 1000.0f - 1.0f;
+           stars[i].z = (int)(xorshift32(&gen->rng) % 1000) / 1000.0f + 0.001f;
+       }
+   }
+
+   float dt = gen->last_t > 0.0f ? t - gen->last_t : 0.0f;
+   gen->last_t = t;
+   for (int i = 0; i < STARFIELD_STARS; i++) {
+       stars[i].z -= dt * 0.15f;
+       if (stars[i].z <= 0.01f) {
+           stars[i].x = (int)(xorshift32(&gen->rng) % 2001) / 1000.0f - 1.0f;
+           stars[i].y = (int)(xorshift32(&gen->rng) % 2001) / 1000.0f - 1.0f;
+           stars[i].z = 1.0f;
+       }
+   }
+}
+
+static void render_starfield(generator_state *gen, int y0, int y1, float t) {
+   (void)t;
+   const v4i background = v4i_splat(0x000008);
+
+   for (int y = y0; y < y1; y++) {
+       uint32_t *row = gen->pixels + (size_t)y * gen->stride;
+       for (int x = 0; x < gen->stride; x += 4) {
+           v4_store(row + x, background);
+       }
+   }
+
+   const starfield_star *stars = gen->priv;
+   if (!stars) return;
+
+   const float half_w = gen->width * 0.5f, half_h = gen->height * 0.5f;
+   for (int i = 0; i < STARFIELD_STARS; i++) {
+       int sx = (int)(stars[i].x / stars[i].z * half_w + half_w);
+       int sy = (int)(stars[i].y / stars[i].z * half_w + half_h);
+       if (sy < y0 || sy >= y1 || sx < 0 || sx >= gen->width) continue;
+
+       uint32_t level = (uint32_t)((1.0f - stars[i].z) * 255.0f);
+       gen->pixels[(size_t)sy * gen->stride + sx] = (level << 16) | (level << 8) | level;
+   }
+}
+
+// Generadores disponibles
+static const generator_def generators[] = {
+   {"plasma", NULL, render_plasma},
+   {"flow", NULL, render_flow},
+   {"gradient", NULL, render_gradient},
+   {"starfield", prepare_starfield, render_starfield},
+};
+
+// Verificar si un elemento de la playlist es un generador ("generator:plasma")
+static bool is_generator_item(const char *path) {
+   return path && strncmp(path, GENERATOR_PREFIX, strlen(GENERATOR_PREFIX)) == 0;
+}
+
+// Buscar un generador por nombre
+static const generator_def *find_generator(const char *name) {
+   for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+       if (strcmp(generators[i].name, name) == 0) return &generators[i];
+   }
+   return NULL;
+}
+
+// Worker del pool de render: cada hilo pinta una franja de filas
+static void *render_worker(void *arg) {
+   int index = (int)(intptr_t)arg;
+   unsigned long seen = 0;
+
+   pthread_mutex_lock(&render_pool.lock);
+   for (;;) {
+       while (!render_pool.quit && render_pool.generation == seen) {
+           pthread_cond_wait(&render_pool.start, &render_pool.lock);
+       }
+       if (render_pool.quit) break;
+       seen = render_pool.generation;
+
+       generator_state *gen = render_pool.gen;
+       float t = render_pool.t;
+       pthread_mutex_unlock(&render_pool.lock);
+
+       int y0 = gen->height * index / render_pool.count;
+       int y1 = gen->height * (index + 1) / render_pool.count;
+       gen->def->render_rows(gen, y0, y1, t);
+
+       pthread_mutex_lock(&render_pool.lock);
+       if (--render_pool.pending == 0) {
+           pthread_cond_signal(&render_pool.done);
+       }
+   }
+   pthread_mutex_unlock(&render_pool.lock);
+   return NULL;
+}
+
+// Crear el pool de hilos de render (una sola vez)
+static void init_render_pool(int threads) {
+   if (render_pool.count > 0) return;
+   if (threads > MAX_RENDER_THREADS) threads = MAX_RENDER_THREADS;
+   if (threads <= 1) {
+       render_pool.count = 1;
+       return;
+   }
+
+   pthread_mutex_init(&render_pool.lock, NULL);
+   pthread_cond_init(&render_pool.start, NULL);
+   pthread_cond_init(&render_pool.done, NULL);
+
+   for (int i = 0; i < threads; i++) {
+       if (pthread_create(&render_pool.threads[i], NULL, render_worker, (void *)(intptr_t)i) != 0) {
+           break;
+       }
+       render_pool.count++;
+   }
+   render_pool.started = render_pool.count;
+}
+
+// Detener los hilos de render
+static void shutdown_render_pool(void) {
+   if (render_pool.started == 0) return;
+
+   pthread_mutex_lock(&render_pool.lock);
+   render_pool.quit = true;
+   pthread_cond_broadcast(&render_pool.start);
+   pthread_mutex_unlock(&render_pool.lock);
+
+   for (int i = 0; i < render_pool.started; i++) {
+       pthread_join(render_pool.threads[i], NULL);
+   }
+   render_pool.started = 0;
+   render_pool.count = 0;
+}
+
+// Renderizar un frame completo repartiendo las filas entre los hilos
+static void render_generator_frame(generator_state *gen, float t) {
+   if (gen->def->prepare) {
+       gen->def->prepare(gen, t);
+   }
+
+   if (render_pool.count <= 1) {
+       gen->def->render_rows(gen, 0, gen->height, t);
+       return;
+   }
+
+   pthread_mutex_lock(&render_pool.lock);
+   render_pool.gen = gen;
+   render_pool.t = t;
+   render_pool.pending = render_pool.count;
+   render_pool.generation++;
+   pthread_cond_broadcast(&render_pool.start);
+   while (render_pool.pending > 0) {
+       pthread_cond_wait(&render_pool.done, &render_pool.lock);
+   }
+   pthread_mutex_unlock(&render_pool.lock);
+}
+
+// Preparar el buffer de un generador a la resolución interna indicada
+static bool init_generator_state(generator_state *gen, const generator_def *def,
+                                 unsigned int width, unsigned int height) {
+   memset(gen, 0, sizeof(*gen));
+   gen->def = def;
+   gen->width = width > 4 ? (int)width : 4;
+   gen->height = height > 1 ? (int)height : 1;
+   gen->stride = (gen->width + 3) & ~3; // Múltiplo de 4 para los kernels vectoriales
+   gen->pixels = malloc((size_t)gen->stride * gen->height * sizeof(uint32_t));
+   return gen->pixels != NULL;
+}
+
+static void free_generator_state(generator_state *gen) {
+   free(gen->pixels);
+   free(gen->priv);
+   gen->pixels = NULL;
+   gen->priv = NULL;
+}
+
+// Liberar el motor procedural de una ventana
+static void stop_procedural_engine(window_info *win) {
+   procedural_state *proc = win->procedural;
+   if (!proc) return;
+
+   if (proc->window_pic != None) XRenderFreePicture(display, proc->window_pic);
+   if (proc->small_pic != None) XRenderFreePicture(display, proc->small_pic);
+   if (proc->small != None) XFreePixmap(display, proc->small);
+   if (proc->image) {
+       proc->image->data = NULL; // Los píxeles son del generador
+       XDestroyImage(proc->image);
+   }
+   free_generator_state(&proc->gen);
+   free(proc);
+   win->procedural = NULL;
+}
+
+// Iniciar un generador procedural en la ventana
+static bool start_procedural_engine(int window_index) {
+   window_info *win = &config.windows[window_index];
+   const char *path = config.media_playlist.paths[config.media_playlist.current];
+
+   if (!is_generator_item(path)) return false;
+
+   const generator_def *def = find_generator(path + strlen(GENERATOR_PREFIX));
+   if (!def) {
+       fprintf(stderr, NAME ": Error: Unknown generator '%s'\n", path + strlen(GENERATOR_PREFIX));
+       return false;
+   }
+
+   int render_major, render_minor;
+   Visual *visual = DefaultVisual(display, screen);
+   if (!XRenderQueryExtension(display, &render_major, &render_minor) ||
+       DefaultDepth(display, screen) < 24 || visual->red_mask != 0xff0000 ||
+       visual->green_mask != 0x00ff00 || visual->blue_mask != 0x0000ff) {
+       fprintf(stderr, NAME ": Error: Procedural wallpapers need XRender and a 24-bit TrueColor visual\n");
+       return false;
+   }
+
+   procedural_state *proc = calloc(1, sizeof(procedural_state));
+   if (!proc) return false;
+
+   // Render a resolución reducida; XRender escala en el servidor
+   int scale = config.generator_scale > 0 ? config.generator_scale : 1;
+   if (window_reduced_resolution(win)) scale *= 2;
+   if (!init_generator_state(&proc->gen, def, win->width / scale, win->height / scale)) {
+       free(proc);
+       return false;
+   }
+
+   proc->image = XCreateImage(display, win->visual, DefaultDepth(display, screen), ZPixmap, 0,
+                              (char *)proc->gen.pixels, proc->gen.stride, proc->gen.height,
+                              32, proc->gen.stride * 4);
+   if (!proc->image) {
+       free_generator_state(&proc->gen);
+       free(proc);
+       return false;
+   }
+   const uint16_t probe = 1;
+   proc->image->byte_order = (*(const uint8_t *)&probe == 1) ? LSBFirst : MSBFirst;
+
+   XRenderPictFormat *format = XRenderFindVisualFormat(display, win->visual);
+   proc->small = XCreatePixmap(display, win->window, proc->gen.stride, proc->gen.height,
+                               DefaultDepth(display, screen));
+   proc->small_pic = create_scaled_picture(proc->small, proc->gen.width, proc->gen.height,
+                                           win->width, win->height);
+   proc->window_pic = XRenderCreatePicture(display, win->window, format, 0, NULL);
+
+   init_render_pool(config.generator_threads);
+
+   proc->start_ms = monotonic_ms();
+   proc->next_frame_ms = proc->start_ms;
+
+   win->procedural = proc;
+   win->engine = ENGINE_PROCEDURAL;
+   win->applied_cheap_scaler = false;
+   win->frames_shown = 0;
+   win->frames_dropped = 0;
+   win->player_pid = 0;
+   win->player_active = true;
+   win->player_start_time = time(NULL);
+   win->started_ms = monotonic_ms();
+
+   LOG_DEBUG(SUBSYS_ENGINE, "Window %d running generator '%s' at %dx%d -> %ux%u, %d fps, %d thread(s)\n",
+             window_index, def->name, proc->gen.width, proc->gen.height, win->width, win->height,
+             config.generator_fps, render_pool.count);
+   return true;
+}
+
+// Subir el frame actual y escalarlo a la ventana
+static void present_procedural_frame(window_info *win) {
+   procedural_state *proc = win->procedural;
+   GC gc = DefaultGC(display, screen);
+
+   XPutImage(display, proc->small, gc, proc->image, 0, 0, 0, 0, proc->gen.stride, proc->gen.height);
+   XRenderComposite(display, PictOpSrc, proc->small_pic, None, proc->window_pic,
+                    0, 0, 0, 0, 0, 0, win->width, win->height);
+}
+
+// Renderizar un frame si toca; devuelve el próximo deadline
+static long long service_procedural(window_info *win, long long now) {
+   procedural_state *proc = win->procedural;
+   int fps = config.generator_fps > 0 ? config.generator_fps : 1;
+   int cap = window_fps_cap(win);
+   if (cap > 0 && cap < fps) fps = cap;
+   long long frame_ms = 1000 / fps;
+
+   if (now < proc->next_frame_ms) return proc->next_frame_ms;
+
+   render_generator_frame(&proc->gen, (now - proc->start_ms) / 1000.0f);
+   present_procedural_frame(win);
+
+   win->frames_shown++;
+
+   proc->next_frame_ms += frame_ms;
+   if (proc->next_frame_ms <= now) {
+       // El render no llega a tiempo: esos frames se pierden
+       win->frames_dropped += (now - proc->next_frame_ms) / frame_ms + 1;
+       proc->next_frame_ms = now + frame_ms;
+   }
+   return proc->next_frame_ms;
+}
+
+// Benchmark de generadores: CPU por megapíxel, sin servidor X
+static int bench_generators(void) {
+   const int size = 1024;          // ~1 MP por frame
+   const int frames = 120;
+   const double megapixels = (double)size * size / 1e6;
+
+   init_render_pool(config.generator_threads);
+
+   printf("%-10s %8s %14s %14s %10s\n", "generator", "threads", "cpu ms/MP", "wall ms/MP", "MP/s");
+   for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+       generator_state gen;
+       if (!init_generator_state(&gen, &generators[i], size, size)) return 1;
+
+       // Calentar cache y estado (estrellas) antes de medir
+       render_generator_frame(&gen, 0.0f);
+
+       double cpu0 = self_cpu_seconds();
+       long long wall0 = monotonic_us();
+       for (int f = 1; f <= frames; f++) {
+           render_generator_frame(&gen, f / 30.0f);
+       }
+       double cpu = self_cpu_seconds() - cpu0;
+       double wall = (monotonic_us() - wall0) / 1e6;
+
+       double total_mp = megapixels * frames;
+       printf("%-10s %8d %14.3f %14.3f %10.1f\n", generators[i].name, render_pool.count,
+              cpu * 1000.0 / total_mp, wall * 1000.0 / total_mp, total_mp / wall);
+       free_generator_state(&gen);
+   }
+
+   shutdown_render_pool();
+   return 0;
+}
+
+// Benchmark del camino de frames de la cache de loops hacia los sinks sin
+// servidor X: reloj virtual, así se mide a velocidad máxima
+static int bench_sinks(const char *file_path) {
+   const unsigned int width = 1280, height = 720;
+   const int clip_frames = 90;
+   const int loops = 4;
+   size_t count = (size_t)width * height;
+
+   // Clip sintético: frames del generador plasma codificados como la cache real
+   loop_clip *clip = calloc(1, sizeof(loop_clip));
+   generator_state gen;
+   if (!clip || !init_generator_state(&gen, find_generator("plasma"), width, height)) {
+       free(clip);
+       return 1;
+   }
+   strncpy(clip->path, GENERATOR_PREFIX "plasma", sizeof(clip->path) - 1);
+   clip->width = width;
+   clip->height = height;
+   clip->frame_ms = 1000.0 / 30;
+   clip->decoder_fd = -1;
+   clip->read_buf = malloc(count * sizeof(uint32_t));
+   clip->prev_raw = calloc(count, sizeof(uint32_t));
+   clip->scratch = malloc(count * 8 + 16);
+   if (!clip->read_buf || !clip->prev_raw || !clip->scratch) {
+       loop_clip_release_data(clip);
+       free(clip);
+       free_generator_state(&gen);
+       return 1;
+   }
+
+   config.loop_cache_mb = 4096;
+   init_render_pool(config.generator_threads);
+   for (int f = 0; f < clip_frames && !clip->failed; f++) {
+       render_generator_frame(&gen, f / 30.0f);
+       for (unsigned int y = 0; y < height; y++) {
+           memcpy(clip->read_buf + (size_t)y * width, gen.pixels + (size_t)y * gen.stride, width * 4);
+       }
+       loop_clip_add_frame(clip);
+   }
+   free_generator_state(&gen);
+   shutdown_render_pool();
+   if (clip->failed) {
+       free(clip);
+       return 1;
+   }
+   free(clip->read_buf);
+   free(clip->prev_raw);
+   free(clip->scratch);
+   clip->read_buf = NULL;
+   clip->prev_raw = NULL;
+   clip->scratch = NULL;
+   clip->complete = true;
+
+   printf("clip: %ux%u, %d frames, %zu KB cached (%.1fx smaller than raw)\n", width, height,
+          clip->frame_count, clip->bytes / 1024, (double)count * 4 * clip->frame_count / clip->bytes);
+
+   // Ventana falsa: service_loop_playback es el mismo que en producción
+   window_info win;
+   memset(&win, 0, sizeof(win));
+   win.width = width;
+   win.height = height;
+   win.window = None;
+   config.windows = &win;
+   config.window_count = 1;
+
+   const frame_sink_ops *sinks[] = { &null_sink, &file_sink };
+   printf("%-6s %8s %12s %12s %14s %10s\n", "sink", "frames", "frames/s", "ns/frame",
+          "cpu ns/frame", "MB/s out");
+   for (size_t i = 0; i < sizeof(sinks) / sizeof(sinks[0]); i++) {
+       loop_playback lp;
+       memset(&lp, 0, sizeof(lp));
+       lp.clip = clip;
+       lp.pending_last = -1;
+       lp.sink.ops = sinks[i];
+       lp.sink.width = width;
+       lp.sink.height = height;
+       lp.sink.path = file_path;
+       if (!frame_sink_open(&lp.sink)) {
+           fprintf(stderr, NAME ": Could not open %s sink\n", sinks[i]->name);
+           continue;
+       }
+       win.loop = &lp;
+       win.engine = ENGINE_LOOP_CACHE;
+
+       unsigned long total = (unsigned long)clip_frames * loops;
+       long long now = 0;
+       double cpu0 = self_cpu_seconds();
+       long long wall0 = monotonic_us();
+       while (lp.sink.frames < total) {
+           // Saltar directamente al siguiente deadline en vez de dormir
+           now = service_loop_playback(0, now);
+       }
+       double cpu = self_cpu_seconds() - cpu0;
+       double wall = (monotonic_us() - wall0) / 1e6;
+
+       printf("%-6s %8lu %12.1f %12.0f %14.0f %10.1f\n", sinks[i]->name, lp.sink.frames,
+              lp.sink.frames / wall, wall * 1e9 / lp.sink.frames, cpu * 1e9 / lp.sink.frames,
+              lp.sink.bytes_written / wall / (1024.0 * 1024.0));
+       frame_sink_close(&lp.sink);
+   }
+
+   config.windows = NULL;
+   config.window_count = 0;
+   loop_clip_release_data(clip);
+   free(clip);
+   return 0;
+}
+
+static int compare_long_long(const void *a, const void *b) {
+   long long x = *(const long long *)a, y = *(const long long *)b;
+   return (x > y) - (x < y);
+}
+
+// Una pasada del benchmark de planificación: "workers" procesos de carga
+// (ps == NULL: prioridad por defecto) y una tarea interactiva que duerme 1 ms
+// y trabaja ~100 us, como un terminal o un editor
+static void bench_sched_run(const char *label, int workers, const player_sched *ps) {
+   const int samples = 2000;
+   pid_t *pids = calloc(workers > 0 ? workers : 1, sizeof(pid_t));
+   long long *latency = malloc(samples * sizeof(long long));
+   if (!pids || !latency) {
+       free(pids);
+       free(latency);
+       return;
+   }
+
+   for (int w = 0; w < workers; w++) {
+       pids[w] = fork();
+       if (pids[w] == 0) {
+           if (ps) apply_player_sched(ps);
+           // Carga tipo decodificador: CPU y recorrido de un buffer de 1 MB
+           uint32_t *buffer = malloc(1 << 20);
+           uint32_t state = 0x9e3779b9u + w;
+           for (;;) {
+               for (size_t i = 0; buffer && i < (1 << 20) / sizeof(uint32_t); i++) {
+                   buffer[i] = xorshift32(&state) + (buffer[i] >> 1);
+               }
+           }
+       }
+   }
+   usleep(200000);
+
+   double work_total = 0.0;
+   volatile uint32_t sink = 0;
+   uint32_t state = 1;
+   for (int n = 0; n < samples; n++) {
+       long long t0 = monotonic_us();
+       usleep(1000);
+       long long t1 = monotonic_us();
+       latency[n] = t1 - t0 - 1000;
+
+       for (int i = 0; i < 20000; i++) sink += xorshift32(&state);
+       work_total += monotonic_us() - t1;
+   }
+
+   for (int w = 0; w < workers; w++) {
+       if (pids[w] > 0) {
+           kill(pids[w], SIGKILL);
+           waitpid(pids[w], NULL, 0);
+       }
+   }
+
+   qsort(latency, samples, sizeof(long long), compare_long_long);
+   printf("%-22s %8d %10lld %10lld %10lld %10.0f\n", label, workers, latency[samples / 2],
+          latency[samples * 99 / 100], latency[samples - 1], work_total / samples);
+   free(pids);
+   free(latency);
+}
+
+// Benchmark de planificación: cuánto retrasan los reproductores a una tarea
+// en primer plano con y sin SCHED_IDLE/ioprio/afinidad configurados
+static int bench_sched(void) {
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   int workers = cpus > 0 ? 2 * (int)cpus : 2; // Decodificadores multihilo: sobrecargar
+
+   player_sched configured;
+   resolve_player_sched(NULL, &configured);
+
+   printf("%-22s %8s %10s %10s %10s %10s\n", "background", "workers",
+          "p50 us", "p99 us", "max us", "work us");
+   bench_sched_run("none", 0, NULL);
+   bench_sched_run("players default", workers, NULL);
+   bench_sched_run("players configured", workers, &configured);
+   return 0;
+}
+
+// Avanzar una animación GIF; devuelve el próximo deadline (-1 si es estática)
+static long long service_gif_animation(window_info *win, long long now) {
+   gif_animation *gif = win->gif;
+   if (gif->frame_count <= 1) return -1;
+
+   if (now >= gif->next_frame_ms) {
+       gif->current = (gif->current + 1) % gif->frame_count;
+       draw_gif_frame(win);
+
+       gif->next_frame_ms += gif->delays_ms[gif->current];
+       if (gif->next_frame_ms <= now) {
+           // Nos hemos retrasado (p.ej. cambio de playlist): no intentar recuperar
+           gif->next_frame_ms = now + gif->delays_ms[gif->current];
+       }
+   }
+   return gif->next_frame_ms;
+}
+
+// Avanzar los motores internos; devuelve el próximo deadline en ms (-1 si ninguno)
+static long long service_inprocess_engines(long long now) {
+   long long next_deadline = -1;
+   bool active = false;
+
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       long long deadline = -1;
+
+       // En pausa solo se repinta con Expose, no se avanza
+       if (win->paused) continue;
+
+       switch (win->engine) {
+           case ENGINE_GIF:
+               if (win->gif) deadline = service_gif_animation(win, now);
+               break;
+           case ENGINE_LOOP_CACHE:
+               if (win->loop) deadline = service_loop_playback(i, now);
+               break;
+           case ENGINE_SLIDESHOW:
+               if (win->slide) deadline = service_slideshow(win, now);
+               break;
+           case ENGINE_PROCEDURAL:
+               if (win->procedural) deadline = service_procedural(win, now);
+               break;
+           default:
+               continue;
+       }
+
+       if (deadline >= 0) {
+           active = true;
+           if (next_deadline < 0 || deadline < next_deadline) {
+               next_deadline = deadline;
+           }
+       }
+   }
+
+   if (active) {
+       XFlush(display);
+   }
+
+   return next_deadline;
+}
+
+// Estimar el CPU por segundo que gasta lo que pinta la ventana
+static double window_cpu_rate(window_info *win, long long now) {
+   double cpu;
+   long long memory;
+   if (win->engine == ENGINE_PLAYER) {
+       // La hoja cgroup suma también los hijos del reproductor
+       if (!read_player_usage(win, &cpu, &memory)) {
+           cpu = read_process_cpu_seconds(win->player_pid);
+       }
+   } else {
+       // Motores internos: el CPU del daemon repartido entre las ventanas activas
+       int active = 0;
+       for (int i = 0; i < config.window_count; i++) {
+           if (!config.windows[i].paused && config.windows[i].engine != ENGINE_STATIC) active++;
+       }
+       cpu = self_cpu_seconds() / (active > 0 ? active : 1);
+   }
+   if (cpu < 0) return 0.0;
+
+   double rate = 0.0;
+   if (win->cpu_ref_pid == win->player_pid && win->cpu_ref_ms > 0 && now - win->cpu_ref_ms >= 1000) {
+       rate = (cpu - win->cpu_ref_sec) * 1000.0 / (now - win->cpu_ref_ms);
+   }
+   win->cpu_ref_pid = win->player_pid;
+   win->cpu_ref_sec = cpu;
+   win->cpu_ref_ms = now;
+   return rate > 0 ? rate : 0.0;
+}
+
+// ¿Hay un compositor? Solo entonces el contenido de una ventana tapada sigue existiendo
+static bool compositor_running(void) {
+   char name[32];
+   snprintf(name, sizeof(name), "_NET_WM_CM_S%d", screen);
+   return XGetSelectionOwner(display, XInternAtom(display, name, False)) != None;
+}
+
+// Guardar el contenido actual (incluidas subventanas del reproductor) como
+// fondo de la ventana, para que el servidor repinte los Expose en pausa.
+// Sin compositor las partes tapadas no están definidas: solo se copia una
+// ventana que se ve entera; si no, se repinta en negro hasta reanudar
+static void freeze_window_frame(window_info *win) {
+   if (win->window == None || win->frozen_frame != None) return;
+   if (win->visibility != VisibilityUnobscured && !compositor_running()) return;
+
+   win->frozen_frame = XCreatePixmap(display, win->window, win->width, win->height,
+                                     DefaultDepth(display, screen));
+   XGCValues values;
+   values.subwindow_mode = IncludeInferiors;
+   GC gc = XCreateGC(display, win->window, GCSubwindowMode, &values);
+   XCopyArea(display, win->window, win->frozen_frame, gc, 0, 0, win->width, win->height, 0, 0);
+   XFreeGC(display, gc);
+   XSetWindowBackgroundPixmap(display, win->window, win->frozen_frame);
+}
+
+static void thaw_window_frame(window_info *win) {
+   if (win->frozen_frame == None) return;
+
+   if (win->window != None) {
+       XSetWindowBackground(display, win->window, BlackPixel(display, screen));
+   }
+   XFreePixmap(display, win->frozen_frame);
+   win->frozen_frame = None;
+}
+
+// Pausar o reanudar la ventana según sus motivos de pausa
+static void apply_pause_state(int window_index) {
+   window_info *win = &config.windows[window_index];
+   long long now = monotonic_ms();
+
+   // Las imágenes fijas no gastan nada: no hay nada que pausar
+   bool pausable = win->player_active && win->engine != ENGINE_STATIC &&
+                   (win->engine != ENGINE_PLAYER || win->player_pid > 0);
+   bool want = pausable && win->pause_reasons != 0;
+
+   if (want == win->paused) {
+       if (!win->paused && pausable) {
+           // Mantener fresca la referencia de CPU mientras corre
+           if (win->cpu_ref_pid != win->player_pid || now - win->cpu_ref_ms > 60000) {
+               window_cpu_rate(win, now);
+           }
+       }
+       return;
+   }
+
+   if (want) {
+       win->paused_cpu_rate = window_cpu_rate(win, now);
+       if (win->engine == ENGINE_PLAYER) {
+           freeze_window_frame(win);
+           kill(win->player_pid, SIGSTOP);
+       }
+       win->paused = true;
+       win->paused_since_ms = now;
+       pause_count++;
+
+       LOG_DEBUG(SUBSYS_POWER, "Window %d paused (reasons 0x%x, was using %.1f%% CPU)\n",
+                 window_index, win->pause_reasons, win->paused_cpu_rate * 100.0);
+   } else {
+       if (win->engine == ENGINE_PLAYER && win->player_pid > 0) {
+           kill(win->player_pid, SIGCONT);
+       }
+       thaw_window_frame(win);
+       win->paused = false;
+
+       double seconds = (now - win->paused_since_ms) / 1000.0;
+       paused_seconds_total += seconds;
+       paused_cpu_seconds_saved += seconds * win->paused_cpu_rate;
+
+       // La referencia de CPU no debe incluir el tiempo parado
+       win->cpu_ref_ms = 0;
+       window_cpu_rate(win, now);
+
+       LOG_DEBUG(SUBSYS_POWER, "Window %d resumed after %.1fs (~%.1f CPU-s saved, %.4f CPU-h total)\n",
+                 window_index, seconds, seconds * win->paused_cpu_rate,
+                 paused_cpu_seconds_saved / 3600.0);
+   }
+}
+
+static void set_pause_reason(int window_index, unsigned int reason, bool active) {
+   window_info *win = &config.windows[window_index];
+   if (active) {
+       win->pause_reasons |= reason;
+   } else {
+       win->pause_reasons &= ~reason;
+   }
+   apply_pause_state(window_index);
+}
+
+static int occlusion_error_trap(Display *dpy, XErrorEvent *event) {
+   (void)dpy;
+   (void)event;
+   occlusion_error = true; // El cliente desapareció durante el recorrido
+   return 0;
+}
+
+// ¿Tiene el cliente _NET_WM_STATE_FULLSCREEN/MAXIMIZED o está oculto?
+static void read_client_state(Window client, bool *fullscreen, bool *maximized, bool *hidden) {
+   Atom type;
+   int format;
+   unsigned long count, after;
+   unsigned char *data = NULL;
+   bool max_vert = false, max_horz = false;
+
+   *fullscreen = *maximized = *hidden = false;
+   if (XGetWindowProperty(display, client, ATOM(_NET_WM_STATE), 0, 64, False, XA_ATOM,
+                          &type, &format, &count, &after, &data) != Success || !data) {
+       return;
+   }
+   if (format == 32) {
+       Atom *states = (Atom *)data;
+       for (unsigned long i = 0; i < count; i++) {
+           if (states[i] == ATOM(_NET_WM_STATE_FULLSCREEN)) *fullscreen = true;
+           else if (states[i] == ATOM(_NET_WM_STATE_MAXIMIZED_VERT)) max_vert = true;
+           else if (states[i] == ATOM(_NET_WM_STATE_MAXIMIZED_HORZ)) max_horz = true;
+           else if (states[i] == ATOM(_NET_WM_STATE_HIDDEN)) *hidden = true;
+       }
+   }
+   *maximized = max_vert && max_horz;
+   XFree(data);
+}
+
+// Opacidad de compositor por debajo del 100%: se ve el fondo a través
+static bool client_is_translucent(Window client, int depth) {
+   if (depth == 32) return true; // Visual ARGB
+
+   Atom type;
+   int format;
+   unsigned long count, after;
+   unsigned char *data = NULL;
+   bool translucent = false;
+   if (XGetWindowProperty(display, client, ATOM(_NET_WM_WINDOW_OPACITY), 0, 1, False, XA_CARDINAL,
+                          &type, &format, &count, &after, &data) == Success && data) {
+       if (format == 32 && count == 1) {
+           translucent = (*(unsigned long *)data & 0xffffffffUL) != 0xffffffffUL;
+       }
+       XFree(data);
+   }
+   return translucent;
+}
+
+// Enterarse de cambios de apilamiento y de clientes que se mueven, aparecen
+// o desaparecen solo mientras pause_when_covered esté activo
+static void select_occlusion_events(void) {
+   if (!display) return;
+   XSelectInput(display, DefaultRootWindow(display),
+                config.pause_when_covered ? PropertyChangeMask | SubstructureNotifyMask : NoEventMask);
+}
+
+// Recalcular qué ventanas están tapadas: VisibilityNotify (sin compositor) o
+// algún cliente opaco que cubre el monitor entero, está a pantalla completa o
+// maximizado sobre él (con compositor VisibilityNotify nunca dice "tapada")
+static void update_occlusion(void) {
+   if (!config.pause_when_covered || !display) return;
+
+   bool covered[MAX_MONITORS] = {false};
+   int windows = config.window_count < MAX_MONITORS ? config.window_count : MAX_MONITORS;
+   Window root = DefaultRootWindow(display);
+
+   Atom type;
+   int format;
+   unsigned long count = 0, after;
+   unsigned char *data = NULL;
+   if (XGetWindowProperty(display, root, ATOM(_NET_CLIENT_LIST_STACKING), 0, 4096, False, XA_WINDOW,
+                          &type, &format, &count, &after, &data) != Success || !data || format != 32) {
+       count = 0;
+   }
+
+   XErrorHandler old_handler = XSetErrorHandler(occlusion_error_trap);
+   Window *clients = (Window *)data;
+   for (unsigned long c = 0; c < count; c++) {
+       bool own = false;
+       for (int i = 0; i < windows; i++) {
+           if (config.windows[i].window == clients[c]) own = true;
+       }
+       if (own) continue;
+
+       occlusion_error = false;
+       XWindowAttributes attrs;
+       if (!XGetWindowAttributes(display, clients[c], &attrs) || occlusion_error) continue;
+       if (attrs.map_state != IsViewable || attrs.class == InputOnly) continue;
+       if (client_is_translucent(clients[c], attrs.depth)) continue;
+
+       bool fullscreen, maximized, hidden;
+       read_client_state(clients[c], &fullscreen, &maximized, &hidden);
+       if (hidden) continue;
+
+       int cx, cy;
+       Window child;
+       if (!XTranslateCoordinates(display, clients[c], root, 0, 0, &cx, &cy, &child) || occlusion_error) {
+           continue;
+       }
+       int center_x = cx + attrs.width / 2, center_y = cy + attrs.height / 2;
+
+       for (int i = 0; i < windows; i++) {
+           window_info *win = &config.windows[i];
+           bool on_monitor = center_x >= win->x && center_x < win->x + (int)win->width &&
+                             center_y >= win->y && center_y < win->y + (int)win->height;
+           bool spans = cx <= win->x && cy <= win->y &&
+                        cx + attrs.width >= win->x + (int)win->width &&
+                        cy + attrs.height >= win->y + (int)win->height;
+           if (spans || ((fullscreen || maximized) && on_monitor)) {
+               covered[i] = true;
+           }
+       }
+   }
+   XSync(display, False);
+   XSetErrorHandler(old_handler);
+   if (data) XFree(data);
+
+   for (int i = 0; i < windows; i++) {
+       set_pause_reason(i, PAUSE_COVERED, covered[i] || config.windows[i].fully_obscured);
+   }
+}
+
+// VisibilityNotify: sin compositor el servidor sabe si la ventana está tapada
+static void handle_visibility_event(XVisibilityEvent *event) {
+   for (int i = 0; i < config.window_count; i++) {
+       if (config.windows[i].window == event->window) {
+           config.windows[i].fully_obscured = (event->state == VisibilityFullyObscured);
+           config.windows[i].visibility = event->state;
+       }
+   }
+   update_occlusion();
+}
+
+// Resumen de lo que se ahorró con las pausas
+static void report_pause_savings(void) {
+   long long now = monotonic_ms();
+   for (int i = 0; config.windows && i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       if (win->paused) {
+           double seconds = (now - win->paused_since_ms) / 1000.0;
+           paused_seconds_total += seconds;
+           paused_cpu_seconds_saved += seconds * win->paused_cpu_rate;
+           win->paused_since_ms = now;
+       }
+   }
+   if (pause_count > 0) {
+       fprintf(stderr, NAME ": Paused %d time(s) for %.2f h in total, saved ~%.3f CPU-hours\n",
+               pause_count, paused_seconds_total / 3600.0, paused_cpu_seconds_saved / 3600.0);
+   }
+}
+
+// Enviar un comando JSON al socket IPC de mpv; si se pide respuesta, leer la
+// primera línea que no sea un evento (con un timeout corto)
+static int mpv_ipc_connect(window_info *win) {
+   if (win->ipc_path[0] == '\0' || win->player_pid <= 0) return -1;
+
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0) return -1;
+
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   memcpy(addr.sun_path, win->ipc_path, sizeof(addr.sun_path));
+   if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+       close(fd); // mpv aún no ha creado el socket: se reintenta más tarde
+       return -1;
+   }
+   return fd;
+}
+
+static bool mpv_ipc_request(window_info *win, const char *command, char *reply, size_t reply_size) {
+   int fd = mpv_ipc_connect(win);
+   if (fd < 0) return false;
+
+   char line[512];
+   int len = snprintf(line, sizeof(line), "%s\n", command);
+   bool ok = len > 0 && len < (int)sizeof(line) && write(fd, line, len) == len;
+
+   if (ok && reply && reply_size > 0) {
+       size_t filled = 0;
+       long long deadline = monotonic_ms() + 200;
+       ok = false;
+       reply[0] = '\0';
+       while (!ok) {
+           long long left = deadline - monotonic_ms();
+           struct pollfd pfd = { .fd = fd, .events = POLLIN };
+           if (left <= 0 || poll(&pfd, 1, (int)left) <= 0) break;
+
+           ssize_t n = read(fd, reply + filled, reply_size - 1 - filled);
+           if (n <= 0) break;
+           filled += n;
+           reply[filled] = '\0';
+
+           // Descartar eventos ("event":...) hasta la respuesta con "error"
+           char *nl;
+           while ((nl = strchr(reply, '\n')) != NULL) {
+               *nl = '\0';
+               if (strstr(reply, "\"error\"")) {
+                   ok = true;
+                   break;
+               }
+               size_t rest = filled - (size_t)(nl + 1 - reply);
+               memmove(reply, nl + 1, rest + 1);
+               filled = rest;
+           }
+           if (filled >= reply_size - 1) break;
+       }
+   }
+
+   close(fd);
+   return ok;
+}
+
+// Límite de fps que corresponde ahora a la ventana (0 = sin límite)
+static int window_fps_cap(window_info *win) {
+   int cap = idle_fps_cap;
+   if (win && win->profile && win->profile->fps_cap > 0 && (cap == 0 || win->profile->fps_cap < cap)) {
+       cap = win->profile->fps_cap;
+   }
+   if (on_battery && strcmp(config.battery_profile, "none") != 0 && config.battery_fps > 0 &&
+       (cap == 0 || config.battery_fps < cap)) {
+       cap = config.battery_fps;
+   }
+   if (psi_level >= 1 && config.psi_fps > 0 && (cap == 0 || config.psi_fps < cap)) {
+       cap = config.psi_fps;
+   }
+   if (win && win->quality_level >= 3 && win->source_fps > 0) {
+       int half = (int)(win->source_fps / 2 + 0.5);
+       if (half < 1) half = 1;
+       if (cap == 0 || half < cap) cap = half;
+   }
+   return cap;
+}
+
+// Media resolución: gobernador PSI o ventana que no da abasto
+static bool window_reduced_resolution(window_info *win) {
+   return psi_level >= 2 || (win && win->quality_level >= 2);
+}
+
+// Leer una propiedad de mpv; devuelve el texto de "data" (sin comillas)
+static bool mpv_get_property(window_info *win, const char *property, char *value, size_t size) {
+   char command[160], reply[512];
+   snprintf(command, sizeof(command), "{\"command\":[\"get_property\",\"%s\"]}", property);
+   if (!mpv_ipc_request(win, command, reply, sizeof(reply))) return false;
+   if (!strstr(reply, "\"error\":\"success\"")) return false;
+
+   const char *data = strstr(reply, "\"data\":");
+   if (!data) return false;
+   data += 7;
+   if (*data == '"') data++;
+   size_t len = strcspn(data, "\",}");
+   if (len >= size) len = size - 1;
+   memcpy(value, data, len);
+   value[len] = '\0';
+   return true;
+}
+
+// Varias propiedades numéricas en una sola conexión: todas las peticiones de
+// golpe con request_id y las respuestas en el orden en que lleguen. Devuelve
+// cuántas se leyeron; found[i] dice cuáles
+static int mpv_get_numbers(window_info *win, const char *const *properties, double *values,
+                           bool *found, int count) {
+   for (int i = 0; i < count; i++) found[i] = false;
+   int fd = mpv_ipc_connect(win);
+   if (fd < 0) return 0;
+
+   char request[1024];
+   size_t len = 0;
+   for (int i = 0; i < count && len < sizeof(request); i++) {
+       len += snprintf(request + len, sizeof(request) - len,
+                       "{\"command\":[\"get_property\",\"%s\"],\"request_id\":%d}\n", properties[i], i + 1);
+   }
+   if (len >= sizeof(request) || write(fd, request, len) != (ssize_t)len) {
+       close(fd);
+       return 0;
+   }
+
+   char reply[2048];
+   size_t filled = 0;
+   int answered = 0, got = 0;
+   long long deadline = monotonic_ms() + 200;
+   while (answered < count) {
+       long long left = deadline - monotonic_ms();
+       struct pollfd pfd = { .fd = fd, .events = POLLIN };
+       if (left <= 0 || poll(&pfd, 1, (int)left) <= 0) break;
+       ssize_t n = read(fd, reply + filled, sizeof(reply) - 1 - filled);
+       if (n <= 0) break;
+       filled += n;
+       reply[filled] = '\0';
+
+       // Líneas completas; los eventos no llevan request_id
+       char *line = reply, *nl;
+       while ((nl = strchr(line, '\n')) != NULL) {
+           *nl = '\0';
+           const char *id = strstr(line, "\"request_id\":");
+           int index = id ? atoi(id + 13) - 1 : -1;
+           if (index >= 0 && index < count) {
+               answered++;
+               const char *data = strstr(line, "\"data\":");
+               char *end;
+               if (strstr(line, "\"error\":\"success\"") && data) {
+                   values[index] = strtod(data + 7, &end);
+                   if (end != data + 7 && !found[index]) {
+                       found[index] = true;
+                       got++;
+                   }
+               }
+           }
+           line = nl + 1;
+       }
+       filled -= line - reply;
+       memmove(reply, line, filled + 1);
+       if (filled >= sizeof(reply) - 1) break;
+   }
+   close(fd);
+   return got;
+}
+
+// Escaladores bilineales (baratos) o volver a los que tenía mpv
+static bool mpv_set_scalers(window_info *win, bool cheap) {
+   char command[160];
+   if (cheap) {
+       if (!mpv_get_property(win, "scale", win->saved_scale, sizeof(win->saved_scale)) ||
+           !mpv_get_property(win, "dscale", win->saved_dscale, sizeof(win->saved_dscale))) {
+           return false;
+       }
+   }
+   snprintf(command, sizeof(command), "{\"command\":[\"set_property\",\"scale\",\"%s\"]}",
+            cheap ? "bilinear" : win->saved_scale);
+   bool ok = mpv_ipc_request(win, command, NULL, 0);
+   snprintf(command, sizeof(command), "{\"command\":[\"set_property\",\"dscale\",\"%s\"]}",
+            cheap ? "bilinear" : win->saved_dscale);
+   return mpv_ipc_request(win, command, NULL, 0) && ok;
+}
+
+// Contadores de frames mostrados/perdidos de la ventana hasta ahora
+static bool read_frame_counters(window_info *win, double *shown, double *dropped) {
+   if (win->engine == ENGINE_PLAYER) {
+       // Una sola ida y vuelta por ventana; container-fps solo la primera vez
+       static const char *const properties[] = {
+           "frame-drop-count", "estimated-frame-number", "decoder-frame-drop-count", "container-fps"
+       };
+       double values[4] = {0};
+       bool found[4];
+       if (win->player_pid <= 0 || win->ipc_path[0] == '\0') return false;
+       int count = win->source_fps > 0 ? 3 : 4;
+       mpv_get_numbers(win, properties, values, found, count);
+       if (!found[0] || !found[1] || (count == 4 && !found[3])) return false;
+       if (count == 4) win->source_fps = values[3];
+       *dropped = values[0] + values[2];
+       *shown = values[1] - *dropped;
+       return true;
+   }
+   if (win->engine == ENGINE_PROCEDURAL || win->engine == ENGINE_LOOP_CACHE) {
+       if (win->engine == ENGINE_PROCEDURAL) {
+           win->source_fps = config.generator_fps;
+       } else if (win->loop->clip->frame_ms > 0) {
+           win->source_fps = 1000.0 / win->loop->clip->frame_ms;
+       }
+       *shown = win->frames_shown;
+       *dropped = win->frames_dropped;
+       return true;
+   }
+   return false;
+}
+
+// Medir frames entregados frente a los del origen y ajustar la calidad de
+// cada ventana: baja un escalón si pierde demasiados, sube tras un rato con margen
+static void update_quality_control(long long now) {
+   if (!config.adaptive_quality) return;
+
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       if (win->paused || now - win->quality_ref_ms < QUALITY_SAMPLE_MS) continue;
+
+       // Motor o reproductor nuevo: empezar de cero
+       if (win->quality_ref_pid != win->player_pid || win->quality_ref_engine != win->engine) {
+           win->quality_ref_pid = win->player_pid;
+           win->quality_ref_engine = win->engine;
+           win->quality_ref_ms = 0;
+           win->quality_level = 0;
+           win->quality_good_samples = 0;
+           win->source_fps = 0;
+       }
+
+       double shown, dropped;
+       if (!read_frame_counters(win, &shown, &dropped)) continue;
+
+       if (win->quality_ref_ms == 0 || shown < win->quality_ref_shown || win->quality_ref_ms <= quality_stall_ms) {
+           // Primera muestra, el archivo volvió a empezar o el bucle estuvo
+           // bloqueado: los frames que se perdieron entonces no son de la ventana
+           win->quality_ref_shown = shown;
+           win->quality_ref_dropped = dropped;
+           win->quality_ref_ms = now;
+           continue;
+       }
+
+       double seconds = (now - win->quality_ref_ms) / 1000.0;
+       double d_shown = shown - win->quality_ref_shown;
+       double d_dropped = dropped - win->quality_ref_dropped;
+       win->quality_ref_shown = shown;
+       win->quality_ref_dropped = dropped;
+       win->quality_ref_ms = now;
+       if (d_shown + d_dropped <= 0) continue;
+
+       double drop_rate = d_dropped / (d_shown + d_dropped);
+       win->delivered_fps = seconds > 0 ? d_shown / seconds : 0;
+       win->drop_ratio = drop_rate;
+       int old_level = win->quality_level;
+       if (drop_rate > QUALITY_DROP_HIGH) {
+           win->quality_good_samples = 0;
+           if (win->quality_level < QUALITY_LEVEL_MAX) win->quality_level++;
+       } else if (drop_rate < QUALITY_DROP_LOW) {
+           if (++win->quality_good_samples >= QUALITY_RECOVER_SAMPLES && win->quality_level > 0) {
+               win->quality_level--;
+               win->quality_good_samples = 0;
+           }
+       } else {
+           win->quality_good_samples = 0;
+       }
+
+       if (win->quality_level != old_level || drop_rate > QUALITY_DROP_LOW) {
+           LOG_DEBUG(SUBSYS_POWER, "Window %d delivered %.1f fps (source %.1f), %.1f%% dropped, "
+                     "quality level %d -> %d\n", i, d_shown / seconds, win->source_fps,
+                     drop_rate * 100.0, old_level, win->quality_level);
+       }
+       if (win->quality_level != old_level) {
+           apply_window_limits(i);
+       }
+   }
+}
+
+// Atajos de decodificación de libavcodec en mpv (sin filtro de escala, que con
+// hwdec obligaría a copiar los frames a memoria o a decodificar por software)
+static bool mpv_set_decoder_shortcuts(window_info *win, bool cheap) {
+   char command[160];
+   if (cheap) {
+       if (!mpv_get_property(win, "vd-lavc-skiploopfilter", win->saved_skiploopfilter,
+                             sizeof(win->saved_skiploopfilter)) ||
+           !mpv_get_property(win, "vd-lavc-fast", win->saved_lavc_fast, sizeof(win->saved_lavc_fast))) {
+           return false;
+       }
+   }
+   snprintf(command, sizeof(command), "{\"command\":[\"set_property\",\"vd-lavc-skiploopfilter\",\"%s\"]}",
+            cheap ? "all" : win->saved_skiploopfilter);
+   bool ok = mpv_ipc_request(win, command, NULL, 0);
+   snprintf(command, sizeof(command), "{\"command\":[\"set_property\",\"vd-lavc-fast\",\"%s\"]}",
+            cheap ? "yes" : win->saved_lavc_fast);
+   return mpv_ipc_request(win, command, NULL, 0) && ok;
+}
+
+// Llevar los límites de fps y resolución al motor de la ventana sin reiniciarlo
+static void apply_window_limits(int window_index) {
+   window_info *win = &config.windows[window_index];
+   bool player = win->engine == ENGINE_PLAYER && win->player_pid > 0;
+   // Reproductor sin IPC: se queda como está
+   if (player && win->ipc_path[0] == '\0') return;
+
+   // Los motores internos leen window_fps_cap() en cada frame
+   int cap = window_fps_cap(win);
+   if (cap != win->applied_fps_cap) {
+       bool ok = true;
+       if (player) {
+           char command[256];
+           mpv_ipc_request(win, "{\"command\":[\"vf\",\"remove\",\"" MPV_FPS_FILTER "\"]}", NULL, 0);
+           if (cap > 0) {
+               snprintf(command, sizeof(command),
+                        "{\"command\":[\"vf\",\"add\",\"" MPV_FPS_FILTER ":fps=fps=%d\"]}", cap);
+               ok = mpv_ipc_request(win, command, NULL, 0);
+           }
+       }
+       if (ok) {
+           LOG_DEBUG(SUBSYS_POWER, "Window %d frame rate cap %s%d\n", window_index,
+                     cap > 0 ? "" : "removed, was ", cap > 0 ? cap : win->applied_fps_cap);
+           win->applied_fps_cap = cap;
+       }
+   }
+
+   bool reduced = window_reduced_resolution(win);
+   if (reduced != win->applied_reduced_res) {
+       bool ok = true;
+       if (player) {
+           ok = mpv_set_decoder_shortcuts(win, reduced);
+       } else if (win->engine == ENGINE_PROCEDURAL && win->procedural) {
+           // El divisor interno se fija al crear el generador: rehacerlo
+           terminate_player(window_index);
+           start_media_player(window_index);
+       }
+       if (ok) {
+           LOG_DEBUG(SUBSYS_POWER, "Window %d %s\n", window_index,
+                     player ? (reduced ? "skipping the decoder loop filter" : "back to full decoding quality")
+                            : (reduced ? "rendering at half resolution" : "back to full resolution"));
+           win->applied_reduced_res = reduced;
+       }
+   }
+
+   // Escalador barato: primer escalón del control de calidad (después de
+   // rehacer un generador, que vuelve al bilineal)
+   bool cheap = win->quality_level >= 1;
+   if (cheap != win->applied_cheap_scaler) {
+       bool ok = true;
+       if (player) {
+           ok = mpv_set_scalers(win, cheap);
+       } else if (win->engine == ENGINE_PROCEDURAL && win->procedural) {
+           XRenderSetPictureFilter(display, win->procedural->small_pic,
+                                   cheap ? FilterFast : FilterBilinear, NULL, 0);
+       }
+       if (ok) win->applied_cheap_scaler = cheap;
+   }
+}
+
+// Interpretar "segundos:fps,segundos:fps" en orden creciente de segundos
+static void parse_idle_levels(const char *spec) {
+   idle_level_count = 0;
+   const char *p = spec;
+   while (*p && idle_level_count < MAX_IDLE_LEVELS) {
+       int seconds, fps, consumed;
+       if (sscanf(p, "%d:%d%n", &seconds, &fps, &consumed) != 2) break;
+       if (seconds > 0 && fps > 0) {
+           idle_level_seconds[idle_level_count] = seconds;
+           idle_level_fps[idle_level_count] = fps;
+           idle_level_count++;
+       }
+       p += consumed;
+       if (*p != ',') break;
+       p++;
+   }
+}
+
+// Preparar DPMS, MIT-SCREEN-SAVER y los niveles de inactividad
+static void init_power_monitoring(void) {
+   int error_base;
+   if (XScreenSaverQueryExtension(display, &screensaver_event_base, &error_base)) {
+       XScreenSaverSelectInput(display, DefaultRootWindow(display), ScreenSaverNotifyMask);
+   } else {
+       screensaver_event_base = -1;
+   }
+
+   parse_idle_levels(config.idle_levels);
+
+   if (log_enabled(LOG_LEVEL_DEBUG, SUBSYS_POWER)) {
+       int dpms_event, dpms_error;
+       log_write(LOG_LEVEL_DEBUG, SUBSYS_POWER, "Power monitoring: DPMS %s, MIT-SCREEN-SAVER %s, %d idle level(s)\n",
+                         DPMSQueryExtension(display, &dpms_event, &dpms_error) && DPMSCapable(display) ? "yes" : "no",
+                         screensaver_event_base >= 0 ? "yes" : "no", idle_level_count);
+   }
+}
+
+// Consultar pantallas apagadas e inactividad y aplicar pausas/límites
+static void update_power_state(void) {
+   bool blanked = false;
+   long idle_seconds = 0;
+
+   int dpms_event, dpms_error;
+   if (DPMSQueryExtension(display, &dpms_event, &dpms_error) && DPMSCapable(display)) {
+       CARD16 level;
+       BOOL enabled;
+       if (DPMSInfo(display, &level, &enabled) && enabled && level != DPMSModeOn) {
+           blanked = true;
+       }
+   }
+
+   if (screensaver_event_base >= 0) {
+       XScreenSaverInfo *info = XScreenSaverAllocInfo();
+       if (info) {
+           if (XScreenSaverQueryInfo(display, DefaultRootWindow(display), info)) {
+               if (info->state == ScreenSaverOn) blanked = true;
+               idle_seconds = (long)(info->idle / 1000);
+           }
+           XFree(info);
+       }
+   }
+
+   int cap = 0;
+   for (int i = 0; i < idle_level_count; i++) {
+       if (idle_seconds >= idle_level_seconds[i]) cap = idle_level_fps[i];
+   }
+
+   if (blanked != screens_blanked || cap != idle_fps_cap) {
+       LOG_DEBUG(SUBSYS_POWER, "Screens %s, idle %lds, frame rate cap %d\n",
+                 blanked ? "blanked" : "on", idle_seconds, cap);
+   }
+   screens_blanked = blanked;
+   idle_fps_cap = cap;
+
+   for (int i = 0; i < config.window_count; i++) {
+       set_pause_reason(i, PAUSE_BLANKED, config.pause_when_blanked && screens_blanked);
+       apply_window_limits(i);
+   }
+}
+
+// Leer un atributo de una fuente de alimentación de sysfs
+static bool read_power_supply_attr(const char *supply, const char *attr, char *buf, size_t size) {
+   char path[MAX_PATH];
+   snprintf(path, sizeof(path), POWER_SUPPLY_DIR "/%s/%s", supply, attr);
+   FILE *file = fopen(path, "r");
+   if (!file) return false;
+   bool ok = fgets(buf, size, file) != NULL;
+   fclose(file);
+   if (ok) buf[strcspn(buf, "\n")] = '\0';
+   return ok;
+}
+
+// ¿Funcionamos con batería? Sí si hay batería y ningún cargador conectado
+static bool detect_on_battery(void) {
+   DIR *dir = opendir(POWER_SUPPLY_DIR);
+   if (!dir) return false;
+
+   bool has_battery = false, external_online = false;
+   struct dirent *entry;
+   while ((entry = readdir(dir)) != NULL) {
+       if (entry->d_name[0] == '.') continue;
+
+       char type[32], value[32];
+       if (!read_power_supply_attr(entry->d_name, "type", type, sizeof(type))) continue;
+       if (strcmp(type, "Battery") == 0) {
+           // Las baterías de periféricos (ratón, teclado) no cuentan
+           if (!read_power_supply_attr(entry->d_name, "scope", value, sizeof(value)) ||
+               strcmp(value, "Device") != 0) {
+               has_battery = true;
+           }
+       } else if (read_power_supply_attr(entry->d_name, "online", value, sizeof(value)) &&
+                  strcmp(value, "1") == 0) {
+           external_online = true; // Mains, USB, USB-C...
+       }
+   }
+   closedir(dir);
+
+   return has_battery && !external_online;
+}
+
+// Aplicar el perfil de AC o batería a todas las ventanas
+static void update_battery_state(void) {
+   bool battery = detect_on_battery();
+   if (battery != on_battery) {
+       LOG_DEBUG(SUBSYS_POWER, "Power source changed to %s, using %s profile\n",
+                 battery ? "battery" : "AC", battery ? config.battery_profile : "AC");
+   }
+   on_battery = battery;
+
+   int primary = config.monitors.primary_index >= 0 ? config.monitors.primary_index : 0;
+   bool freeze_all = on_battery && strcmp(config.battery_profile, "freeze") == 0;
+   bool primary_only = on_battery && strcmp(config.battery_profile, "primary") == 0;
+
+   for (int i = 0; i < config.window_count; i++) {
+       bool secondary = config.windows[i].monitor_id != primary;
+       set_pause_reason(i, PAUSE_BATTERY, freeze_all || (primary_only && secondary));
+       apply_window_limits(i);
+   }
+}
+
+// Mensajes uevent del kernel: solo interesan los de power_supply
+static void handle_uevent(int fd, short revents) {
+   (void)revents;
+   char buf[4096];
+   bool power_event = false;
+
+   ssize_t n;
+   while ((n = recv(fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+       buf[n] = '\0';
+       // Formato: "accion@ruta\0CLAVE=valor\0..."
+       for (char *p = buf; p < buf + n; p += strlen(p) + 1) {
+           if (strcmp(p, "SUBSYSTEM=power_supply") == 0) power_event = true;
+       }
+   }
+
+   if (power_event) {
+       update_battery_state();
+   }
+}
+
+// Suscribirse a los uevents del kernel en lugar de consultar sysfs con un temporizador
+static void init_battery_monitoring(void) {
+   update_battery_state();
+
+   uevent_fd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+   if (uevent_fd < 0) {
+       LOG_DEBUG(SUBSYS_POWER, "netlink uevent socket: %s\n", strerror(errno));
+       return;
+   }
+   fcntl(uevent_fd, F_SETFD, FD_CLOEXEC);
+
+   struct sockaddr_nl addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.nl_family = AF_NETLINK;
+   addr.nl_groups = 1; // Grupo de eventos del kernel
+   if (bind(uevent_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+       !watch_fd(uevent_fd, POLLIN, handle_uevent)) {
+       LOG_DEBUG(SUBSYS_POWER, "netlink uevent bind: %s\n", strerror(errno));
+       close(uevent_fd);
+       uevent_fd = -1;
+       return;
+   }
+
+   LOG_DEBUG(SUBSYS_POWER, "Watching power supply uevents, currently on %s\n",
+             on_battery ? "battery" : "AC");
+}
+
+// Marca de tiempo local con milisegundos para los registros del gobernador
+static void format_log_timestamp(char *buf, size_t size) {
+   struct timespec ts;
+   struct tm tm;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   localtime_r(&ts.tv_sec, &tm);
+   size_t len = strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+   snprintf(buf + len, size - len, ".%03ld", ts.tv_nsec / 1000000);
+}
+
+// avg10 de la línea "some" de /proc/pressure/<recurso> (-1 si no hay PSI)
+static double read_psi_avg10(const char *resource) {
+   char path[64];
+   snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+   FILE *file = fopen(path, "r");
+   if (!file) return -1.0;
+
+   double avg10 = -1.0;
+   if (fscanf(file, "some avg10=%lf", &avg10) != 1) avg10 = -1.0;
+   fclose(file);
+   return avg10;
+}
+
+// Aplicar un escalón del gobernador y registrarlo
+static void set_psi_level(int level, const char *why) {
+   if (level < 0) level = 0;
+   if (level > PSI_LEVEL_MAX) level = PSI_LEVEL_MAX;
+   if (level == psi_level) return;
+
+   static const char *const actions[] = {
+       "normal", "lower frame rate", "cheaper decoding", "pause secondary monitors", "freeze all"
+   };
+   // El logger no pone hora: la de la decisión va en el mensaje
+   char stamp[32];
+   format_log_timestamp(stamp, sizeof(stamp));
+   LOG_WARN(SUBSYS_POWER, "[%s] PSI governor: level %d -> %d (%s): %s\n",
+            stamp, psi_level, level, actions[level], why);
+
+   psi_level = level;
+   psi_last_change_ms = monotonic_ms();
+
+   int primary = config.monitors.primary_index >= 0 ? config.monitors.primary_index : 0;
+   for (int i = 0; i < config.window_count; i++) {
+       bool secondary = config.windows[i].monitor_id != primary;
+       set_pause_reason(i, PAUSE_PRESSURE, psi_level >= 4 || (psi_level >= 3 && secondary));
+       apply_window_limits(i);
+   }
+}
+
+// Texto con los avg10 actuales para explicar cada decisión
+static bool describe_psi(char *buf, size_t size, bool *high, bool *calm) {
+   size_t len = 0;
+   bool any = false;
+   *high = false;
+   *calm = true;
+   buf[0] = '\0';
+   for (int i = 0; i < PSI_RESOURCES; i++) {
+       double avg10 = read_psi_avg10(psi_resources[i].resource);
+       if (avg10 < 0) continue;
+       any = true;
+       // Histéresis: se sube por encima del umbral y solo se baja por debajo de 1/4
+       if (avg10 >= psi_resources[i].high_percent) *high = true;
+       if (avg10 >= psi_resources[i].high_percent / 4.0) *calm = false;
+       if (len < size) {
+           len += snprintf(buf + len, size - len, "%s%s avg10=%.2f", len ? ", " : "",
+                           psi_resources[i].resource, avg10);
+       }
+   }
+   return any;
+}
+
+static void escalate_psi(const char *source) {
+   long long now = monotonic_ms();
+   psi_calm_since_ms = 0;
+   if (psi_level >= PSI_LEVEL_MAX || now - psi_last_change_ms < PSI_ESCALATE_MS) return;
+
+   char why[320], state[192];
+   bool high, calm;
+   describe_psi(state, sizeof(state), &high, &calm);
+   snprintf(why, sizeof(why), "%s (%s)", source, state);
+   set_psi_level(psi_level + 1, why);
+}
+
+// Un trigger PSI saltó: el umbral se superó dentro de la ventana
+static void handle_psi_trigger(int fd, short revents) {
+   for (int i = 0; i < PSI_RESOURCES; i++) {
+       if (psi_fds[i] != fd) continue;
+
+       if (revents & (POLLERR | POLLNVAL)) {
+           // El monitor del kernel desapareció: seguir solo con avg10
+           unwatch_fd(fd);
+           close(fd);
+           psi_fds[i] = -1;
+           return;
+       }
+       char source[64];
+       snprintf(source, sizeof(source), "%s pressure trigger", psi_resources[i].resource);
+       escalate_psi(source);
+   }
+}
+
+// Registrar triggers poll-ables en /proc/pressure/{cpu,memory,io}
+static void init_psi_governor(void) {
+   if (!config.psi_governor) return;
+
+   for (int i = 0; i < PSI_RESOURCES; i++) {
+       char path[64], trigger[64];
+       snprintf(path, sizeof(path), "/proc/pressure/%s", psi_resources[i].resource);
+       int fd = open(path, O_RDWR | O_NONBLOCK);
+       if (fd < 0) continue;
+       fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+       // "some <stall µs> <ventana µs>": porcentaje de la ventana con tareas esperando
+       int len = snprintf(trigger, sizeof(trigger), "some %d %d",
+                          PSI_WINDOW_US / 100 * psi_resources[i].high_percent, PSI_WINDOW_US);
+       if (write(fd, trigger, len + 1) < 0 || !watch_fd(fd, POLLPRI, handle_psi_trigger)) {
+           LOG_DEBUG(SUBSYS_POWER, "PSI trigger on %s unavailable: %s\n", path, strerror(errno));
+           close(fd);
+           continue;
+       }
+       psi_fds[i] = fd;
+       psi_have_triggers = true;
+   }
+
+   LOG_DEBUG(SUBSYS_POWER, "PSI governor using %s\n",
+             psi_have_triggers ? "kernel triggers" : "avg10 sampling");
+}
+
+// Recuperación con histéresis (y escalado si no hay triggers)
+static void service_psi_governor(long long now) {
+   if (!config.psi_governor || now - psi_last_sample_ms < PSI_SAMPLE_MS) return;
+   if (psi_level == 0 && psi_have_triggers) return; // Sin presión: solo triggers
+   psi_last_sample_ms = now;
+
+   char state[192];
+   bool high, calm;
+   if (!describe_psi(state, sizeof(state), &high, &calm)) return;
+
+   if (high && !psi_have_triggers) {
+       escalate_psi("avg10 above threshold");
+       return;
+   }
+
+   if (!calm) {
+       psi_calm_since_ms = 0;
+       return;
+   }
+   if (psi_calm_since_ms == 0) psi_calm_since_ms = now;
+
+   if (psi_level > 0 && now - psi_calm_since_ms >= PSI_RECOVER_MS &&
+       now - psi_last_change_ms >= PSI_RECOVER_MS) {
+       char why[320];
+       snprintf(why, sizeof(why), "pressure low for %llds (%s)",
+                (now - psi_calm_since_ms) / 1000, state);
+       set_psi_level(psi_level - 1, why);
+       psi_calm_since_ms = now;
+   }
+}
+
+static void shutdown_psi_governor(void) {
+   for (int i = 0; i < PSI_RESOURCES; i++) {
+       if (psi_fds[i] >= 0) {
+           unwatch_fd(psi_fds[i]);
+           close(psi_fds[i]);
+           psi_fds[i] = -1;
+       }
+   }
+}
+
+// Escribir un valor en un archivo de control de cgroup
+static bool write_cgroup_file(const char *dir, const char *file, const char *value) {
+   char path[MAX_PATH];
+   if (!safe_path_join(path, sizeof(path), dir, file)) return false;
+   int fd = open(path, O_WRONLY);
+   if (fd < 0) return false;
+   bool ok = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+   close(fd);
+   return ok;
+}
+
+static bool read_cgroup_file(const char *dir, const char *file, char *buf, size_t size) {
+   char path[MAX_PATH];
+   if (!safe_path_join(path, sizeof(path), dir, file)) return false;
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) return false;
+   ssize_t n = read(fd, buf, size - 1);
+   close(fd);
+   if (n < 0) return false;
+   buf[n] = '\0';
+   return true;
+}
+
+// Un cgroup está delegado si es nuestro (usuario normal) o si systemd lo
+// marcó con Delegate= (xattr user.delegate / trusted.delegate)
+static bool cgroup_is_delegated(const char *path) {
+   struct stat st;
+   if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+   char procs[MAX_PATH];
+   if (!safe_path_join(procs, sizeof(procs), path, "cgroup.procs") || access(procs, W_OK) != 0) return false;
+   if (getuid() != 0 && st.st_uid == getuid()) return true;
+   char flag[8];
+   return getxattr(path, "user.delegate", flag, sizeof(flag)) > 0 ||
+          getxattr(path, "trusted.delegate", flag, sizeof(flag)) > 0;
+}
+
+// Preparar el subárbol de reproductores bajo nuestro cgroup delegado (p.ej.
+// user@UID.service/app.slice/motionwall.service). Para poder activar
+// controladores el padre no puede tener procesos: el daemon se mueve a su hoja
+static void init_player_cgroups(void) {
+   if (!config.cgroups) return;
+
+   // cgroup v2 puro o el "unified" de un sistema híbrido (solo contabilidad)
+   const char *mount = "/sys/fs/cgroup";
+   if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) != 0) {
+       mount = "/sys/fs/cgroup/unified";
+       if (access("/sys/fs/cgroup/unified/cgroup.controllers", F_OK) != 0) return;
+   }
+
+   char base[MAX_PATH];
+   if (config.cgroup_parent[0] != '\0') {
+       strncpy(base, config.cgroup_parent, sizeof(base) - 1);
+       base[sizeof(base) - 1] = '\0';
+   } else {
+       char line[MAX_PATH] = "";
+       FILE *file = fopen("/proc/self/cgroup", "r");
+       if (!file) return;
+       bool found = false;
+       while (fgets(line, sizeof(line), file)) {
+           if (strncmp(line, "0::", 3) == 0) {
+               found = true;
+               break;
+           }
+       }
+       fclose(file);
+       if (!found) return;
+       line[strcspn(line, "\n")] = '\0';
+       if (snprintf(base, sizeof(base), "%s%s", mount, line + 3) >= (int)sizeof(base)) return;
+   }
+
+   if (!cgroup_is_delegated(base)) {
+       LOG_DEBUG(SUBSYS_PLAYER, "cgroup %s is not delegated to us, players run unconfined\n", base);
+       return;
+   }
+   memcpy(cgroup_base, base, sizeof(cgroup_base));
+
+   // Sacar al daemon de la raíz del subárbol para que pueda tener controladores
+   if (config.cgroup_parent[0] == '\0') {
+       char daemon_dir[MAX_PATH], pid_str[32];
+       if (safe_path_join(daemon_dir, sizeof(daemon_dir), base, CGROUP_DAEMON_DIR) &&
+           (mkdir(daemon_dir, 0755) == 0 || errno == EEXIST)) {
+           snprintf(pid_str, sizeof(pid_str), "%d", (int)getpid());
+           if (write_cgroup_file(daemon_dir, "cgroup.procs", pid_str)) {
+               memcpy(cgroup_daemon, daemon_dir, sizeof(cgroup_daemon));
+           } else {
+               rmdir(daemon_dir);
+           }
+       }
+   }
+
+   // Falla si quedan otros procesos en base (p.ej. la shell de un terminal):
+   // entonces solo hay contabilidad de CPU, sin límites
+   char before[256] = "";
+   read_cgroup_file(base, "cgroup.subtree_control", before, sizeof(before));
+   write_cgroup_file(base, "cgroup.subtree_control", "+cpu +memory");
+   char after[256] = "";
+   read_cgroup_file(base, "cgroup.subtree_control", after, sizeof(after));
+   snprintf(cgroup_enabled, sizeof(cgroup_enabled), "%s%s",
+            !strstr(before, "cpu") && strstr(after, "cpu") ? "-cpu " : "",
+            !strstr(before, "memory") && strstr(after, "memory") ? "-memory" : "");
+
+   char players[MAX_PATH];
+   if (!safe_path_join(players, sizeof(players), base, CGROUP_PLAYERS_DIR)) return;
+   if (mkdir(players, 0755) != 0 && errno != EEXIST) {
+       LOG_DEBUG(SUBSYS_PLAYER, "mkdir players cgroup: %s\n", strerror(errno));
+       return;
+   }
+   write_cgroup_file(players, "cgroup.subtree_control", "+cpu +memory");
+
+   char controllers[256] = "";
+   read_cgroup_file(players, "cgroup.subtree_control", controllers, sizeof(controllers));
+   cgroup_has_cpu = strstr(controllers, "cpu") != NULL;
+   cgroup_has_memory = strstr(controllers, "memory") != NULL;
+   memcpy(cgroup_players, players, sizeof(cgroup_players));
+
+   LOG_DEBUG(SUBSYS_PLAYER, "Players go into %s (controllers:%s%s)\n", cgroup_players,
+             cgroup_has_cpu ? " cpu" : "", cgroup_has_memory ? " memory" : "");
+}
+
+// Crear (o reutilizar) la hoja de la ventana y aplicarle los límites
+static bool prepare_window_cgroup(int window_index) {
+   window_info *win = &config.windows[window_index];
+   win->cgroup_path[0] = '\0';
+   if (cgroup_players[0] == '\0') return false;
+
+   char leaf[64], path[MAX_PATH];
+   snprintf(leaf, sizeof(leaf), "window-%d", window_index);
+   if (!safe_path_join(path, sizeof(path), cgroup_players, leaf)) return false;
+   if (mkdir(path, 0755) != 0 && errno != EEXIST) return false;
+
+   char value[64];
+   if (cgroup_has_cpu) {
+       if (config.cgroup_cpu_percent > 0) {
+           snprintf(value, sizeof(value), "%d 100000", config.cgroup_cpu_percent * 1000);
+       } else {
+           strcpy(value, "max 100000");
+       }
+       write_cgroup_file(path, "cpu.max", value);
+       // 0 vuelve al valor por defecto si una recarga quita el peso
+       snprintf(value, sizeof(value), "%d", config.cgroup_cpu_weight > 0 ? config.cgroup_cpu_weight : 100);
+       write_cgroup_file(path, "cpu.weight", value);
+   }
+   if (cgroup_has_memory) {
+       if (config.cgroup_memory_high_mb > 0) {
+           snprintf(value, sizeof(value), "%lld", (long long)config.cgroup_memory_high_mb << 20);
+       } else {
+           strcpy(value, "max");
+       }
+       write_cgroup_file(path, "memory.high", value);
+       if (config.cgroup_memory_max_mb > 0) {
+           snprintf(value, sizeof(value), "%lld", (long long)config.cgroup_memory_max_mb << 20);
+       } else {
+           strcpy(value, "max");
+       }
+       write_cgroup_file(path, "memory.max", value);
+   }
+
+   strncpy(win->cgroup_path, path, sizeof(win->cgroup_path) - 1);
+   win->cgroup_path[sizeof(win->cgroup_path) - 1] = '\0';
+   return true;
+}
+
+// CPU (cpu.stat usage_usec) y memoria (memory.current) de la hoja de la ventana
+static bool read_player_usage(window_info *win, double *cpu_seconds, long long *memory_bytes) {
+   if (win->cgroup_path[0] == '\0') return false;
+
+   char buf[1024];
+   if (!read_cgroup_file(win->cgroup_path, "cpu.stat", buf, sizeof(buf))) return false;
+   long long usage_usec;
+   if (sscanf(buf, "usage_usec %lld", &usage_usec) != 1) return false;
+   *cpu_seconds = usage_usec / 1e6;
+
+   *memory_bytes = -1;
+   if (read_cgroup_file(win->cgroup_path, "memory.current", buf, sizeof(buf))) {
+       *memory_bytes = atoll(buf);
+   }
+   return true;
+}
+
+// Borrar las hojas vacías al salir (los reproductores ya terminaron)
+static void release_player_cgroups(void) {
+   if (cgroup_players[0] == '\0') return;
+   for (int i = 0; config.windows && i < config.window_count; i++) {
+       if (config.windows[i].cgroup_path[0] != '\0') {
+           rmdir(config.windows[i].cgroup_path);
+           config.windows[i].cgroup_path[0] = '\0';
+       }
+   }
+   rmdir(cgroup_players);
+   cgroup_players[0] = '\0';
+
+   // Dejar la raíz como estaba: sin nuestros controladores y el daemon de vuelta
+   if (cgroup_base[0] == '\0') return;
+   if (cgroup_enabled[0] != '\0') write_cgroup_file(cgroup_base, "cgroup.subtree_control", cgroup_enabled);
+   if (cgroup_daemon[0] != '\0') {
+       char pid_str[32];
+       snprintf(pid_str, sizeof(pid_str), "%d", (int)getpid());
+       if (write_cgroup_file(cgroup_base, "cgroup.procs", pid_str)) rmdir(cgroup_daemon);
+       cgroup_daemon[0] = '\0';
+   }
+   cgroup_base[0] = '\0';
+}
+
+// Buscar (o crear) las opciones de un monitor por nombre de salida
+static monitor_override *find_monitor_override(const char *name, bool create) {
+   for (int i = 0; i < config.monitor_override_count; i++) {
+       if (strcmp(config.monitor_overrides[i].name, name) == 0) {
+           return &config.monitor_overrides[i];
+       }
+   }
+   if (!create || config.monitor_override_count >= MAX_MONITORS) return NULL;
+
+   monitor_override *mo = &config.monitor_overrides[config.monitor_override_count++];
+   memset(mo, 0, sizeof(*mo));
+   strncpy(mo->name, name, sizeof(mo->name) - 1);
+   return mo;
+}
+
+// monitor.<SALIDA>.<clave>=valor; la salida puede contener puntos
+static bool parse_monitor_key(const char *key, const char *value) {
+   if (strncmp(key, "monitor.", 8) != 0) return false;
+   const char *name = key + 8;
+   const char *dot = strrchr(name, '.');
+   if (!dot || dot == name || (size_t)(dot - name) >= sizeof(((monitor_override *)0)->name)) {
+       return false;
+   }
+
+   char output[64];
+   memcpy(output, name, dot - name);
+   output[dot - name] = '\0';
+   const char *field = dot + 1;
+
+   monitor_override *mo = find_monitor_override(output, true);
+   if (!mo) return false;
+
+   if (strcmp(field, "profile") == 0) {
+       strncpy(mo->profile, value, sizeof(mo->profile) - 1);
+   } else if (strcmp(field, "player_sched") == 0) {
+       strncpy(mo->player_sched, value, sizeof(mo->player_sched) - 1);
+   } else if (strcmp(field, "player_ioprio") == 0) {
+       strncpy(mo->player_ioprio, value, sizeof(mo->player_ioprio) - 1);
+   } else if (strcmp(field, "player_cpus") == 0) {
+       strncpy(mo->player_cpus, value, sizeof(mo->player_cpus) - 1);
+   } else if (strcmp(field, "player_nice") == 0) {
+       mo->player_nice = atoi(value);
+       mo->has_nice = true;
+   } else if (strcmp(field, "max_fps") == 0) {
+       mo->max_fps = atoi(value);
+   } else if (strcmp(field, "match_output") == 0) {
+       mo->match_output = strcmp(value, "true") == 0;
+       mo->has_match_output = true;
+   } else {
+       return false;
+   }
+   return true;
+}
+
+static void save_monitor_overrides(FILE *file) {
+   for (int i = 0; i < config.monitor_override_count; i++) {
+       monitor_override *mo = &config.monitor_overrides[i];
+       if (mo->profile[0]) fprintf(file, "monitor.%s.profile=%s\n", mo->name, mo->profile);
+       if (mo->player_sched[0]) fprintf(file, "monitor.%s.player_sched=%s\n", mo->name, mo->player_sched);
+       if (mo->has_nice) fprintf(file, "monitor.%s.player_nice=%d\n", mo->name, mo->player_nice);
+       if (mo->player_ioprio[0]) fprintf(file, "monitor.%s.player_ioprio=%s\n", mo->name, mo->player_ioprio);
+       if (mo->player_cpus[0]) fprintf(file, "monitor.%s.player_cpus=%s\n", mo->name, mo->player_cpus);
+       if (mo->max_fps) fprintf(file, "monitor.%s.max_fps=%d\n", mo->name, mo->max_fps);
+       if (mo->has_match_output) {
+           fprintf(file, "monitor.%s.match_output=%s\n", mo->name, mo->match_output ? "true" : "false");
+       }
+   }
+}
+
+// Lista de CPUs estilo cpuset ("0-3,6") a máscara de afinidad
+static bool parse_cpu_list(const char *list, unsigned long *mask, size_t words) {
+   memset(mask, 0, words * sizeof(unsigned long));
+   const size_t bits = words * 8 * sizeof(unsigned long);
+   bool any = false;
+   const char *p = list;
+
+   while (*p) {
+       char *end;
+       long first = strtol(p, &end, 10);
+       if (end == p || first < 0) return false;
+       long last = first;
+       p = end;
+       if (*p == '-') {
+           last = strtol(p + 1, &end, 10);
+           if (end == p + 1 || last < first) return false;
+           p = end;
+       }
+       for (long cpu = first; cpu <= last && (size_t)cpu < bits; cpu++) {
+           mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+           any = true;
+       }
+       if (*p == ',') p++;
+       else if (*p) return false;
+   }
+   return any;
+}
+
+// Combinar las opciones globales con las del monitor
+static void resolve_player_sched(const char *monitor_name, player_sched *ps) {
+   monitor_override *mo = monitor_name ? find_monitor_override(monitor_name, false) : NULL;
+   const char *sched = (mo && mo->player_sched[0]) ? mo->player_sched : config.player_sched;
+   const char *ioprio = (mo && mo->player_ioprio[0]) ? mo->player_ioprio : config.player_ioprio;
+   const char *cpus = (mo && mo->player_cpus[0]) ? mo->player_cpus : config.player_cpus;
+
+   memset(ps, 0, sizeof(*ps));
+   ps->nice = (mo && mo->has_nice) ? mo->player_nice : config.player_nice;
+
+   if (strcmp(sched, "idle") == 0) {
+       ps->policy = SCHED_IDLE;
+   } else if (strcmp(sched, "batch") == 0) {
+       ps->policy = SCHED_BATCH;
+   } else {
+       ps->policy = SCHED_OTHER;
+   }
+
+   if (strcmp(ioprio, "idle") == 0) {
+       ps->ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+   } else if (strcmp(ioprio, "low") == 0) {
+       ps->ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7;
+   } else {
+       ps->ioprio = -1;
+   }
+
+   if (cpus[0] != '\0') {
+       ps->set_cpus = parse_cpu_list(cpus, ps->cpus, CPU_MASK_WORDS);
+       if (!ps->set_cpus) {
+           fprintf(stderr, NAME ": Warning: Invalid CPU list '%s', ignoring\n", cpus);
+       }
+   }
+}
+
+// Entre fork() y exec(): solo llamadas al sistema. Los hilos del reproductor
+// heredan la clase; si algo falla el reproductor sigue con la de por defecto
+static void apply_player_sched(const player_sched *ps) {
+   if (ps->nice != 0) {
+       setpriority(PRIO_PROCESS, 0, ps->nice);
+   }
+   if (ps->policy != SCHED_OTHER) {
+       struct sched_param param = { .sched_priority = 0 };
+       sched_setscheduler(0, ps->policy, &param);
+   }
+   if (ps->ioprio >= 0) {
+       syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ps->ioprio);
+   }
+   if (ps->set_cpus) {
+       syscall(SYS_sched_setaffinity, 0, sizeof(ps->cpus), ps->cpus);
+   }
+}
+
+// ffprobe del elemento actual; todas las ventanas suelen arrancar el mismo,
+// así que basta una entrada de cache para no repetirlo
+static bool current_item_probe(media_probe *info) {
+   return cached_probe(config.media_playlist.paths[config.media_playlist.current], info);
+}
+
+// Píxeles por frame del elemento actual
+static double current_item_pixels(void) {
+   media_probe info;
+   return current_item_probe(&info) ? (double)info.width * info.height : 1920.0 * 1080.0;
+}
+
+// Filtro que recorta el vídeo a lo que el monitor puede mostrar: no más fps
+// que su refresco. El tamaño no se toca: un scale de lavfi sacaría los frames
+// de hwdec y haría en la CPU lo que el VO escala en la GPU. Sin ffprobe no se
+// sabe si sobra: no se añade nada
+static bool build_output_filter(int window_index, bool mpv_syntax, char *buf, size_t size) {
+   window_info *win = &config.windows[window_index];
+   buf[0] = '\0';
+   if (win->monitor_id < 0 || win->monitor_id >= config.monitors.count) return false;
+
+   monitor_info *mon = &config.monitors.monitors[win->monitor_id];
+   monitor_override *mo = find_monitor_override(mon->name, false);
+   bool enabled = (mo && mo->has_match_output) ? mo->match_output : config.match_output;
+   media_probe info;
+   if (!enabled || !current_item_probe(&info)) return false;
+
+   int max_fps = (mo && mo->max_fps > 0) ? mo->max_fps : (int)(mon->refresh + 0.5);
+   if (max_fps <= 0 || info.fps <= max_fps * 1.05) return false;
+
+   // El filtro fps solo descarta frames: acepta los de hwdec tal cual
+   if (mpv_syntax) {
+       snprintf(buf, size, "--vf=" MPV_OUTPUT_FILTER ":lavfi=[fps=fps=%d]", max_fps);
+   } else {
+       // mplayer no tiene filtro fps: saltar frames enteros
+       snprintf(buf, size, "framestep=%d", (int)(info.fps / max_fps + 0.5));
+   }
+
+   LOG_DEBUG(SUBSYS_MONITOR, "Window %d: %ux%u@%.2f source on %s@%d, filter %s\n",
+             window_index, info.width, info.height, info.fps, mon->name, max_fps, buf);
+   return true;
+}
+
+// Coste medido por archivo, para ver qué elementos salen caros
+static item_usage item_costs[ACCOUNTING_ITEMS];
+static int item_cost_count = 0;
+
+// Leer CPU, memoria, cambios de contexto y lecturas de un proceso
+static bool read_process_usage(pid_t pid, player_usage *out) {
+   char path[64], line[256];
+   memset(out, 0, sizeof(*out));
+
+   double cpu = read_process_cpu_seconds(pid);
+   if (cpu < 0) return false;
+   out->cpu_seconds = cpu;
+
+   snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+   FILE *file = fopen(path, "r");
+   if (file) {
+       while (fgets(line, sizeof(line), file)) {
+           if (sscanf(line, "VmRSS: %ld", &out->rss_kb) == 1) continue;
+           if (sscanf(line, "voluntary_ctxt_switches: %llu", &out->voluntary_switches) == 1) continue;
+           sscanf(line, "nonvoluntary_ctxt_switches: %llu", &out->involuntary_switches);
+       }
+       fclose(file);
+   }
+
+   // PSS no está en status; smaps_rollup la da sin recorrer cada mapeo
+   snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+   file = fopen(path, "r");
+   if (file) {
+       while (fgets(line, sizeof(line), file)) {
+           if (sscanf(line, "Pss: %ld", &out->pss_kb) == 1) break;
+       }
+       fclose(file);
+   }
+
+   snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+   file = fopen(path, "r");
+   if (file) {
+       while (fgets(line, sizeof(line), file)) {
+           if (sscanf(line, "rchar: %llu", &out->read_bytes) == 1) break;
+       }
+       fclose(file);
+   }
+   out->peak_rss_kb = out->rss_kb;
+   return true;
+}
+
+// Entrada del archivo en la tabla; si está llena se recicla la menos usada
+static int find_item_usage(const char *path, bool create) {
+   int least = -1;
+   for (int i = 0; i < item_cost_count; i++) {
+       if (strcmp(item_costs[i].path, path) == 0) return i;
+       if (least < 0 || item_costs[i].usage.play_seconds < item_costs[least].usage.play_seconds) least = i;
+   }
+   if (!create) return -1;
+
+   int slot = item_cost_count < ACCOUNTING_ITEMS ? item_cost_count++ : least;
+   memset(&item_costs[slot], 0, sizeof(item_costs[slot]));
+   strncpy(item_costs[slot].path, path, sizeof(item_costs[slot].path) - 1);
+   // Las ventanas que apuntaban a la entrada reciclada dejan de sumar en ella
+   for (int i = 0; config.windows && i < config.window_count; i++) {
+       if (config.windows[i].usage_item == slot) config.windows[i].usage_item = -1;
+   }
+   return slot;
+}
+
+static void add_usage(player_usage *total, const player_usage *delta, const player_usage *sample) {
+   total->cpu_seconds += delta->cpu_seconds;
+   total->voluntary_switches += delta->voluntary_switches;
+   total->involuntary_switches += delta->involuntary_switches;
+   total->read_bytes += delta->read_bytes;
+   total->play_seconds += delta->play_seconds;
+   total->rss_kb = sample->rss_kb;
+   total->pss_kb = sample->pss_kb;
+   if (sample->rss_kb > total->peak_rss_kb) total->peak_rss_kb = sample->rss_kb;
+}
+
+// Sumar lo consumido desde la muestra anterior a la ventana y a su elemento
+static void account_player(int window_index, long long now) {
+   window_info *win = &config.windows[window_index];
+   if (win->engine != ENGINE_PLAYER || !win->player_active || win->player_pid <= 0) return;
+
+   player_usage sample;
+   if (!read_process_usage(win->player_pid, &sample)) return;
+
+   // Reproductor nuevo: se cuenta desde su arranque
+   if (win->usage_pid != win->player_pid) {
+       memset(&win->usage_ref, 0, sizeof(win->usage_ref));
+       win->usage_pid = win->player_pid;
+       win->usage_ms = win->started_ms;
+   }
+
+   player_usage delta;
+   delta.cpu_seconds = sample.cpu_seconds - win->usage_ref.cpu_seconds;
+   delta.voluntary_switches = sample.voluntary_switches - win->usage_ref.voluntary_switches;
+   delta.involuntary_switches = sample.involuntary_switches - win->usage_ref.involuntary_switches;
+   delta.read_bytes = sample.read_bytes - win->usage_ref.read_bytes;
+   // En pausa no se decodifica: ese tiempo no abarata el elemento
+   delta.play_seconds = (win->paused || win->usage_ms <= 0) ? 0 : (now - win->usage_ms) / 1000.0;
+
+   add_usage(&win->usage, &delta, &sample);
+   if (win->usage_item >= 0) {
+       add_usage(&item_costs[win->usage_item].usage, &delta, &sample);
+   }
+   win->usage_ref = sample;
+   win->usage_ms = now;
+}
+
+// Muestreo periódico de todos los reproductores
+static void sample_player_accounting(long long now) {
+   static long long last_sample_ms = 0;
+   if (config.accounting_interval <= 0 || now - last_sample_ms < config.accounting_interval * 1000LL) return;
+   last_sample_ms = now;
+
+   for (int i = 0; config.windows && i < config.window_count; i++) {
+       account_player(i, now);
+   }
+}
+
+// CPU por segundo de reproducción del elemento, o < 0 si aún no hay bastante
+static double item_cpu_rate(int item) {
+   if (item < 0 || item_costs[item].usage.play_seconds < ACCOUNTING_MIN_SECONDS) return -1.0;
+   return item_costs[item].usage.cpu_seconds / item_costs[item].usage.play_seconds;
+}
+
+// Resumen al salir, los elementos más caros primero
+static void report_item_usage(void) {
+   if (!log_enabled(LOG_LEVEL_INFO, SUBSYS_PLAYER)) return;
+
+   bool shown[ACCOUNTING_ITEMS] = { false };
+   for (int n = 0; n < item_cost_count; n++) {
+       int best = -1;
+       for (int i = 0; i < item_cost_count; i++) {
+           if (shown[i]) continue;
+           double rate = item_costs[i].usage.play_seconds > 0 ?
+                         item_costs[i].usage.cpu_seconds / item_costs[i].usage.play_seconds : 0;
+           double best_rate = best < 0 ? -1 : item_costs[best].usage.play_seconds > 0 ?
+                              item_costs[best].usage.cpu_seconds / item_costs[best].usage.play_seconds : 0;
+           if (rate > best_rate) best = i;
+       }
+       shown[best] = true;
+       player_usage *u = &item_costs[best].usage;
+       LOG_INFO(SUBSYS_PLAYER, "Item cost: %.2f CPU-s/s over %.0fs, peak RSS %ld MB, %llu MB read, "
+                "%llu/%llu ctx switches: %s\n",
+                u->play_seconds > 0 ? u->cpu_seconds / u->play_seconds : 0.0, u->play_seconds,
+                u->peak_rss_kb / 1024, u->read_bytes >> 20, u->voluntary_switches,
+                u->involuntary_switches, item_costs[best].path);
+   }
+}
+
+// Hilos de decodificación de toda la máquina: los núcleos a los que pueden ir
+// los reproductores, o el valor configurado
+static int decoder_thread_budget(void) {
+   if (config.decoder_threads > 0) return config.decoder_threads;
+
+   player_sched ps;
+   resolve_player_sched(NULL, &ps);
+   if (ps.set_cpus) {
+       int count = 0;
+       for (int i = 0; i < CPU_MASK_WORDS; i++) {
+           count += __builtin_popcountl(ps.cpus[i]);
+       }
+       return count;
+   }
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   return cpus > 0 ? (int)cpus : 1;
+}
+
+// Coste de decodificar un elemento en CPU-s por segundo: el medido si hay
+// bastante reproducción, si no sus píxeles por el coste medio por píxel
+static double item_decode_cost(const char *path, double pixels, double cpu_per_pixel) {
+   double rate = item_cpu_rate(find_item_usage(path, false));
+   return rate >= 0 ? rate : pixels * cpu_per_pixel;
+}
+
+// Parte del presupuesto para la ventana, proporcional a lo que cuesta
+// decodificar su elemento; las ventanas con motores internos no cuentan
+static int window_decoder_threads(int window_index) {
+   const char *current_path = config.media_playlist.paths[config.media_playlist.current];
+   double current = current_item_pixels();
+
+   // CPU medio por píxel de lo ya medido; sin medidas, el reparto es por píxeles
+   double measured_cpu = 0, measured_pixels = 0;
+   for (int i = 0; i < item_cost_count; i++) {
+       double rate = item_cpu_rate(i);
+       if (rate < 0 || item_costs[i].pixels <= 0) continue;
+       measured_cpu += rate;
+       measured_pixels += item_costs[i].pixels;
+   }
+   double cpu_per_pixel = measured_pixels > 0 ? measured_cpu / measured_pixels : 1.0;
+
+   double total = 0, mine = 0;
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       if (i != window_index && win->engine != ENGINE_PLAYER) continue;
+       double cost;
+       if (i == window_index || win->usage_item < 0) {
+           cost = item_decode_cost(current_path, current, cpu_per_pixel);
+       } else {
+           cost = item_decode_cost(item_costs[win->usage_item].path,
+                                   win->item_pixels > 0 ? win->item_pixels : current, cpu_per_pixel);
+       }
+       if (i == window_index) mine = cost;
+       total += cost;
+   }
+
+   const performance_profile *profile = resolve_window_profile(window_index);
+   int threads = total > 0 ? (int)(decoder_thread_budget() * mine / total *
+                                   profile->thread_percent / 100 + 0.5) : 1;
+   return threads < 1 ? 1 : threads;
+}
+
+// Tras un cambio de monitores: reiniciar los reproductores cuya parte de
+// hilos o filtro de salida cambió (ambos se fijan al abrir el archivo)
+static void restart_outdated_players(void) {
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       if (win->engine != ENGINE_PLAYER || !win->player_active || win->decoder_threads <= 0) continue;
+
+       int threads = window_decoder_threads(i);
+       char filter[sizeof(win->output_filter)];
+       build_output_filter(i, strstr(config.media_player, "mpv") != NULL, filter, sizeof(filter));
+       if (threads == win->decoder_threads && strcmp(filter, win->output_filter) == 0) continue;
+
+       LOG_DEBUG(SUBSYS_PLAYER, "Window %d decoder threads %d -> %d, output filter '%s' -> '%s', "
+                 "restarting player\n", i, win->decoder_threads, threads, win->output_filter, filter);
+       terminate_player(i);
+       start_media_player(i);
+   }
+}
+
+// Perfiles de rendimiento. balanced es lo que hacíamos siempre
+static const performance_profile profiles[] = {
+   {
+       "eco",
+       { "--hwdec=auto-safe", "--framedrop=decoder+vo", "--vd-lavc-fast", "--vd-lavc-skiploopfilter=all",
+         "--scale=bilinear", "--dscale=bilinear", "--cscale=bilinear", "--demuxer-max-bytes=16MiB" },
+       { "-hardframedrop", "-nocache", "-sws", "0" },
+       "fast:skiploopfilter=all",
+       { "--avcodec-hw=any", "--avcodec-fast", "--avcodec-skiploopfilter=4", "--drop-late-frames",
+         "--swscale-mode=0", "--file-caching=300" },
+       24, 50
+   },
+   {
+       // Exactamente los flags que se pasaban antes de haber perfiles
+       "balanced",
+       { "--hwdec=auto" },
+       { "-framedrop", "-cache", "8192" },
+       NULL,
+       { NULL },
+       0, 100
+   },
+   {
+       "quality",
+       { "--hwdec=auto-copy", "--framedrop=no", "--scale=ewa_lanczossharp", "--dscale=mitchell",
+         "--cscale=spline36", "--demuxer-max-bytes=150MiB" },
+       { "-cache", "32768", "-sws", "9" },
+       NULL,
+       { "--avcodec-hw=any", "--no-drop-late-frames", "--swscale-mode=9", "--file-caching=2000" },
+       0, 100
+   },
+};
+
+static const performance_profile *find_profile(const char *name) {
+   for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+       if (strcmp(profiles[i].name, name) == 0) return &profiles[i];
+   }
+   return NULL;
+}
+
+// Perfil del monitor de la ventana, o el global
+static const performance_profile *resolve_window_profile(int window_index) {
+   window_info *win = &config.windows[window_index];
+   const performance_profile *profile = NULL;
+   if (win->monitor_id >= 0 && win->monitor_id < config.monitors.count) {
+       monitor_override *mo = find_monitor_override(config.monitors.monitors[win->monitor_id].name, false);
+       if (mo && mo->profile[0]) profile = find_profile(mo->profile);
+   }
+   if (!profile) profile = find_profile(config.profile);
+   return profile ? profile : find_profile("balanced");
+}
+
+// SIGUSR1: siguiente perfil global. Los monitores con perfil propio no cambian
+static void cycle_profile(void) {
+   const performance_profile *current = find_profile(config.profile);
+   size_t count = sizeof(profiles) / sizeof(profiles[0]);
+   size_t next = current ? (size_t)(current - profiles + 1) % count : 0;
+   strcpy(config.profile, profiles[next].name);
+   fprintf(stderr, NAME ": Performance profile: %s\n", config.profile);
+   apply_profile_change();
+}
+
+// Reiniciar los reproductores cuyo perfil efectivo cambió
+static void apply_profile_change(void) {
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       if (win->engine == ENGINE_PLAYER && win->player_active && win->profile &&
+           win->profile != resolve_window_profile(i)) {
+           // Las opciones del reproductor se fijan al arrancar
+           terminate_player(i);
+           start_media_player(i);
+       } else if (win->engine != ENGINE_PLAYER) {
+           // Los motores internos solo leen el límite de fps
+           win->profile = resolve_window_profile(i);
+       }
+   }
+}
+
+static void metrics_append(char *buf, size_t size, size_t *len, const char *fmt, ...) {
+   if (*len >= size) return;
+   va_list ap;
+   va_start(ap, fmt);
+   int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+   va_end(ap);
+   if (n > 0) *len = (*len + n < size) ? *len + n : size;
+}
+
+// Métricas en formato de texto de Prometheus
+static size_t format_metrics(char *buf, size_t size) {
+   size_t len = 0;
+   double now_s = monotonic_ms() / 1000.0;
+
+   metrics_append(buf, size, &len,
+       "# HELP motionwall_uptime_seconds Seconds since the daemon started.\n"
+       "# TYPE motionwall_uptime_seconds gauge\n"
+       "motionwall_uptime_seconds %.3f\n"
+       "# HELP motionwall_cpu_seconds_total CPU time used by the daemon itself.\n"
+       "# TYPE motionwall_cpu_seconds_total counter\n"
+       "motionwall_cpu_seconds_total %.3f\n"
+       "# HELP motionwall_resident_memory_bytes Resident set size of the daemon.\n"
+       "# TYPE motionwall_resident_memory_bytes gauge\n"
+       "motionwall_resident_memory_bytes %ld\n",
+       now_s - daemon_stats.start_ms / 1000.0, self_cpu_seconds(), self_rss_kb() * 1024);
+
+   metrics_append(buf, size, &len,
+       "# HELP motionwall_reconfiguration_duration_seconds Time to adapt to a monitor change.\n"
+       "# TYPE motionwall_reconfiguration_duration_seconds summary\n"
+       "motionwall_reconfiguration_duration_seconds_sum %.6f\n"
+       "motionwall_reconfiguration_duration_seconds_count %lu\n"
+       "# HELP motionwall_last_reconfiguration_duration_seconds Duration of the latest monitor change.\n"
+       "# TYPE motionwall_last_reconfiguration_duration_seconds gauge\n"
+       "motionwall_last_reconfiguration_duration_seconds %.6f\n"
+       "# HELP motionwall_transition_duration_seconds Time from a playlist switch until every window shows the new item.\n"
+       "# TYPE motionwall_transition_duration_seconds summary\n"
+       "motionwall_transition_duration_seconds_sum %.6f\n"
+       "motionwall_transition_duration_seconds_count %lu\n"
+       "# HELP motionwall_last_transition_duration_seconds Duration of the latest playlist switch.\n"
+       "# TYPE motionwall_last_transition_duration_seconds gauge\n"
+       "motionwall_last_transition_duration_seconds %.6f\n",
+       daemon_stats.reconfiguration_seconds, daemon_stats.reconfigurations,
+       daemon_stats.last_reconfiguration_seconds,
+       daemon_stats.transition_seconds, daemon_stats.transitions,
+       daemon_stats.last_transition_seconds);
+
+   metrics_append(buf, size, &len,
+       "# HELP motionwall_psi_level Pressure governor level (0 = normal).\n"
+       "# TYPE motionwall_psi_level gauge\n"
+       "motionwall_psi_level %d\n"
+       "# HELP motionwall_on_battery Whether the machine runs on battery.\n"
+       "# TYPE motionwall_on_battery gauge\n"
+       "motionwall_on_battery %d\n",
+       psi_level, on_battery ? 1 : 0);
+
+   static const struct {
+       const char *name, *type, *help;
+   } window_metrics[] = {
+       { "motionwall_window_player_restarts_total", "counter", "Players restarted after dying or hanging." },
+       { "motionwall_window_uptime_seconds", "gauge", "Seconds since the current engine or player started." },
+       { "motionwall_window_fps", "gauge", "Delivered frames per second in the last quality sample." },
+       { "motionwall_window_drop_ratio", "gauge", "Fraction of frames dropped in the last quality sample." },
+       { "motionwall_window_quality_level", "gauge", "Adaptive quality level (0 = full quality)." },
+       { "motionwall_window_paused", "gauge", "Whether playback is paused (covered, blanked, battery, pressure)." },
+       { "motionwall_window_player_cpu_seconds_total", "counter", "CPU time used by the window's players." },
+       { "motionwall_window_player_resident_bytes", "gauge", "Resident set size of the current player." },
+       { "motionwall_window_player_pss_bytes", "gauge", "Proportional set size of the current player." },
+       { "motionwall_window_player_context_switches_total", "counter", "Voluntary and involuntary context switches of the window's players." },
+       { "motionwall_window_player_read_bytes_total", "counter", "Bytes read by the window's players." },
+   };
+   for (size_t m = 0; m < sizeof(window_metrics) / sizeof(window_metrics[0]); m++) {
+       metrics_append(buf, size, &len, "# HELP %s %s\n# TYPE %s %s\n", window_metrics[m].name,
+                      window_metrics[m].help, window_metrics[m].name, window_metrics[m].type);
+       for (int i = 0; config.windows && i < config.window_count; i++) {
+           window_info *win = &config.windows[i];
+           const char *monitor = (win->monitor_id >= 0 && win->monitor_id < config.monitors.count) ?
+                                 config.monitors.monitors[win->monitor_id].name : "";
+           double value = 0;
+           switch (m) {
+               case 0: value = win->player_restarts; break;
+               case 1: value = win->started_ms > 0 ? now_s - win->started_ms / 1000.0 : 0; break;
+               case 2: value = win->delivered_fps; break;
+               case 3: value = win->drop_ratio; break;
+               case 4: value = win->quality_level; break;
+               case 5: value = win->paused ? 1 : 0; break;
+               case 6: value = win->usage.cpu_seconds; break;
+               case 7: value = win->player_active ? win->usage.rss_kb * 1024.0 : 0; break;
+               case 8: value = win->player_active ? win->usage.pss_kb * 1024.0 : 0; break;
+               case 9: value = win->usage.voluntary_switches + win->usage.involuntary_switches; break;
+               case 10: value = win->usage.read_bytes; break;
+           }
+           metrics_append(buf, size, &len, "%s{window=\"%d\",monitor=\"%s\"} %g\n",
+                          window_metrics[m].name, i, monitor, value);
+       }
+   }
+
+   metrics_append(buf, size, &len,
+       "# HELP motionwall_item_cpu_seconds_total CPU time players spent on each file.\n"
+       "# TYPE motionwall_item_cpu_seconds_total counter\n"
+       "# HELP motionwall_item_play_seconds_total Unpaused playback time measured for each file.\n"
+       "# TYPE motionwall_item_play_seconds_total counter\n");
+   for (int i = 0; i < item_cost_count; i++) {
+       // Comillas y barras invertidas no pueden ir sin escapar en una etiqueta
+       char label[512];
+       size_t n = 0;
+       for (const char *c = item_costs[i].path; *c && n < sizeof(label) - 3; c++) {
+           if (*c == '"' || *c == '\\') label[n++] = '\\';
+           label[n++] = *c == '\n' ? ' ' : *c;
+       }
+       label[n] = '\0';
+       metrics_append(buf, size, &len, "motionwall_item_cpu_seconds_total{path=\"%s\"} %.3f\n"
+                      "motionwall_item_play_seconds_total{path=\"%s\"} %.3f\n",
+                      label, item_costs[i].usage.cpu_seconds, label, item_costs[i].usage.play_seconds);
+   }
+   return len;
+}
+
+// Responder y cerrar sin bloquear: lo que no quepa en el buffer del socket
+// se pierde antes que parar el bucle principal por un cliente lento
+static void answer_metrics_client(int client, bool http) {
+   static char body[METRICS_BUFFER_SIZE];
+   size_t body_len = format_metrics(body, sizeof(body));
+
+   if (http) {
+       char header[160];
+       int n = snprintf(header, sizeof(header),
+                        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+       if (send(client, header, n, MSG_NOSIGNAL | MSG_DONTWAIT) != n) {
+           close(client);
+           return;
+       }
+   }
+   for (size_t sent = 0; sent < body_len; ) {
+       ssize_t n = send(client, body + sent, body_len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+       if (n <= 0) break;
+       sent += n;
+   }
+   close(client);
+}
+
+static void drop_metrics_client(int index) {
+   unwatch_fd(metrics_clients[index].fd);
+   metrics_clients[index] = metrics_clients[--metrics_client_count];
+}
+
+// El cliente habló: si es una petición HTTP (curl --unix-socket) va con cabecera
+static void handle_metrics_request(int fd, short revents) {
+   (void)revents;
+   for (int i = 0; i < metrics_client_count; i++) {
+       if (metrics_clients[i].fd != fd) continue;
+       char request[512];
+       ssize_t n = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT);
+       if (n < 0 && errno == EAGAIN) return;
+       drop_metrics_client(i);
+       answer_metrics_client(fd, n >= 4 && strncmp(request, "GET ", 4) == 0);
+       return;
+   }
+}
+
+// Una conexión al socket de métricas: no se espera aquí a la petición, el
+// bucle principal vigila el cliente hasta METRICS_REQUEST_WAIT_MS
+static void handle_metrics_client(int fd, short revents) {
+   (void)revents;
+   int client = accept(fd, NULL, NULL);
+   if (client < 0) return;
+   fcntl(client, F_SETFD, FD_CLOEXEC);
+   fcntl(client, F_SETFL, O_NONBLOCK);
+
+   if (metrics_client_count >= METRICS_MAX_CLIENTS ||
+       !watch_fd(client, POLLIN, handle_metrics_request)) {
+       answer_metrics_client(client, false);
+       return;
+   }
+   metrics_clients[metrics_client_count].fd = client;
+   metrics_clients[metrics_client_count].deadline_ms = monotonic_ms() + METRICS_REQUEST_WAIT_MS;
+   metrics_client_count++;
+}
+
+// Clientes que no mandaron nada (socat, nc -U): texto plano. Devuelve el
+// próximo plazo pendiente, o -1
+static long long expire_metrics_clients(long long now_ms) {
+   long long next = -1;
+   for (int i = 0; i < metrics_client_count; ) {
+       if (metrics_clients[i].deadline_ms <= now_ms) {
+           int client = metrics_clients[i].fd;
+           drop_metrics_client(i);
+           answer_metrics_client(client, false);
+           continue;
+       }
+       if (next < 0 || metrics_clients[i].deadline_ms < next) next = metrics_clients[i].deadline_ms;
+       i++;
+   }
+   return next;
+}
+
+// Directorio para los sockets: $XDG_RUNTIME_DIR o, sin él, /tmp/motionwall-$UID
+// creado con 0700. Se comprueba que es nuestro y privado antes de usarlo, para
+// no borrar ni crear nada en una ruta que otro usuario haya preparado
+static bool private_runtime_dir(char *buf, size_t size) {
+   const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+   if (runtime_dir && runtime_dir[0]) {
+       return snprintf(buf, size, "%s", runtime_dir) < (int)size;
+   }
+   if (snprintf(buf, size, "/tmp/" NAME "-%d", (int)getuid()) >= (int)size) return false;
+   if (mkdir(buf, 0700) != 0 && errno != EEXIST) return false;
+
+   struct stat st;
+   if (lstat(buf, &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+       (st.st_mode & 0077) != 0) {
+       fprintf(stderr, NAME ": Warning: %s is not a private directory of ours, "
+               "sockets disabled (set XDG_RUNTIME_DIR)\n", buf);
+       return false;
+   }
+   return true;
+}
+
+// Socket de métricas en el directorio privado del usuario
+static void init_metrics_server(void) {
+   if (!config.metrics) return;
+
+   char dir[80];  // Con el nombre del socket cabe en sun_path
+   if (!private_runtime_dir(dir, sizeof(dir))) return;
+   snprintf(metrics_path, sizeof(metrics_path), "%s/" NAME "-metrics.sock", dir);
+
+   metrics_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (metrics_fd < 0) return;
+   fcntl(metrics_fd, F_SETFD, FD_CLOEXEC);
+   fcntl(metrics_fd, F_SETFL, O_NONBLOCK);
+
+   // El lock de instancia garantiza que un socket existente es de una ejecución anterior
+   unlink(metrics_path);
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   memcpy(addr.sun_path, metrics_path, sizeof(addr.sun_path));
+   mode_t old_mask = umask(0077);
+   bool ok = bind(metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+             listen(metrics_fd, 4) == 0 && watch_fd(metrics_fd, POLLIN, handle_metrics_client);
+   umask(old_mask);
+
+   if (!ok) {
+       LOG_DEBUG(SUBSYS_CORE, "metrics socket: %s\n", strerror(errno));
+       close(metrics_fd);
+       metrics_fd = -1;
+       return;
+   }
+   LOG_DEBUG(SUBSYS_CORE, "Serving metrics on %s\n", metrics_path);
+}
+
+static void shutdown_metrics_server(void) {
+   while (metrics_client_count > 0) {
+       int client = metrics_clients[0].fd;
+       drop_metrics_client(0);
+       close(client);
+   }
+   if (metrics_fd < 0) return;
+   unwatch_fd(metrics_fd);
+   close(metrics_fd);
+   metrics_fd = -1;
+   unlink(metrics_path);
+}
+
+// Ventanas a las que va una orden: todas, o las del monitor (nombre de salida
+// o número); false si el monitor no existe
+static bool control_targets(const char *monitor, bool *targets) {
+   bool any = false;
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       targets[i] = true;
+       if (monitor) {
+           const char *name = (win->monitor_id >= 0 && win->monitor_id < config.monitors.count) ?
+                              config.monitors.monitors[win->monitor_id].name : "";
+           char *end;
+           long index = strtol(monitor, &end, 10);
+           targets[i] = strcmp(name, monitor) == 0 || (*end == '\0' && index == win->monitor_id);
+       }
+       any |= targets[i];
+   }
+   return any;
+}
+
+static void control_reply(char *reply, size_t size, size_t *len, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+static void control_reply(char *reply, size_t size, size_t *len, const char *fmt, ...) {
+   if (*len >= size) return;
+   va_list ap;
+   va_start(ap, fmt);
+   int n = vsnprintf(reply + *len, size - *len, fmt, ap);
+   va_end(ap);
+   if (n > 0) *len = (*len + n < size) ? *len + n : size;
+}
+
+// Estado del daemon y de cada ventana, una línea por ventana
+static void control_status(char *reply, size_t size, size_t *len) {
+   static const char *engine_names[] = { "player", "gif", "loop", "static", "slideshow", "procedural" };
+   static const char *pause_names[] = { "covered", "blanked", "battery", "pressure", "user" };
+
+   control_reply(reply, size, len, "pid %d\nprofile %s\nplaylist %d/%d %s\npsi %d\nbattery %s\n",
+                 (int)getpid(), config.profile, config.media_playlist.current + 1, config.media_playlist.count,
+                 config.media_playlist.count > 0 ? config.media_playlist.paths[config.media_playlist.current] : "",
+                 psi_level, on_battery ? "yes" : "no");
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       const char *monitor = (win->monitor_id >= 0 && win->monitor_id < config.monitors.count) ?
+                             config.monitors.monitors[win->monitor_id].name : "-";
+       int item = win->playlist_item >= 0 ? win->playlist_item : config.media_playlist.current;
+
+       char paused[64] = "";
+       size_t n = 0;
+       for (int r = 0; r < 5; r++) {
+           if (win->pause_reasons & (1u << r)) {
+               n += snprintf(paused + n, sizeof(paused) - n, "%s%s", n ? "," : "", pause_names[r]);
+           }
+       }
+       control_reply(reply, size, len, "window %d monitor %s engine %s pid %d profile %s fps %.1f paused %s item %s\n",
+                     i, monitor, engine_names[win->engine], (int)win->player_pid,
+                     win->profile ? win->profile->name : "-", win->delivered_fps, n ? paused : "no",
+                     config.media_playlist.count > 0 ? config.media_playlist.paths[item] : "");
+   }
+}
+
+// Releer el directorio o patrón de la lista. Si el elemento actual sigue en
+// ella no se reinicia nada; si desapareció, las ventanas pasan al primero
+static bool control_reload(void) {
+   char current[MAX_PATH];
+   strncpy(current, config.media_playlist.paths[config.media_playlist.current], sizeof(current) - 1);
+   current[sizeof(current) - 1] = '\0';
+
+   int old_count = config.media_playlist.count, old_current = config.media_playlist.current;
+   create_playlist(playlist_source);
+   if (config.media_playlist.count == 0) {
+       // Sin entradas nuevas no se sobrescribió ninguna ruta: la lista vieja sigue ahí
+       config.media_playlist.count = old_count;
+       config.media_playlist.current = old_current;
+       return false;
+   }
+   playlist_history_count = 0;
+
+   bool found = false;
+   for (int i = 0; i < config.media_playlist.count; i++) {
+       if (strcmp(config.media_playlist.paths[i], current) == 0) {
+           config.media_playlist.current = i;
+           found = true;
+           break;
+       }
+   }
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       if (found && win->playlist_item < 0) continue;
+       win->playlist_item = -1;
+       terminate_player(i);
+       start_media_player(i);
+   }
+   return true;
+}
+
+// Ejecutar una orden y escribir la respuesta
+static void control_execute(char *request, char *reply, size_t size, size_t *len) {
+   char *argv[4] = { NULL };
+   int argc = 0;
+   for (char *tok = strtok(request, " \t\r\n"); tok && argc < 4; tok = strtok(NULL, " \t\r\n")) {
+       argv[argc++] = tok;
+   }
+   if (argc == 0) {
+       control_reply(reply, size, len, "error: empty command\n");
+       return;
+   }
+
+   const char *cmd = argv[0];
+   bool targets[MAX_MONITORS] = { false };
+   const char *monitor = NULL;
+   if (strcmp(cmd, "set-profile") == 0) {
+       monitor = argc > 2 ? argv[2] : NULL;
+   } else {
+       monitor = argc > 1 ? argv[1] : NULL;
+   }
+   bool windowed = strcmp(cmd, "next") == 0 || strcmp(cmd, "prev") == 0 || strcmp(cmd, "pause") == 0 ||
+                   strcmp(cmd, "resume") == 0 || strcmp(cmd, "set-profile") == 0;
+   if (windowed && config.window_count > MAX_MONITORS) {
+       control_reply(reply, size, len, "error: too many windows\n");
+       return;
+   }
+   if (windowed && monitor && !control_targets(monitor, targets)) {
+       control_reply(reply, size, len, "error: no window on monitor '%s'\n", monitor);
+       return;
+   }
+   if (windowed && !monitor) control_targets(NULL, targets);
+
+   LOG_INFO(SUBSYS_CORE, "Control command: %s%s%s\n", cmd, monitor ? " " : "", monitor ? monitor : "");
+
+   if (strcmp(cmd, "next") == 0 || strcmp(cmd, "prev") == 0) {
+       int direction = strcmp(cmd, "prev") == 0 ? -1 : 1;
+       if (config.media_playlist.count <= 1) {
+           control_reply(reply, size, len, "error: playlist has a single item\n");
+           return;
+       }
+       if (!monitor) {
+           // En el bucle principal, que además reinicia el temporizador de la lista
+           control_playlist_step = direction;
+       } else {
+           int count = config.media_playlist.count;
+           for (int i = 0; i < config.window_count; i++) {
+               if (!targets[i]) continue;
+               window_info *win = &config.windows[i];
+               int item = win->playlist_item >= 0 ? win->playlist_item : config.media_playlist.current;
+               if (direction < 0) {
+                   item = (item + count - 1) % count;
+               } else {
+                   item = config.media_playlist.shuffle ? rand() % count : (item + 1) % count;
+               }
+               win->playlist_item = item;
+               terminate_player(i);
+               start_media_player(i);
+           }
+       }
+       control_reply(reply, size, len, "ok\n");
+   } else if (strcmp(cmd, "pause") == 0 || strcmp(cmd, "resume") == 0) {
+       for (int i = 0; i < config.window_count; i++) {
+           if (targets[i]) set_pause_reason(i, PAUSE_USER, strcmp(cmd, "pause") == 0);
+       }
+       control_reply(reply, size, len, "ok\n");
+   } else if (strcmp(cmd, "reload") == 0) {
+       if (!control_reload()) {
+           control_reply(reply, size, len, "error: no media found in %s\n", playlist_source);
+           return;
+       }
+       control_reply(reply, size, len, "ok\n%d items\n", config.media_playlist.count);
+   } else if (strcmp(cmd, "set-profile") == 0) {
+       if (argc < 2 || !find_profile(argv[1])) {
+           control_reply(reply, size, len, "error: unknown profile '%s'\n", argc > 1 ? argv[1] : "");
+           return;
+       }
+       if (monitor) {
+           for (int i = 0; i < config.window_count; i++) {
+               window_info *win = &config.windows[i];
+               if (!targets[i] || win->monitor_id < 0 || win->monitor_id >= config.monitors.count) continue;
+               monitor_override *mo = find_monitor_override(config.monitors.monitors[win->monitor_id].name, true);
+               if (mo) strcpy(mo->profile, argv[1]);
+           }
+       } else {
+           strcpy(config.profile, argv[1]);
+       }
+       apply_profile_change();
+       control_reply(reply, size, len, "ok\n");
+   } else if (strcmp(cmd, "log") == 0) {
+       int level = argc > 1 ? parse_log_level(argv[1]) : -1;
+       if (level < 0 || (argc > 2 && !parse_log_subsystems(argv[2]))) {
+           control_reply(reply, size, len, "error: usage: log error|warn|info|debug|trace [SUBSYSTEMS]\n");
+           return;
+       }
+       log_level_setting = level;
+       control_reply(reply, size, len, "ok\n");
+   } else if (strcmp(cmd, "status") == 0) {
+       control_reply(reply, size, len, "ok\n");
+       control_status(reply, size, len);
+   } else {
+       control_reply(reply, size, len, "error: unknown command '%s'\n", cmd);
+   }
+}
+
+// Una conexión: leer una línea, ejecutarla, responder y cerrar
+// Ejecutar la orden y contestar sin bloquear, como las métricas
+static void answer_control_client(int client, char *request) {
+   static char reply[MOTIONWALL_CONTROL_REPLY_MAX];
+   size_t len = 0;
+   control_execute(request, reply, sizeof(reply), &len);
+
+   for (size_t sent = 0; sent < len; ) {
+       ssize_t n = send(client, reply + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+       if (n <= 0) break;
+       sent += n;
+   }
+   close(client);
+}
+
+static void drop_control_client(int index) {
+   unwatch_fd(control_clients[index].fd);
+   control_clients[index] = control_clients[--control_client_count];
+}
+
+// Llegó parte de la línea: se ejecuta cuando está entera (o llena el buffer,
+// o el cliente cerró su lado)
+static void handle_control_request(int fd, short revents) {
+   (void)revents;
+   for (int i = 0; i < control_client_count; i++) {
+       if (control_clients[i].fd != fd) continue;
+       char *request = control_clients[i].request;
+       size_t got = control_clients[i].length;
+       ssize_t n = recv(fd, request + got, sizeof(control_clients[i].request) - 1 - got, MSG_DONTWAIT);
+       if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+       if (n < 0) {
+           drop_control_client(i);
+           close(fd);
+           return;
+       }
+       got += n;
+       control_clients[i].length = got;
+       if (n > 0 && got < sizeof(control_clients[i].request) - 1 && !memchr(request, '\n', got)) return;
+
+       char line[MOTIONWALL_CONTROL_REQUEST_MAX];
+       memcpy(line, request, got);
+       line[got] = '\0';
+       drop_control_client(i);
+       answer_control_client(fd, line);
+       return;
+   }
+}
+
+// Una conexión al socket de control: la línea se recoge desde el bucle
+// principal, con un plazo total para que un cliente lento no lo frene
+static void handle_control_client(int fd, short revents) {
+   (void)revents;
+   int client = accept(fd, NULL, NULL);
+   if (client < 0) return;
+   fcntl(client, F_SETFD, FD_CLOEXEC);
+   fcntl(client, F_SETFL, O_NONBLOCK);
+
+   if (control_client_count >= CONTROL_MAX_CLIENTS ||
+       !watch_fd(client, POLLIN, handle_control_request)) {
+       close(client);
+       return;
+   }
+   control_clients[control_client_count].fd = client;
+   control_clients[control_client_count].deadline_ms = monotonic_ms() + CONTROL_REQUEST_WAIT_MS;
+   control_clients[control_client_count].length = 0;
+   control_client_count++;
+}
+
+// Cerrar las conexiones que no completaron su línea a tiempo. Devuelve el
+// próximo plazo pendiente, o -1
+static long long expire_control_clients(long long now_ms) {
+   long long next = -1;
+   for (int i = 0; i < control_client_count; ) {
+       if (control_clients[i].deadline_ms <= now_ms) {
+           int client = control_clients[i].fd;
+           drop_control_client(i);
+           close(client);
+           continue;
+       }
+       if (next < 0 || control_clients[i].deadline_ms < next) next = control_clients[i].deadline_ms;
+       i++;
+   }
+   return next;
+}
+
+// Socket de control junto al de métricas (solo para el usuario)
+static void init_control_server(void) {
+   if (!config.control) return;
+
+   // Mismo directorio privado que las métricas (lo crea si hace falta)
+   char dir[80];
+   if (!private_runtime_dir(dir, sizeof(dir))) return;
+   motionwall_control_path(control_path, sizeof(control_path));
+   control_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (control_fd < 0) return;
+   fcntl(control_fd, F_SETFD, FD_CLOEXEC);
+   fcntl(control_fd, F_SETFL, O_NONBLOCK);
+
+   unlink(control_path);
+   struct sockaddr_un addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   memcpy(addr.sun_path, control_path, sizeof(addr.sun_path));
+   mode_t old_mask = umask(0077);
+   bool ok = bind(control_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+             listen(control_fd, 4) == 0 && watch_fd(control_fd, POLLIN, handle_control_client);
+   umask(old_mask);
+
+   if (!ok) {
+       LOG_DEBUG(SUBSYS_CORE, "control socket: %s\n", strerror(errno));
+       close(control_fd);
+       control_fd = -1;
+       return;
+   }
+   LOG_DEBUG(SUBSYS_CORE, "Accepting commands on %s\n", control_path);
+}
+
+static void shutdown_control_server(void) {
+   while (control_client_count > 0) {
+       int client = control_clients[0].fd;
+       drop_control_client(0);
+       close(client);
+   }
+   if (control_fd < 0) return;
+   unwatch_fd(control_fd);
+   close(control_fd);
+   control_fd = -1;
+   unlink(control_path);
+}
+
+// Todo lo que fija el arranque de la ventana: si cambia, hay que reiniciarla
+// FNV-1a de un texto completo, separado del siguiente por un 0
+static uint64_t signature_mix(uint64_t hash, const char *text) {
+   do {
+       hash = (hash ^ (uint8_t)*text) * 1099511628211ULL;
+   } while (*text++);
+   return hash;
+}
+
+static uint64_t window_launch_signature(int window_index) {
+   window_info *win = &config.windows[window_index];
+   const char *monitor = (win->monitor_id >= 0 && win->monitor_id < config.monitors.count) ?
+                         config.monitors.monitors[win->monitor_id].name : NULL;
+   player_sched ps;
+   resolve_player_sched(monitor, &ps);
+   char filter[sizeof(win->output_filter)];
+   build_output_filter(window_index, strstr(config.media_player, "mpv") != NULL, filter, sizeof(filter));
+
+   // Los textos se mezclan enteros: player_args puede ser largo y un
+   // cambio al final también cuenta
+   uint64_t hash = 1469598103934665603ULL;
+   hash = signature_mix(hash, config.media_player);
+   hash = signature_mix(hash, config.player_args);
+   hash = signature_mix(hash, resolve_window_profile(window_index)->name);
+   hash = signature_mix(hash, filter);
+
+   char numbers[256 + CPU_MASK_WORDS * 20];
+   size_t len = snprintf(numbers, sizeof(numbers), "%d|%d:%d|%d:%d:%d|%d:%d|%d:%d:%d|%d:%d:%d:%d",
+                         window_decoder_threads(window_index),
+                         config.native_gif, config.gif_memory_mb,
+                         config.loop_cache, config.loop_cache_mb, config.loop_cache_max_seconds,
+                         config.slideshow, config.slideshow_fade_ms,
+                         config.generator_fps, config.generator_scale, config.generator_threads,
+                         ps.policy, ps.nice, ps.ioprio, ps.set_cpus);
+   for (int w = 0; ps.set_cpus && w < CPU_MASK_WORDS && len < sizeof(numbers); w++) {
+       len += snprintf(numbers + len, sizeof(numbers) - len, ":%lx", ps.cpus[w]);
+   }
+   return signature_mix(hash, numbers);
+}
+
+// Releer los archivos de configuración y volver a aplicar la línea de
+// comandos encima. Solo se reinician las ventanas cuyo arranque cambió; el
+// resto recibe los límites nuevos en caliente
+static void reload_configuration(void) {
+   TRACE_SCOPE("reload_configuration", -1);
+   uint64_t before[MAX_MONITORS];
+   int count = config.window_count < MAX_MONITORS ? config.window_count : MAX_MONITORS;
+   for (int i = 0; i < count; i++) {
+       before[i] = window_launch_signature(i);
+   }
+   bool multi_monitor = config.multi_monitor, logical = config.logical_monitors;
+   bool metrics = config.metrics, control = config.control;
+   bool stats = config.stats_segment, cgroups = config.cgroups, covered = config.pause_when_covered;
+   int log_level = config.log_level;
+   char log_subsystems[sizeof(config.log_subsystems)];
+   strcpy(log_subsystems, config.log_subsystems);
+
+   // Mismo orden que el arranque, desde cero: una opción borrada del archivo
+   // vuelve a su valor por defecto y los monitor.<OUTPUT>.* quitados desaparecen
+   config_defaults();
+   load_default_config();
+   command_line scratch = { .sink_file = "/dev/null" };
+   if (saved_argv) parse_arguments(saved_argc, saved_argv, &scratch);
+
+   if (multi_monitor != config.multi_monitor || logical != config.logical_monitors ||
+       metrics != config.metrics || control != config.control ||
+       stats != config.stats_segment || cgroups != config.cgroups) {
+       fprintf(stderr, NAME ": Warning: multi_monitor, logical_monitors, metrics, control, stats_segment "
+               "and cgroups take effect after a restart\n");
+   }
+   if (!find_profile(config.profile)) strcpy(config.profile, "balanced");
+   if (log_level != config.log_level) {
+       log_level_setting = (debug && config.log_level < LOG_LEVEL_DEBUG) ? LOG_LEVEL_DEBUG : config.log_level;
+   }
+   if (strcmp(log_subsystems, config.log_subsystems) != 0 && !parse_log_subsystems(config.log_subsystems)) {
+       fprintf(stderr, NAME ": Warning: Unknown log subsystem in '%s'\n", config.log_subsystems);
+   }
+
+   // Límites que se aplican sin reiniciar nada
+   parse_idle_levels(config.idle_levels);
+   for (int i = 0; i < config.window_count; i++) {
+       if (config.windows[i].cgroup_path[0] != '\0') prepare_window_cgroup(i);
+       if (!config.pause_when_covered) set_pause_reason(i, PAUSE_COVERED, false);
+   }
+   if (config.pause_when_covered != covered) {
+       select_occlusion_events();
+       update_occlusion();
+   }
+   update_battery_state();
+   update_power_state();
+
+   int restarted = 0;
+   for (int i = 0; i < count; i++) {
+       window_info *win = &config.windows[i];
+       uint64_t after = window_launch_signature(i);
+       if (before[i] == after) continue;
+       if (win->engine == ENGINE_PLAYER && !win->player_active) continue;
+
+       LOG_DEBUG(SUBSYS_CORE, "Window %d settings changed (%016llx -> %016llx), restarting\n", i,
+                 (unsigned long long)before[i], (unsigned long long)after);
+       terminate_player(i);
+       start_media_player(i);
+       restarted++;
+   }
+   fprintf(stderr, NAME ": Configuration reloaded, %d of %d window(s) restarted\n", restarted, config.window_count);
+}
+
+// SIGHUP: recargar fuera del handler
+static void config_reload_signal_handler(int sig) {
+   (void)sig;
+   config_reload_pending = 1;
+}
+
+// Eventos de inotify sobre los directorios de los archivos de configuración.
+// Los editores suelen escribir un temporal y renombrarlo: se mira el nombre
+static void handle_config_watch(int fd, short revents) {
+   (void)revents;
+   char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+   ssize_t n;
+   while ((n = read(fd, buf, sizeof(buf))) > 0) {
+       for (char *p = buf; p < buf + n; ) {
+           struct inotify_event *event = (struct inotify_event *)p;
+           p += sizeof(struct inotify_event) + event->len;
+           if (event->len == 0) continue;
+           for (int i = 0; i < config_source_count; i++) {
+               const char *slash = strrchr(config_sources[i], '/');
+               const char *base = slash ? slash + 1 : config_sources[i];
+               if (strcmp(base, event->name) == 0) config_reload_pending = 1;
+           }
+       }
+   }
+}
+
+// SIGHUP y vigilancia de los archivos de configuración
+static void init_config_watch(void) {
+   signal(SIGHUP, config_reload_signal_handler);
+
+   config_watch_fd = inotify_init();
+   if (config_watch_fd < 0) return;
+   fcntl(config_watch_fd, F_SETFD, FD_CLOEXEC);
+   fcntl(config_watch_fd, F_SETFL, O_NONBLOCK);
+
+   int watched = 0;
+   for (int i = 0; i < config_source_count; i++) {
+       char dir[MAX_PATH];
+       strcpy(dir, config_sources[i]);
+       char *slash = strrchr(dir, '/');
+       if (slash == dir) slash[1] = '\0';
+       else if (slash) *slash = '\0';
+       else strcpy(dir, ".");
+       // El mismo directorio devuelve el mismo watch: no hace falta deduplicar
+       if (inotify_add_watch(config_watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) >= 0) watched++;
+   }
+   if (watched == 0 || !watch_fd(config_watch_fd, POLLIN, handle_config_watch)) {
+       close(config_watch_fd);
+       config_watch_fd = -1;
+       return;
+   }
+   LOG_DEBUG(SUBSYS_CORE, "Watching %d configuration file(s) for changes\n", config_source_count);
+}
+
+// Crear y mapear el segmento; los lectores lo abren en solo lectura
+static void init_stats_segment(void) {
+   if (!config.stats_segment) return;
+
+   snprintf(stats_segment_path, sizeof(stats_segment_path), MOTIONWALL_STATS_PATH_FORMAT, (int)getuid());
+   // /dev/shm es de todos: nada de enlaces ni de archivos que otro haya dejado
+   int fd = open(stats_segment_path, O_CREAT | O_RDWR | O_NOFOLLOW | O_CLOEXEC, 0600);
+   if (fd < 0) {
+       LOG_DEBUG(SUBSYS_CORE, "stats segment: %s\n", strerror(errno));
+       return;
+   }
+   struct stat st;
+   if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+       fprintf(stderr, NAME ": Warning: %s is not our own regular file, stats segment disabled\n",
+               stats_segment_path);
+       close(fd);
+       return;
+   }
+   if (fchmod(fd, 0600) != 0 || ftruncate(fd, sizeof(motionwall_stats)) != 0) {
+       LOG_DEBUG(SUBSYS_CORE, "stats segment: %s\n", strerror(errno));
+       close(fd);
+       return;
+   }
+   void *map = mmap(NULL, sizeof(motionwall_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) return;
+
+   stats_segment = map;
+   memset(stats_segment, 0, sizeof(*stats_segment));
+   stats_segment->version = MOTIONWALL_STATS_VERSION;
+   stats_segment->pid = getpid();
+   stats_segment->start_ms = daemon_stats.start_ms;
+   // Magic al final: un lector nunca ve una cabecera a medias
+   __atomic_store_n(&stats_segment->magic, MOTIONWALL_STATS_MAGIC, __ATOMIC_RELEASE);
+
+   LOG_DEBUG(SUBSYS_CORE, "Publishing stats in %s\n", stats_segment_path);
+}
+
+// Copiar los contadores al segmento bajo el seqlock; sin llamadas al sistema
+// salvo para CPU y RSS, que se refrescan cada segundo
+static void publish_stats(long long now) {
+   static const char *engine_names[] = { "player", "gif", "loop", "static", "slideshow", "procedural" };
+   static long long last_publish_ms = 0, last_process_ms = 0;
+   static double cpu_seconds = 0;
+   static long rss_kb = 0;
+
+   if (!stats_segment || now - last_publish_ms < STATS_PUBLISH_MS) return;
+   last_publish_ms = now;
+   if (now - last_process_ms >= STATS_PROCESS_SAMPLE_MS) {
+       cpu_seconds = self_cpu_seconds();
+       rss_kb = self_rss_kb();
+       last_process_ms = now;
+   }
+
+   motionwall_stats *stats = stats_segment;
+   motionwall_stats_begin(stats);
+   stats->update_ms = now;
+   stats->cpu_seconds = cpu_seconds;
+   stats->rss_bytes = (int64_t)rss_kb * 1024;
+   stats->reconfigurations = daemon_stats.reconfigurations;
+   stats->reconfiguration_seconds = daemon_stats.reconfiguration_seconds;
+   stats->last_reconfiguration_seconds = daemon_stats.last_reconfiguration_seconds;
+   stats->transitions = daemon_stats.transitions;
+   stats->transition_seconds = daemon_stats.transition_seconds;
+   stats->last_transition_seconds = daemon_stats.last_transition_seconds;
+   stats->psi_level = psi_level;
+   stats->on_battery = on_battery;
+   stats->idle_fps_cap = idle_fps_cap;
+
+   int count = config.windows ? config.window_count : 0;
+   if (count > MOTIONWALL_STATS_WINDOWS) count = MOTIONWALL_STATS_WINDOWS;
+   stats->window_count = count;
+   for (int i = 0; i < count; i++) {
+       window_info *win = &config.windows[i];
+       motionwall_window_stats *out = &stats->windows[i];
+       const char *monitor = (win->monitor_id >= 0 && win->monitor_id < config.monitors.count) ?
+                             config.monitors.monitors[win->monitor_id].name : "";
+       strncpy(out->monitor, monitor, sizeof(out->monitor) - 1);
+       strncpy(out->engine, engine_names[win->engine], sizeof(out->engine) - 1);
+       strncpy(out->profile, win->profile ? win->profile->name : "", sizeof(out->profile) - 1);
+       out->player_pid = win->player_pid;
+       out->paused = win->paused;
+       out->pause_reasons = win->pause_reasons;
+       out->quality_level = win->quality_level;
+       out->fps_cap = window_fps_cap(win);
+       out->decoder_threads = win->decoder_threads;
+       out->player_restarts = win->player_restarts;
+       out->started_ms = win->started_ms;
+       out->delivered_fps = win->delivered_fps;
+       out->drop_ratio = win->drop_ratio;
+   }
+   motionwall_stats_end(stats);
+}
+
+static void shutdown_stats_segment(void) {
+   if (!stats_segment) return;
+   munmap(stats_segment, sizeof(*stats_segment));
+   stats_segment = NULL;
+   unlink(stats_segment_path);
+}
+
+// Reservar el anillo de la traza antes de leer la configuración, para que
+// su carga también quede registrada; configure_tracing lo suelta si al
+// final no hay --trace. calloc grande = páginas que no se tocan no ocupan
+static void init_tracing(void) {
+   trace.events = calloc(TRACE_RING_EVENTS, sizeof(trace_event));
+   trace.count = 0;
+}
+
+// Ya con configuración y argumentos: quedarse con la traza o soltarla
+static void configure_tracing(void) {
+   if (config.trace_file[0] == '\0') {
+       free(trace.events);
+       trace.events = NULL;
+       trace.count = 0;
+       return;
+   }
+   if (!trace.events) {
+       fprintf(stderr, NAME ": Warning: Could not allocate trace buffer\n");
+       return;
+   }
+   signal(SIGUSR2, trace_signal_handler);
+}
+
+// Escribir los spans del anillo como JSON de trace events de Chrome
+static void dump_trace(void) {
+   if (!trace.events) return;
+
+   char tmp_path[MAX_PATH + 8];
+   snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", config.trace_file);
+   FILE *file = fopen(tmp_path, "w");
+   if (!file) {
+       fprintf(stderr, NAME ": Warning: Could not write trace to %s\n", config.trace_file);
+       return;
+   }
+
+   unsigned long first = trace.count > TRACE_RING_EVENTS ? trace.count - TRACE_RING_EVENTS : 0;
+   int pid = (int)getpid();
+   fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+   fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+           "\"args\":{\"name\":\"" NAME "\"}}", pid, pid);
+   for (unsigned long n = first; n < trace.count; n++) {
+       trace_event *event = &trace.events[n % TRACE_RING_EVENTS];
+       fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d",
+               event->name, event->start_us, event->duration_us, pid, pid);
+       if (event->arg >= 0) {
+           fprintf(file, ",\"args\":{\"index\":%d}", event->arg);
+       }
+       fputc('}', file);
+   }
+   fprintf(file, "\n]}\n");
+
+   // Renombrar: quien lea el archivo nunca ve un volcado a medias
+   if (fclose(file) == 0 && rename(tmp_path, config.trace_file) == 0) {
+       fprintf(stderr, NAME ": Wrote %lu trace events to %s%s\n", trace.count - first, config.trace_file,
+               first > 0 ? " (oldest dropped)" : "");
+   } else {
+       unlink(tmp_path);
+   }
+}
+
+// SIGUSR2: el volcado escribe un archivo, fuera del handler
+static void trace_signal_handler(int sig) {
+   (void)sig;
+   trace_dump_pending = 1;
+}
+
+static const char *log_level_names[] = { "error", "warn", "info", "debug", "trace" };
+static const char *log_subsystem_names[] = { "core", "x11", "monitor", "player", "playlist", "engine", "power" };
+
+typedef struct {
+    unsigned char level, subsystem;
+    char text[LOG_MESSAGE_SIZE];
+} log_record;
+
+// Anillo de un hilo: head solo lo mueve el hilo dueño, tail el escritor
+typedef struct {
+    log_record records[LOG_RING_ENTRIES];
+    unsigned long head, tail;
+    unsigned long dropped;           // Anillo lleno o por encima del ritmo
+    unsigned long reported_dropped;  // Lo que el escritor ya avisó
+    long long rate_second[SUBSYS_COUNT];
+    int rate_count[SUBSYS_COUNT];
+} log_ring;
+
+static struct {
+    log_ring *rings[LOG_MAX_THREADS];
+    int ring_count;
+    pthread_mutex_t register_lock;   // Solo al registrar un hilo nuevo
+    sem_t wake;
+    pthread_t writer;
+    bool running;
+} logger = { .register_lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread log_ring *thread_log_ring = NULL;
+
+static log_ring *get_thread_log_ring(void) {
+   if (thread_log_ring) return thread_log_ring;
+
+   log_ring *ring = calloc(1, sizeof(log_ring));
+   if (!ring) return NULL;
+   pthread_mutex_lock(&logger.register_lock);
+   if (logger.ring_count < LOG_MAX_THREADS) {
+       logger.rings[logger.ring_count] = ring;
+       __atomic_store_n(&logger.ring_count, logger.ring_count + 1, __ATOMIC_RELEASE);
+       thread_log_ring = ring;
+   }
+   pthread_mutex_unlock(&logger.register_lock);
+   if (!thread_log_ring) free(ring);
+   return thread_log_ring;
+}
+
+static void log_write(log_level level, log_subsystem subsystem, const char *fmt, ...) {
+   va_list ap;
+   log_ring *ring = logger.running ? get_thread_log_ring() : NULL;
+
+   // Sin escritor (arranque, salida o demasiados hilos): directo a stderr
+   if (!ring) {
+       char text[LOG_MESSAGE_SIZE];
+       va_start(ap, fmt);
+       vsnprintf(text, sizeof(text), fmt, ap);
+       va_end(ap);
+       fprintf(stderr, NAME ": %s", text);
+       return;
+   }
+
+   // Límite de ritmo por subsistema; los errores siempre pasan
+   if (level > LOG_LEVEL_ERROR) {
+       long long second = monotonic_ms() / 1000;
+       if (ring->rate_second[subsystem] != second) {
+           ring->rate_second[subsystem] = second;
+           ring->rate_count[subsystem] = 0;
+       }
+       if (++ring->rate_count[subsystem] > LOG_RATE_PER_SECOND) {
+           __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+           return;
+       }
+   }
+
+   unsigned long head = ring->head;
+   if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_ENTRIES) {
+       __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+       return;
+   }
+
+   log_record *record = &ring->records[head % LOG_RING_ENTRIES];
+   record->level = level;
+   record->subsystem = subsystem;
+   va_start(ap, fmt);
+   vsnprintf(record->text, sizeof(record->text), fmt, ap);
+   va_end(ap);
+
+   __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+   sem_post(&logger.wake);
+}
+
+static void log_flush(char *buffer, size_t *len) {
+   for (size_t done = 0; done < *len; ) {
+       ssize_t n = write(STDERR_FILENO, buffer + done, *len - done);
+       if (n <= 0) break;
+       done += n;
+   }
+   *len = 0;
+}
+
+// Vaciar todos los anillos en lotes de write(); devuelve si había algo
+static bool log_drain(char *buffer) {
+   size_t len = 0;
+   bool any = false;
+   int count = __atomic_load_n(&logger.ring_count, __ATOMIC_ACQUIRE);
+
+   for (int i = 0; i < count; i++) {
+       log_ring *ring = logger.rings[i];
+       unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+       for (unsigned long tail = ring->tail; tail != head; tail++) {
+           log_record *record = &ring->records[tail % LOG_RING_ENTRIES];
+           if (len + LOG_MESSAGE_SIZE + 64 > LOG_WRITE_BUFFER) log_flush(buffer, &len);
+           int n = snprintf(buffer + len, LOG_WRITE_BUFFER - len, NAME ": %s%s", record->text,
+                            record->text[0] && record->text[strlen(record->text) - 1] == '\n' ? "" : "\n");
+           if (n > 0) len += n;
+           __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+           any = true;
+       }
+
+       unsigned long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+       if (dropped != ring->reported_dropped) {
+           if (len + 96 > LOG_WRITE_BUFFER) log_flush(buffer, &len);
+           len += snprintf(buffer + len, LOG_WRITE_BUFFER - len, NAME ": %lu log messages dropped\n",
+                           dropped - ring->reported_dropped);
+           ring->reported_dropped = dropped;
+       }
+   }
+   log_flush(buffer, &len);
+   return any;
+}
+
+// Hilo escritor: duerme en el semáforo, sin despertares si no hay mensajes
+static void *log_writer(void *arg) {
+   (void)arg;
+   char *buffer = malloc(LOG_WRITE_BUFFER);
+   if (!buffer) return NULL;
+
+   while (__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE)) {
+       while (sem_wait(&logger.wake) != 0 && errno == EINTR) {}
+       log_drain(buffer);
+   }
+   log_drain(buffer);
+   free(buffer);
+   return NULL;
+}
+
+// SIGRTMIN: más detalle; SIGRTMIN+1: menos
+static void log_level_signal_handler(int sig) {
+   if (sig == SIGRTMIN && log_level_setting < LOG_LEVEL_TRACE) {
+       log_level_setting = log_level_setting + 1;
+   } else if (sig == SIGRTMIN + 1 && log_level_setting > LOG_LEVEL_ERROR) {
+       log_level_setting = log_level_setting - 1;
+   }
+}
+
+static int parse_log_level(const char *name) {
+   for (int i = 0; i <= LOG_LEVEL_TRACE; i++) {
+       if (strcmp(name, log_level_names[i]) == 0) return i;
+   }
+   return -1;
+}
+
+// "player,power" o "all"; false si hay un nombre desconocido
+static bool parse_log_subsystems(const char *list) {
+   if (strcmp(list, "all") == 0) {
+       log_subsystem_mask = (1u << SUBSYS_COUNT) - 1;
+       return true;
+   }
+   char buf[256];
+   strncpy(buf, list, sizeof(buf) - 1);
+   buf[sizeof(buf) - 1] = '\0';
+
+   unsigned int mask = 0;
+   for (char *name = strtok(buf, ","); name; name = strtok(NULL, ",")) {
+       int found = -1;
+       for (int i = 0; i < SUBSYS_COUNT; i++) {
+           if (strcmp(name, log_subsystem_names[i]) == 0) found = i;
+       }
+       if (found < 0) return false;
+       mask |= 1u << found;
+   }
+   log_subsystem_mask = mask;
+   return true;
+}
+
+// Un hijo de fork no tiene hilo escritor: escribe directamente
+static void logger_after_fork(void) {
+   logger.running = false;
+   thread_log_ring = NULL;
+}
+
+// Arrancar el escritor (después de daemonizar: los hilos no sobreviven a fork)
+static void init_logger(void) {
+   if (sem_init(&logger.wake, 0, 0) != 0) return;
+   logger.running = true;
+   if (pthread_create(&logger.writer, NULL, log_writer, NULL) != 0) {
+       logger.running = false;
+       sem_destroy(&logger.wake);
+       return;
+   }
+   pthread_atfork(NULL, NULL, logger_after_fork);
+   signal(SIGRTMIN, log_level_signal_handler);
+   signal(SIGRTMIN + 1, log_level_signal_handler);
+}
+
+// Vaciar lo pendiente y volver a escribir directamente
+static void shutdown_logger(void) {
+   if (!logger.running) return;
+   __atomic_store_n(&logger.running, false, __ATOMIC_RELEASE);
+   sem_post(&logger.wake);
+   pthread_join(logger.writer, NULL);
+   sem_destroy(&logger.wake);
+}
+
+// Repintar ventanas de motores internos tras un Expose
+static void handle_expose_event(XExposeEvent *event) {
+   if (event->count != 0) return;
+
+   for (int i = 0; i < config.window_count; i++) {
+       window_info *win = &config.windows[i];
+       if (win->window != event->window) continue;
+
+       if (win->engine == ENGINE_GIF) {
+           draw_gif_frame(win);
+       } else if (win->engine == ENGINE_LOOP_CACHE && win->loop) {
+           win->loop->sink.ops->present(&win->loop->sink, 0, (int)win->height - 1);
+       } else if (win->engine == ENGINE_PROCEDURAL && win->procedural) {
+           present_procedural_frame(win);
+       }
+   }
+}
+
+// Dormir hasta que llegue un evento X o venza el próximo frame
+static void wait_for_activity(long long next_deadline) {
+   bool all_paused = config.window_count > 0;
+   for (int i = 0; i < config.window_count; i++) {
+       if (!config.windows[i].paused) all_paused = false;
+   }
+   int timeout = (all_windows_static() || all_paused) ? STATIC_IDLE_TICK_MS : MAIN_LOOP_TICK_MS;
+
+   if (next_deadline >= 0) {
+       long long until = next_deadline - monotonic_ms();
+       if (until < timeout) timeout = until > 0 ? (int)until : 0;
+   }
+
+   if (!display) {
+       usleep(timeout * 1000);
+       return;
+   }
+
+   // Eventos ya encolados en Xlib no despiertan a poll()
+   if (XQLength(display) > 0) return;
+
+   struct pollfd pfds[MAX_WATCHED_FDS + 1];
+   pfds[0].fd = ConnectionNumber(display);
+   pfds[0].events = POLLIN;
+   for (int i = 0; i < watched_fd_count; i++) {
+       pfds[i + 1].fd = watched_fds[i].fd;
+       pfds[i + 1].events = watched_fds[i].events;
+       pfds[i + 1].revents = 0;
+   }
+
+   int count = watched_fd_count;
+   if (poll(pfds, count + 1, timeout) <= 0) return;
+
+   // Un handler puede dejar de vigilar su descriptor: buscarlo por fd
+   for (int i = 0; i < count; i++) {
+       if (pfds[i + 1].revents == 0) continue;
+       for (int j = 0; j < watched_fd_count; j++) {
+           if (watched_fds[j].fd == pfds[i + 1].fd) {
+               watched_fds[j].handler(pfds[i + 1].fd, pfds[i + 1].revents);
+               break;
+           }
+       }
+   }
+}
+
+// Añadir un descriptor a los que espera el bucle principal
+static bool watch_fd(int fd, short events, fd_handler handler) {
+   if (fd < 0 || watched_fd_count >= MAX_WATCHED_FDS) return false;
+   watched_fds[watched_fd_count].fd = fd;
+   watched_fds[watched_fd_count].events = events;
+   watched_fds[watched_fd_count].handler = handler;
+   watched_fd_count++;
+   return true;
+}
+
+static void unwatch_fd(int fd) {
+   for (int i = 0; i < watched_fd_count; i++) {
+       if (watched_fds[i].fd == fd) {
+           watched_fds[i] = watched_fds[--watched_fd_count];
+           return;
+       }
+   }
+}
+
+// Start media player for specific window - VERSIÓN MEJORADA
+// Arrancar el elemento de la ventana: el suyo propio si "next MONITOR" la
+// separó de la lista, si no el actual. Así los reinicios por salud, perfil o
+// hotplug conservan lo que la ventana estaba mostrando
+static void start_media_player(int window_index) {
+   if (window_index < 0 || window_index >= config.window_count) return;
+   window_info *win = &config.windows[window_index];
+   int shared = config.media_playlist.current;
+   if (win->playlist_item >= 0 && win->playlist_item < config.media_playlist.count) {
+       config.media_playlist.current = win->playlist_item;
+   }
+   launch_media_player(window_index);
+   config.media_playlist.current = shared;
+
+   // terminate_player reanudó al anterior pero los motivos (pause del
+   // usuario, tapada, batería...) siguen: el nuevo arranca ya pausado
+   apply_pause_state(window_index);
+}
+
+static void launch_media_player(int window_index) {
+   TRACE_SCOPE("start_media_player", window_index);
+   if (window_index < 0 || window_index >= config.window_count) {
+       fprintf(stderr, NAME ": Error: Invalid window index %d\n", window_index);
+       return;
+   }
+
+   window_info *win = &config.windows[window_index];
+
+   // Verificar si ya hay un reproductor activo para esta ventana
+   if (win->player_active && win->player_pid > 0) {
+       if (is_process_healthy(win->player_pid)) {
+           LOG_DEBUG(SUBSYS_PLAYER, "Player already active for window %d (PID %d)\n",
+                     window_index, win->player_pid);
+           return; // Ya hay un reproductor saludable ejecutándose
+       } else {
+           // El proceso existe pero no está saludable, terminarlo
+           terminate_player(window_index);
+           usleep(500000); // 500ms para limpieza
+       }
+   }
+
+   if (config.media_playlist.count == 0) {
+       fprintf(stderr, NAME ": Error: No media files in playlist\n");
+       return;
+   }
+
+   if (win->window == None) {
+       fprintf(stderr, NAME ": Error: Invalid window for index %d\n", window_index);
+       return;
+   }
+
+   // Perfil de rendimiento del monitor (o el global); los motores internos
+   // también respetan su límite de fps
+   const performance_profile *profile = resolve_window_profile(window_index);
+   win->profile = profile;
+
+   // Fondos procedurales: no hay archivo, no hay reproductor al que volver
+   if (is_generator_item(config.media_playlist.paths[config.media_playlist.current])) {
+       ensure_window_mapped(win);
+       start_procedural_engine(window_index);
+       return;
+   }
+
+   bool image_item = is_image_item(config.media_playlist.paths[config.media_playlist.current]);
+
+   // Diapositivas: imagen desde la cache cruda con fundido en la ventana
+   if (image_item && config.slideshow) {
+       ensure_window_mapped(win);
+       if (start_slideshow_engine(window_index)) {
+           return;
+       }
+   }
+
+   // Imágenes fijas: pintarlas una vez en el pixmap raíz, sin ventana ni reproductor
+   if (image_item && !config.slideshow) {
+       if (start_static_engine(window_index)) {
+           return;
+       }
+       LOG_DEBUG(SUBSYS_PLAYER, "Could not render image in-process, falling back to %s\n",
+                 config.media_player);
+   }
+
+   // Volver a mostrar la ventana si el elemento anterior era una imagen fija
+   ensure_window_mapped(win);
+
+   // GIFs: decodificar una sola vez en el proceso en lugar de lanzar un reproductor
+   if (is_native_gif_item(config.media_playlist.paths[config.media_playlist.current])) {
+       if (start_gif_engine(window_index)) {
+           return;
+       }
+       LOG_DEBUG(SUBSYS_PLAYER, "Native GIF engine failed, falling back to %s\n", config.media_player);
+   }
+
+   // Clips cortos: primer loop decodificado por ffmpeg, el resto desde RAM
+   if (start_loop_cache_engine(window_index)) {
+       return;
+   }
+
+   char wid_arg[64];
+   char mpv_wid_arg[64];
+   char mpv_ipc_arg[160];
+   char threads_arg[64];
+   char drawable_arg[64];
+   char extra_args[sizeof(config.player_args)];
+   char *args[MAX_CMD_ARGS];
+   int argc = 0;
+
+   int ret = snprintf(wid_arg, sizeof(wid_arg), "0x%lx", win->window);
+   if (ret >= (int)sizeof(wid_arg)) {
+       fprintf(stderr, NAME ": Error: Window ID too long\n");
+       return;
+   }
+
+   // Build command line
+   args[argc++] = config.media_player;
+
+   // Hilos de decodificación: parte de un presupuesto común para toda la máquina
+   win->decoder_threads = window_decoder_threads(window_index);
+   win->item_pixels = current_item_pixels();
+   win->usage_item = find_item_usage(config.media_playlist.paths[config.media_playlist.current], true);
+   item_costs[win->usage_item].pixels = win->item_pixels;
+
+   // Fps y tamaño del monitor, antes de escalar (vlc no tiene equivalente)
+   bool output_filter = build_output_filter(window_index, strstr(config.media_player, "mpv") != NULL,
+                                            win->output_filter, sizeof(win->output_filter));
+
+   // Add player-specific arguments
+  win->ipc_path[0] = '\0';
+  win->applied_fps_cap = 0;
+  win->applied_reduced_res = false;
+  win->applied_cheap_scaler = false;
+  if (strstr(config.media_player, "mpv")) {
+      snprintf(mpv_wid_arg, sizeof(mpv_wid_arg), "--wid=0x%lx", win->window);
+      args[argc++] = mpv_wid_arg;
+
+      // Socket IPC para cambiar fps (y más) sin reiniciar el reproductor, en el
+      // directorio privado: el daemon se fía de lo que lee de él
+      char ipc_dir[64];  // Con pid y ventana cabe en sun_path
+      if (private_runtime_dir(ipc_dir, sizeof(ipc_dir))) {
+          snprintf(win->ipc_path, sizeof(win->ipc_path), "%s/" NAME "-%d-%d.sock",
+                   ipc_dir, (int)getpid(), window_index);
+          snprintf(mpv_ipc_arg, sizeof(mpv_ipc_arg), "--input-ipc-server=%s", win->ipc_path);
+          args[argc++] = mpv_ipc_arg;
+      }
+      args[argc++] = "--really-quiet";
+      args[argc++] = "--no-audio";
+      args[argc++] = "--loop-file=inf";
+      args[argc++] = "--panscan=1.0";
+      args[argc++] = "--keepaspect=no";
+      args[argc++] = "--no-input-default-bindings";
+      args[argc++] = "--no-osc";
+      args[argc++] = "--no-input-cursor";
+      args[argc++] = "--no-cursor-autohide";
+      for (int i = 0; i < 8 && profile->mpv[i]; i++) {
+          args[argc++] = (char *)profile->mpv[i];
+      }
+      snprintf(threads_arg, sizeof(threads_arg), "--vd-lavc-threads=%d", win->decoder_threads);
+      args[argc++] = threads_arg;
+      if (output_filter) {
+          args[argc++] = win->output_filter;
+      }
+      args[argc++] = "--no-terminal";
+      args[argc++] = "--no-config";
+  } else if (strstr(config.media_player, "mplayer")) {
+      args[argc++] = "-wid";
+      args[argc++] = wid_arg;
+      args[argc++] = "-nosound";
+      args[argc++] = "-quiet";
+      args[argc++] = "-vo";
+      args[argc++] = "xv";
+      args[argc++] = "-zoom";
+      args[argc++] = "-panscan";
+      args[argc++] = "1.0";
+      for (int i = 0; i < 8 && profile->mplayer[i]; i++) {
+          args[argc++] = (char *)profile->mplayer[i];
+      }
+      snprintf(threads_arg, sizeof(threads_arg), "threads=%d%s%s", win->decoder_threads,
+               profile->mplayer_lavdopts ? ":" : "",
+               profile->mplayer_lavdopts ? profile->mplayer_lavdopts : "");
+      args[argc++] = "-lavdopts";
+      args[argc++] = threads_arg;
+      if (output_filter) {
+          args[argc++] = "-vf";
+          args[argc++] = win->output_filter;
+      }
+      args[argc++] = "-fs";
+      if (config.media_playlist.loop) {
+          args[argc++] = "-loop";
+          args[argc++] = "0";
+      }
+  } else if (strstr(config.media_player, "vlc")) {
+      snprintf(drawable_arg, sizeof(drawable_arg), "--drawable-xid=0x%lx", win->window);
+
+      args[argc++] = "--intf";
+      args[argc++] = "dummy";
+      args[argc++] = "--no-video-title-show";
+      args[argc++] = "--no-audio";
+      args[argc++] = "--quiet";
+      args[argc++] = "--no-osd";
+      args[argc++] = "--no-spu";
+      args[argc++] = "--no-stats";
+      args[argc++] = "--no-snapshot-preview";
+      args[argc++] = "--vout";
+      args[argc++] = "x11";
+      args[argc++] = drawable_arg;
+      args[argc++] = "--no-embedded-video";
+      args[argc++] = "--video-on-top";
+      args[argc++] = "--fullscreen";
+      snprintf(threads_arg, sizeof(threads_arg), "--avcodec-threads=%d", win->decoder_threads);
+      args[argc++] = threads_arg;
+      for (int i = 0; i < 8 && profile->vlc[i]; i++) {
+          args[argc++] = (char *)profile->vlc[i];
+      }
+      if (config.media_playlist.loop) {
+          args[argc++] = "--loop";
+      }
+  }
+
+  // player_args al final: a igual opción gana la última, así que sobrescribe al perfil
+  strcpy(extra_args, config.player_args);
+  for (char *arg = strtok(extra_args, " \t"); arg && argc < MAX_CMD_ARGS - 2; arg = strtok(NULL, " \t")) {
+      args[argc++] = arg;
+  }
+
+  // Add current media file
+  if (argc < MAX_CMD_ARGS - 1) {
+      args[argc++] = config.media_playlist.paths[config.media_playlist.current];
+      args[argc] = NULL;
+  } else {
+      fprintf(stderr, NAME ": Error: Too many command arguments\n");
+      return;
+  }
+
+  // Debug: print the complete command line
+  if (log_enabled(LOG_LEVEL_DEBUG, SUBSYS_PLAYER)) {
+      char command_line[LOG_MESSAGE_SIZE];
+      size_t len = 0;
+      for (int i = 0; i < argc && len < sizeof(command_line); i++) {
+          len += snprintf(command_line + len, sizeof(command_line) - len, "%s ", args[i]);
+      }
+      log_write(LOG_LEVEL_DEBUG, SUBSYS_PLAYER, "Starting player for window %d: %s\n", window_index, command_line);
+  }
+
+  // Hoja cgroup propia con los límites configurados
+  bool in_cgroup = prepare_window_cgroup(window_index);
+  char cgroup_procs[MAX_PATH + 16];
+  snprintf(cgroup_procs, sizeof(cgroup_procs), "%s/cgroup.procs", win->cgroup_path);
+
+  // Clase de planificación, prioridad de E/S y afinidad del monitor
+  player_sched sched;
+  resolve_player_sched(win->monitor_id >= 0 && win->monitor_id < config.monitors.count ?
+                       config.monitors.monitors[win->monitor_id].name : NULL, &sched);
+
+  pid_t pid = fork();
+  if (pid == 0) {
+      // Child process
+      // Entrar en la hoja antes de exec: el reproductor nunca corre fuera de ella
+      if (in_cgroup) {
+          int fd = open(cgroup_procs, O_WRONLY);
+          if (fd >= 0) {
+              if (write(fd, "0", 1) < 0) {
+                  // Sin permiso: el reproductor corre sin límites
+              }
+              close(fd);
+          }
+      }
+      apply_player_sched(&sched);
+
+      // Redirigir stderr y stdout si no estamos en debug
+      if (!debug) {
+          int devnull = open("/dev/null", O_WRONLY);
+          if (devnull != -1) {
+              dup2(devnull, STDOUT_FILENO);
+              dup2(devnull, STDERR_FILENO);
+              close(devnull);
+          }
+      }
+
+      // Establecer nueva sesión para evitar señales del padre
+      setsid();
+
+      execvp(args[0], args);
+      perror(args[0]);
       _exit(2);
   } else if (pid > 0) {
       // Parent process - GESTIÓN MEJORADA
       win->player_pid = pid;
       win->player_active = true;
       win->player_start_time = time(NULL);
+      win->started_ms = monotonic_ms();
 
-      if (debug) {
-          fprintf(stderr, NAME ": Started %s (PID %d) for window %d with file: %s\n",
-                  config.media_player, pid, window_index,
-                  config.media_playlist.paths[config.media_playlist.current]);
-      }
+      LOG_DEBUG(SUBSYS_PLAYER, "Started %s (PID %d) for window %d with file: %s\n",
+                config.media_player, pid, window_index,
+                config.media_playlist.paths[config.media_playlist.current]);
   } else {
       perror("fork");
       win->player_pid = 0;
@@ -1184,37 +7909,120 @@ static void start_media_player(int window_index) {
 static void playlist_next(void) {
   if (config.media_playlist.count <= 1) return;
 
+  if (playlist_history_count == (int)(sizeof(playlist_history) / sizeof(playlist_history[0]))) {
+      memmove(playlist_history, playlist_history + 1, sizeof(playlist_history) - sizeof(playlist_history[0]));
+      playlist_history_count--;
+  }
+  playlist_history[playlist_history_count++] = config.media_playlist.current;
+
   if (config.media_playlist.shuffle) {
       config.media_playlist.current = rand() % config.media_playlist.count;
   } else {
       config.media_playlist.current = (config.media_playlist.current + 1) % config.media_playlist.count;
   }
 
-  if (debug) {
-      fprintf(stderr, NAME ": Switching to: %s\n",
-              config.media_playlist.paths[config.media_playlist.current]);
+  LOG_DEBUG(SUBSYS_PLAYLIST, "Switching to: %s\n",
+            config.media_playlist.paths[config.media_playlist.current]);
+}
+
+// Elemento anterior: el último mostrado, o el previo en orden
+static void playlist_prev(void) {
+  if (config.media_playlist.count <= 1) return;
+
+  if (playlist_history_count > 0) {
+      config.media_playlist.current = playlist_history[--playlist_history_count];
+  } else {
+      config.media_playlist.current = (config.media_playlist.current + config.media_playlist.count - 1) %
+                                      config.media_playlist.count;
   }
+
+  LOG_DEBUG(SUBSYS_PLAYLIST, "Switching back to: %s\n",
+            config.media_playlist.paths[config.media_playlist.current]);
 }
 
-// Signal handler
-static void signal_handler(int sig) {
-  if (debug) {
-      fprintf(stderr, NAME ": Received signal %d, cleaning up...\n", sig);
+// Cambiar al siguiente (o, con direction < 0, al anterior) elemento en todas
+// las ventanas. Las ventanas en modo diapositivas hacen el fundido en el
+// sitio, sin terminar nada ni esperar.
+static void switch_playlist_item(int direction) {
+  TRACE_SCOPE("switch_playlist_item", -1);
+  bool restart[MAX_MONITORS] = {false};
+  bool any_restart = false;
+  long long start_us = monotonic_us();
+
+  if (direction < 0) {
+      playlist_prev();
+  } else {
+      playlist_next();
+  }
+  const char *path = config.media_playlist.paths[config.media_playlist.current];
+
+  for (int i = 0; i < config.window_count && i < MAX_MONITORS; i++) {
+      window_info *win = &config.windows[i];
+      win->playlist_item = -1; // Todas vuelven a seguir la lista
+      if (win->engine == ENGINE_SLIDESHOW && config.slideshow && is_image_item(path) &&
+          slideshow_show_current(i)) {
+          continue;
+      }
+
+      // Terminar reproductores existentes de forma controlada
+      terminate_player(i);
+      restart[i] = true;
+      any_restart = true;
   }
+
+  if (any_restart) {
+      // Esperar antes de reiniciar
+      usleep(200000);
+      sleep(2);
+
+      // Reiniciar con nuevo medio
+      for (int i = 0; i < config.window_count && i < MAX_MONITORS; i++) {
+          if (restart[i]) {
+              start_media_player(i);
+              usleep(200000); // 200ms between starts
+          }
+      }
+  }
+
+  // Tener listos los siguientes elementos antes de que toque mostrarlos
+  prefetch_image_cache();
+  prefetch_media_probes();
+
+  // Hasta que el último reproductor (o fundido) arrancó
+  daemon_stats.last_transition_seconds = (monotonic_us() - start_us) / 1e6;
+  daemon_stats.transition_seconds += daemon_stats.last_transition_seconds;
+  daemon_stats.transitions++;
+}
+
+// Signal handler. Con el bucle principal en marcha solo se pide la salida:
+// poll() vuelve con EINTR y la limpieza (y el volcado de la traza) se hace
+// fuera del handler. Durante el arranque no hay bucle que lo recoja
+static void signal_handler(int sig) {
   running = false;
+  if (in_main_loop) return;
+  LOG_DEBUG(SUBSYS_CORE, "Received signal %d, cleaning up...\n", sig);
+  exiting_from_signal = 1;
   cleanup_and_exit();
 }
 
+// SIGUSR1: el cambio de perfil reinicia reproductores, fuera del handler
+static void profile_signal_handler(int sig) {
+  (void)sig;
+  profile_cycle_pending = 1;
+}
+
 // Cleanup and exit - VERSIÓN MEJORADA
 static void cleanup_and_exit(void) {
   running = false;
 
-  if (debug) {
-      fprintf(stderr, NAME ": Cleaning up...\n");
-  }
+  LOG_DEBUG(SUBSYS_CORE, "Cleaning up...\n");
+
+  // Cuánto se ahorró con las pausas, antes de que terminate_player las cierre
+  report_pause_savings();
 
   // Terminar todos los reproductores de forma controlada
   terminate_all_players();
+  release_player_cgroups();
 
   // Destruir todas las ventanas
   if (config.windows && display) {
@@ -1228,6 +8036,29 @@ static void cleanup_and_exit(void) {
       config.windows = NULL;
   }
 
+  // Detener los hilos de los generadores procedurales
+  shutdown_render_pool();
+
+  shutdown_psi_governor();
+  report_item_usage();
+  shutdown_metrics_server();
+  shutdown_control_server();
+  shutdown_stats_segment();
+  // Escribir un archivo desde un handler no es seguro: esa traza se pierde
+  if (!exiting_from_signal) dump_trace();
+
+  if (uevent_fd >= 0) {
+      unwatch_fd(uevent_fd);
+      close(uevent_fd);
+      uevent_fd = -1;
+  }
+
+  // Cerrar la conexión del fondo: el pixmap raíz queda retenido en el servidor
+  if (root_display) {
+      XCloseDisplay(root_display);
+      root_display = NULL;
+  }
+
   // Cerrar display X11
   if (display) {
       XCloseDisplay(display);
@@ -1242,15 +8073,27 @@ static void cleanup_and_exit(void) {
       lock_fd = -1;
   }
 
-  if (debug) {
-      fprintf(stderr, NAME ": Cleanup complete, exiting\n");
-  }
+  LOG_DEBUG(SUBSYS_CORE, "Cleanup complete, exiting\n");
+  shutdown_logger();
 
   exit(0);
 }
 
 // Configuration file support
 static void load_config_file(const char *config_path) {
+  TRACE_SCOPE("load_config_file", -1);
+
+  // Vigilar también archivos que aún no existen: crearlos los carga
+  bool known = false;
+  for (int i = 0; i < config_source_count; i++) {
+      if (strcmp(config_sources[i], config_path) == 0) known = true;
+  }
+  if (!known && config_source_count < (int)(sizeof(config_sources) / sizeof(config_sources[0]))) {
+      strncpy(config_sources[config_source_count], config_path, MAX_PATH - 1);
+      config_sources[config_source_count][MAX_PATH - 1] = '\0';
+      config_source_count++;
+  }
+
   FILE *file = fopen(config_path, "r");
   if (!file) return;
 
@@ -1281,8 +8124,108 @@ static void load_config_file(const char *config_path) {
           config.media_playlist.loop = (strcmp(value, "true") == 0);
       } else if (strcmp(key, "multi_monitor") == 0) {
           config.multi_monitor = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "logical_monitors") == 0) {
+          config.logical_monitors = (strcmp(value, "true") == 0);
       } else if (strcmp(key, "auto_resize") == 0) {
           config.auto_resize = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "native_gif") == 0) {
+          config.native_gif = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "gif_memory_mb") == 0) {
+          config.gif_memory_mb = atoi(value);
+      } else if (strcmp(key, "loop_cache") == 0) {
+          config.loop_cache = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "loop_cache_mb") == 0) {
+          config.loop_cache_mb = atoi(value);
+      } else if (strcmp(key, "image_cache_mb") == 0) {
+          config.image_cache_mb = atoi(value);
+      } else if (strcmp(key, "loop_cache_max_seconds") == 0) {
+          config.loop_cache_max_seconds = atoi(value);
+      } else if (strcmp(key, "slideshow") == 0) {
+          config.slideshow = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "slideshow_fade_ms") == 0) {
+          config.slideshow_fade_ms = atoi(value);
+      } else if (strcmp(key, "generator_fps") == 0) {
+          config.generator_fps = atoi(value);
+      } else if (strcmp(key, "generator_scale") == 0) {
+          config.generator_scale = atoi(value);
+      } else if (strcmp(key, "generator_threads") == 0) {
+          config.generator_threads = atoi(value);
+      } else if (strcmp(key, "pause_when_covered") == 0) {
+          config.pause_when_covered = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "pause_when_blanked") == 0) {
+          config.pause_when_blanked = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "battery_profile") == 0) {
+          strncpy(config.battery_profile, value, sizeof(config.battery_profile) - 1);
+          config.battery_profile[sizeof(config.battery_profile) - 1] = '\0';
+      } else if (strcmp(key, "battery_fps") == 0) {
+          config.battery_fps = atoi(value);
+      } else if (strcmp(key, "psi_governor") == 0) {
+          config.psi_governor = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "psi_fps") == 0) {
+          config.psi_fps = atoi(value);
+      } else if (strcmp(key, "player_args") == 0) {
+          strncpy(config.player_args, value, sizeof(config.player_args) - 1);
+          config.player_args[sizeof(config.player_args) - 1] = '\0';
+      } else if (strcmp(key, "profile") == 0) {
+          if (find_profile(value)) {
+              strcpy(config.profile, value);
+          } else {
+              fprintf(stderr, NAME ": Warning: Unknown profile '%s'\n", value);
+          }
+      } else if (strcmp(key, "decoder_threads") == 0) {
+          config.decoder_threads = atoi(value);
+      } else if (strcmp(key, "log_level") == 0) {
+          int level = parse_log_level(value);
+          if (level >= 0) config.log_level = level;
+      } else if (strcmp(key, "log_subsystems") == 0) {
+          strncpy(config.log_subsystems, value, sizeof(config.log_subsystems) - 1);
+          config.log_subsystems[sizeof(config.log_subsystems) - 1] = '\0';
+      } else if (strcmp(key, "trace_file") == 0) {
+          strncpy(config.trace_file, value, sizeof(config.trace_file) - 1);
+          config.trace_file[sizeof(config.trace_file) - 1] = '\0';
+      } else if (strcmp(key, "accounting_interval") == 0) {
+          config.accounting_interval = atoi(value);
+      } else if (strcmp(key, "control") == 0) {
+          config.control = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "stats_segment") == 0) {
+          config.stats_segment = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "metrics") == 0) {
+          config.metrics = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "match_output") == 0) {
+          config.match_output = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "player_sched") == 0) {
+          strncpy(config.player_sched, value, sizeof(config.player_sched) - 1);
+          config.player_sched[sizeof(config.player_sched) - 1] = '\0';
+      } else if (strcmp(key, "player_nice") == 0) {
+          config.player_nice = atoi(value);
+      } else if (strcmp(key, "player_ioprio") == 0) {
+          strncpy(config.player_ioprio, value, sizeof(config.player_ioprio) - 1);
+          config.player_ioprio[sizeof(config.player_ioprio) - 1] = '\0';
+      } else if (strcmp(key, "player_cpus") == 0) {
+          strncpy(config.player_cpus, value, sizeof(config.player_cpus) - 1);
+          config.player_cpus[sizeof(config.player_cpus) - 1] = '\0';
+      } else if (strncmp(key, "monitor.", 8) == 0) {
+          if (!parse_monitor_key(key, value)) {
+              fprintf(stderr, NAME ": Warning: Unknown config key '%s'\n", key);
+          }
+      } else if (strcmp(key, "cgroups") == 0) {
+          config.cgroups = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "cgroup_parent") == 0) {
+          strncpy(config.cgroup_parent, value, sizeof(config.cgroup_parent) - 1);
+          config.cgroup_parent[sizeof(config.cgroup_parent) - 1] = '\0';
+      } else if (strcmp(key, "cgroup_cpu_percent") == 0) {
+          config.cgroup_cpu_percent = atoi(value);
+      } else if (strcmp(key, "cgroup_cpu_weight") == 0) {
+          config.cgroup_cpu_weight = atoi(value);
+      } else if (strcmp(key, "cgroup_memory_high_mb") == 0) {
+          config.cgroup_memory_high_mb = atoi(value);
+      } else if (strcmp(key, "cgroup_memory_max_mb") == 0) {
+          config.cgroup_memory_max_mb = atoi(value);
+      } else if (strcmp(key, "adaptive_quality") == 0) {
+          config.adaptive_quality = (strcmp(value, "true") == 0);
+      } else if (strcmp(key, "idle_levels") == 0) {
+          strncpy(config.idle_levels, value, sizeof(config.idle_levels) - 1);
+          config.idle_levels[sizeof(config.idle_levels) - 1] = '\0';
       }
   }
 
@@ -1308,9 +8251,7 @@ static void save_config_file(void) {
 
   // Create config directory
   if (mkdir(config_dir, 0755) != 0 && errno != EEXIST) {
-      if (debug) {
-          perror(NAME ": mkdir config_dir");
-      }
+      LOG_DEBUG(SUBSYS_CORE, "mkdir config_dir: %s\n", strerror(errno));
   }
 
   // Safely construct config file path
@@ -1321,9 +8262,7 @@ static void save_config_file(void) {
 
   FILE *file = fopen(config_path, "w");
   if (!file) {
-      if (debug) {
-          perror(NAME ": fopen config file");
-      }
+      LOG_DEBUG(SUBSYS_CORE, "fopen config file: %s\n", strerror(errno));
       return;
   }
 
@@ -1333,17 +8272,58 @@ static void save_config_file(void) {
   fprintf(file, "playlist_shuffle=%s\n", config.media_playlist.shuffle ? "true" : "false");
   fprintf(file, "playlist_loop=%s\n", config.media_playlist.loop ? "true" : "false");
   fprintf(file, "multi_monitor=%s\n", config.multi_monitor ? "true" : "false");
+  fprintf(file, "logical_monitors=%s\n", config.logical_monitors ? "true" : "false");
   fprintf(file, "auto_resize=%s\n", config.auto_resize ? "true" : "false");
+  fprintf(file, "native_gif=%s\n", config.native_gif ? "true" : "false");
+  fprintf(file, "gif_memory_mb=%d\n", config.gif_memory_mb);
+  fprintf(file, "loop_cache=%s\n", config.loop_cache ? "true" : "false");
+  fprintf(file, "loop_cache_mb=%d\n", config.loop_cache_mb);
+  fprintf(file, "image_cache_mb=%d\n", config.image_cache_mb);
+  fprintf(file, "loop_cache_max_seconds=%d\n", config.loop_cache_max_seconds);
+  fprintf(file, "slideshow=%s\n", config.slideshow ? "true" : "false");
+  fprintf(file, "slideshow_fade_ms=%d\n", config.slideshow_fade_ms);
+  fprintf(file, "generator_fps=%d\n", config.generator_fps);
+  fprintf(file, "generator_scale=%d\n", config.generator_scale);
+  fprintf(file, "generator_threads=%d\n", config.generator_threads);
+  fprintf(file, "pause_when_covered=%s\n", config.pause_when_covered ? "true" : "false");
+  fprintf(file, "pause_when_blanked=%s\n", config.pause_when_blanked ? "true" : "false");
+  fprintf(file, "idle_levels=%s\n", config.idle_levels);
+  fprintf(file, "battery_profile=%s\n", config.battery_profile);
+  fprintf(file, "battery_fps=%d\n", config.battery_fps);
+  fprintf(file, "psi_governor=%s\n", config.psi_governor ? "true" : "false");
+  fprintf(file, "psi_fps=%d\n", config.psi_fps);
+  fprintf(file, "adaptive_quality=%s\n", config.adaptive_quality ? "true" : "false");
+  fprintf(file, "cgroups=%s\n", config.cgroups ? "true" : "false");
+  fprintf(file, "cgroup_parent=%s\n", config.cgroup_parent);
+  fprintf(file, "cgroup_cpu_percent=%d\n", config.cgroup_cpu_percent);
+  fprintf(file, "cgroup_cpu_weight=%d\n", config.cgroup_cpu_weight);
+  fprintf(file, "cgroup_memory_high_mb=%d\n", config.cgroup_memory_high_mb);
+  fprintf(file, "cgroup_memory_max_mb=%d\n", config.cgroup_memory_max_mb);
+  fprintf(file, "player_sched=%s\n", config.player_sched);
+  fprintf(file, "player_nice=%d\n", config.player_nice);
+  fprintf(file, "player_ioprio=%s\n", config.player_ioprio);
+  fprintf(file, "player_cpus=%s\n", config.player_cpus);
+  fprintf(file, "decoder_threads=%d\n", config.decoder_threads);
+  fprintf(file, "player_args=%s\n", config.player_args);
+  fprintf(file, "profile=%s\n", config.profile);
+  fprintf(file, "match_output=%s\n", config.match_output ? "true" : "false");
+  fprintf(file, "metrics=%s\n", config.metrics ? "true" : "false");
+  fprintf(file, "stats_segment=%s\n", config.stats_segment ? "true" : "false");
+  fprintf(file, "control=%s\n", config.control ? "true" : "false");
+  fprintf(file, "accounting_interval=%d\n", config.accounting_interval);
+  fprintf(file, "trace_file=%s\n", config.trace_file);
+  fprintf(file, "log_level=%s\n", log_level_names[config.log_level]);
+  fprintf(file, "log_subsystems=%s\n", config.log_subsystems);
+  save_monitor_overrides(file);
 
   fclose(file);
 
-  if (debug) {
-      fprintf(stderr, NAME ": Configuration saved to: %s\n", config_path);
-  }
+  LOG_DEBUG(SUBSYS_CORE, "Configuration saved to: %s\n", config_path);
 }
 
 // Initialize X11
 static void init_x11(void) {
+  TRACE_SCOPE("init_x11", -1);
   display = XOpenDisplay(NULL);
   if (!display) {
       fprintf(stderr, NAME ": Error: couldn't open display\n");
@@ -1354,9 +8334,7 @@ static void init_x11(void) {
   // Configurar manejo de errores X11
   XSetErrorHandler(NULL); // Usar handler por defecto
 
-  if (debug) {
-      fprintf(stderr, NAME ": X11 initialized successfully\n");
-  }
+  LOG_DEBUG(SUBSYS_X11, "X11 initialized successfully\n");
 }
 
 // Usage information
@@ -1365,6 +8343,8 @@ static void usage(void) {
   fprintf(stderr, "\nUsage: %s [OPTIONS] <media-file-or-directory>\n\n", NAME);
   fprintf(stderr, "Options:\n");
   fprintf(stderr, "  -m, --multi-monitor    Enable multi-monitor support\n");
+  fprintf(stderr, "  --logical-monitors     Use RandR 1.5 monitors from xrandr --setmonitor instead\n");
+  fprintf(stderr, "                         of the physical outputs, when any is defined\n");
   fprintf(stderr, "  -p, --player PLAYER    Media player to use (mpv, mplayer, vlc)\n");
   fprintf(stderr, "  -s, --shuffle          Shuffle playlist\n");
   fprintf(stderr, "  -l, --loop             Loop playlist\n");
@@ -1372,21 +8352,281 @@ static void usage(void) {
   fprintf(stderr, "  -c, --config FILE      Use custom config file\n");
   fprintf(stderr, "  --auto-res             Auto-detect and use native resolution\n");
   fprintf(stderr, "  --auto-resize          Enable automatic resize on screen changes\n");
+  fprintf(stderr, "  --no-native-gif        Play GIFs with the media player instead of the built-in engine\n");
+  fprintf(stderr, "  --loop-cache           Decode short clips once and replay them from RAM (needs ffmpeg)\n");
+  fprintf(stderr, "  --loop-cache-mb MB     Memory budget for the loop cache (default: 512)\n");
+  fprintf(stderr, "  --image-cache-mb MB    Disk budget for prescaled images, least recently used evicted (default: 1024, 0 = unlimited)\n");
+  fprintf(stderr, "  --slideshow            Show images in the window with crossfades between them\n");
+  fprintf(stderr, "  --no-pause-covered     Keep playing when fullscreen/maximized windows cover the wallpaper\n");
+  fprintf(stderr, "  --no-pause-blanked     Keep playing while screens are off (DPMS) or the screensaver runs\n");
+  fprintf(stderr, "  --idle-levels LIST     Idle seconds:fps caps, e.g. 600:15,1800:5 (\"\" disables)\n");
+  fprintf(stderr, "  --battery-profile P    On battery: none, fps, primary (default) or freeze\n");
+  fprintf(stderr, "  --battery-fps N        Frame rate cap on battery (default: 15)\n");
+  fprintf(stderr, "  --no-psi               Do not back off under CPU/memory/IO pressure\n");
+  fprintf(stderr, "  --no-adaptive-quality  Keep full quality even when a window drops frames\n");
+  fprintf(stderr, "  --profile NAME         eco, balanced (default) or quality; SIGUSR1 cycles, per\n");
+  fprintf(stderr, "                         monitor as monitor.<OUTPUT>.profile in the config file\n");
+  fprintf(stderr, "  --player-args \"ARGS\"  Extra player arguments, override the profile's\n");
+  fprintf(stderr, "  --decoder-threads N    Decoder threads shared by all players (default: cores)\n");
+  fprintf(stderr, "  --trace FILE           Record startup/transition/hotplug spans; write Chrome\n");
+  fprintf(stderr, "                         trace JSON to FILE on SIGUSR2 and at exit\n");
+  fprintf(stderr, "  --accounting-interval N\n");
+  fprintf(stderr, "                         Sample each player's /proc CPU, memory, context switches\n");
+  fprintf(stderr, "                         and reads every N seconds (default: 5, 0 = off)\n");
+  fprintf(stderr, "  --no-control           Do not accept motionwall-ctl commands on\n");
+  fprintf(stderr, "                         $XDG_RUNTIME_DIR/motionwall.sock\n");
+  fprintf(stderr, "  --no-stats-segment     Do not publish live stats in /dev/shm/motionwall-$UID\n");
+  fprintf(stderr, "                         (read with motionwall-stat)\n");
+  fprintf(stderr, "  --no-metrics           Do not serve Prometheus metrics on\n");
+  fprintf(stderr, "                         $XDG_RUNTIME_DIR/motionwall-metrics.sock\n");
+  fprintf(stderr, "  --no-match-output      Do not cap player fps to each monitor's refresh rate\n");
+  fprintf(stderr, "                         (per monitor: monitor.<OUTPUT>.max_fps, match_output in\n");
+  fprintf(stderr, "                         the config file)\n");
+  fprintf(stderr, "  --player-sched CLASS   Player CPU class: idle (default), batch or normal\n");
+  fprintf(stderr, "  --player-nice N        Nice level for batch/normal players\n");
+  fprintf(stderr, "  --player-ioprio CLASS  Player I/O class: idle (default), low or none\n");
+  fprintf(stderr, "  --player-cpus LIST     Pin players to these CPUs (e.g. 2-3); per monitor in the\n");
+  fprintf(stderr, "                         config file as monitor.<OUTPUT>.player_cpus=LIST\n");
+  fprintf(stderr, "  --no-cgroups           Do not put each player in its own cgroup v2 leaf\n");
+  fprintf(stderr, "  --cgroup-parent PATH   Delegated cgroup v2 directory for the player leaves\n");
+  fprintf(stderr, "                         (default: the daemon's own cgroup, if delegated)\n");
+  fprintf(stderr, "  --player-cpu PERCENT   cpu.max for each player, in %% of one core (default: 0 = unlimited)\n");
+  fprintf(stderr, "  --player-memory MB     memory.max for each player, memory.high is half\n");
+  fprintf(stderr, "                         (default: 0 = unlimited)\n");
+  fprintf(stderr, "  --player-cpu-weight N  cpu.weight for each player, 1-10000 (default: 0 = unset)\n");
+  fprintf(stderr, "  --psi-fps N            Frame rate cap at the first pressure level (default: 10)\n");
+  fprintf(stderr, "  --fade MS              Crossfade duration for --slideshow (default: 800)\n");
+  fprintf(stderr, "  --generator NAME       Procedural wallpaper: plasma, flow, gradient, starfield\n");
+  fprintf(stderr, "  --gen-fps N            Frame rate for procedural wallpapers (default: 15)\n");
+  fprintf(stderr, "  --gen-scale N          Render at 1/N resolution and upscale (default: 4)\n");
+  fprintf(stderr, "  --gen-threads N        Render threads for procedural wallpapers\n");
+  fprintf(stderr, "  --bench generators     Measure CPU per megapixel of each generator and exit\n");
+  fprintf(stderr, "  --bench sinks          Measure the loop cache frame path into null/file sinks, no X\n");
+  fprintf(stderr, "  --bench sched          Foreground wakeup latency against decoder-like load, with\n");
+  fprintf(stderr, "                         and without the player scheduling options\n");
+  fprintf(stderr, "  --sink-file PATH       Raw BGRX output for the file sink (default: /dev/null)\n");
+  fprintf(stderr, "  --save-config          Write the effective settings to ~/.config/motionwall/config\n");
   fprintf(stderr, "  --daemon               Run as daemon\n");
-  fprintf(stderr, "  --debug                Enable debug output\n");
+  fprintf(stderr, "  --debug                Enable debug output (same as --log-level debug)\n");
+  fprintf(stderr, "  --log-level LEVEL      error, warn, info, debug or trace (default: warn);\n");
+  fprintf(stderr, "                         SIGRTMIN raises it, SIGRTMIN+1 lowers it at runtime\n");
+  fprintf(stderr, "  --log-subsystems LIST  Comma list of core,x11,monitor,player,playlist,engine,\n");
+  fprintf(stderr, "                         power (default: all)\n");
   fprintf(stderr, "  -h, --help             Show this help\n");
   fprintf(stderr, "\nExamples:\n");
   fprintf(stderr, "  %s video.mp4                    # Single video\n", NAME);
   fprintf(stderr, "  %s -m ~/Videos/                 # Multi-monitor playlist\n", NAME);
   fprintf(stderr, "  %s -p mpv -s -l ~/Wallpapers/   # Shuffled looping playlist\n", NAME);
   fprintf(stderr, "  %s --auto-resize ~/Videos/      # Auto-resize on screen changes\n", NAME);
+  fprintf(stderr, "  %s photo.jpg                    # Static image on the root window, no player\n", NAME);
+  fprintf(stderr, "  %s --generator plasma           # Procedural wallpaper, no media files\n", NAME);
+}
+
+// Opciones de línea de comandos; -1 para seguir, si no el código de salida.
+// Se vuelven a aplicar tras recargar la configuración: mandan sobre el archivo
+static int parse_arguments(int argc, char **argv, command_line *cl) {
+  for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--multi-monitor") == 0) {
+          config.multi_monitor = true;
+      } else if (strcmp(argv[i], "--logical-monitors") == 0) {
+          config.logical_monitors = true;
+      } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--player") == 0) {
+          if (++i < argc) {
+              strncpy(config.media_player, argv[i], sizeof(config.media_player) - 1);
+              config.media_player[sizeof(config.media_player) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--shuffle") == 0) {
+          config.media_playlist.shuffle = true;
+      } else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--loop") == 0) {
+          config.media_playlist.loop = true;
+      } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--duration") == 0) {
+          if (++i < argc) {
+              config.media_playlist.duration = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--config") == 0) {
+          if (++i < argc) {
+              load_config_file(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--auto-res") == 0) {
+          config.auto_resolution = true;
+      } else if (strcmp(argv[i], "--auto-resize") == 0) {
+          config.auto_resize = true;
+      } else if (strcmp(argv[i], "--no-native-gif") == 0) {
+          config.native_gif = false;
+      } else if (strcmp(argv[i], "--generator") == 0) {
+          if (++i < argc) {
+              snprintf(cl->media_path, sizeof(cl->media_path), GENERATOR_PREFIX "%s", argv[i]);
+          }
+      } else if (strcmp(argv[i], "--gen-fps") == 0) {
+          if (++i < argc) {
+              config.generator_fps = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--gen-scale") == 0) {
+          if (++i < argc) {
+              config.generator_scale = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--gen-threads") == 0) {
+          if (++i < argc) {
+              config.generator_threads = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--sink-file") == 0) {
+          if (++i < argc) {
+              cl->sink_file = argv[i];
+          }
+      } else if (strcmp(argv[i], "--bench") == 0) {
+          if (++i < argc) {
+              cl->bench = argv[i];
+          }
+      } else if (strcmp(argv[i], "--no-pause-covered") == 0) {
+          config.pause_when_covered = false;
+      } else if (strcmp(argv[i], "--no-pause-blanked") == 0) {
+          config.pause_when_blanked = false;
+      } else if (strcmp(argv[i], "--battery-profile") == 0) {
+          if (++i < argc) {
+              strncpy(config.battery_profile, argv[i], sizeof(config.battery_profile) - 1);
+              config.battery_profile[sizeof(config.battery_profile) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "--battery-fps") == 0) {
+          if (++i < argc) {
+              config.battery_fps = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--profile") == 0) {
+          if (++i < argc) {
+              if (!find_profile(argv[i])) {
+                  fprintf(stderr, NAME ": Error: Unknown profile '%s' (eco, balanced, quality)\n", argv[i]);
+                  return 1;
+              }
+              strcpy(config.profile, argv[i]);
+          }
+      } else if (strcmp(argv[i], "--player-args") == 0) {
+          if (++i < argc) {
+              strncpy(config.player_args, argv[i], sizeof(config.player_args) - 1);
+              config.player_args[sizeof(config.player_args) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "--trace") == 0) {
+          if (++i < argc) {
+              strncpy(config.trace_file, argv[i], sizeof(config.trace_file) - 1);
+              config.trace_file[sizeof(config.trace_file) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "--accounting-interval") == 0) {
+          if (++i < argc) {
+              config.accounting_interval = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--no-control") == 0) {
+          config.control = false;
+      } else if (strcmp(argv[i], "--no-stats-segment") == 0) {
+          config.stats_segment = false;
+      } else if (strcmp(argv[i], "--no-metrics") == 0) {
+          config.metrics = false;
+      } else if (strcmp(argv[i], "--no-match-output") == 0) {
+          config.match_output = false;
+      } else if (strcmp(argv[i], "--decoder-threads") == 0) {
+          if (++i < argc) {
+              config.decoder_threads = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--player-sched") == 0) {
+          if (++i < argc) {
+              strncpy(config.player_sched, argv[i], sizeof(config.player_sched) - 1);
+              config.player_sched[sizeof(config.player_sched) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "--player-nice") == 0) {
+          if (++i < argc) {
+              config.player_nice = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--player-ioprio") == 0) {
+          if (++i < argc) {
+              strncpy(config.player_ioprio, argv[i], sizeof(config.player_ioprio) - 1);
+              config.player_ioprio[sizeof(config.player_ioprio) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "--player-cpus") == 0) {
+          if (++i < argc) {
+              strncpy(config.player_cpus, argv[i], sizeof(config.player_cpus) - 1);
+              config.player_cpus[sizeof(config.player_cpus) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "--no-cgroups") == 0) {
+          config.cgroups = false;
+      } else if (strcmp(argv[i], "--cgroup-parent") == 0) {
+          if (++i < argc) {
+              strncpy(config.cgroup_parent, argv[i], sizeof(config.cgroup_parent) - 1);
+              config.cgroup_parent[sizeof(config.cgroup_parent) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "--player-cpu-weight") == 0) {
+          if (++i < argc) {
+              config.cgroup_cpu_weight = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--player-cpu") == 0) {
+          if (++i < argc) {
+              config.cgroup_cpu_percent = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--player-memory") == 0) {
+          if (++i < argc) {
+              config.cgroup_memory_max_mb = atoi(argv[i]);
+              config.cgroup_memory_high_mb = config.cgroup_memory_max_mb / 2;
+          }
+      } else if (strcmp(argv[i], "--no-adaptive-quality") == 0) {
+          config.adaptive_quality = false;
+      } else if (strcmp(argv[i], "--no-psi") == 0) {
+          config.psi_governor = false;
+      } else if (strcmp(argv[i], "--psi-fps") == 0) {
+          if (++i < argc) {
+              config.psi_fps = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--idle-levels") == 0) {
+          if (++i < argc) {
+              strncpy(config.idle_levels, argv[i], sizeof(config.idle_levels) - 1);
+              config.idle_levels[sizeof(config.idle_levels) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "--slideshow") == 0) {
+          config.slideshow = true;
+      } else if (strcmp(argv[i], "--fade") == 0) {
+          if (++i < argc) {
+              config.slideshow_fade_ms = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--loop-cache") == 0) {
+          config.loop_cache = true;
+      } else if (strcmp(argv[i], "--loop-cache-mb") == 0) {
+          if (++i < argc) {
+              config.loop_cache = true;
+              config.loop_cache_mb = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--image-cache-mb") == 0) {
+          if (++i < argc) {
+              config.image_cache_mb = atoi(argv[i]);
+          }
+      } else if (strcmp(argv[i], "--save-config") == 0) {
+          cl->save_config = true;
+      } else if (strcmp(argv[i], "--daemon") == 0) {
+          cl->daemon_mode = true;
+      } else if (strcmp(argv[i], "--debug") == 0) {
+          debug = true;
+      } else if (strcmp(argv[i], "--log-level") == 0) {
+          if (++i < argc) {
+              int level = parse_log_level(argv[i]);
+              if (level < 0) {
+                  fprintf(stderr, NAME ": Error: Unknown log level '%s'\n", argv[i]);
+                  return 1;
+              }
+              config.log_level = level;
+          }
+      } else if (strcmp(argv[i], "--log-subsystems") == 0) {
+          if (++i < argc) {
+              strncpy(config.log_subsystems, argv[i], sizeof(config.log_subsystems) - 1);
+              config.log_subsystems[sizeof(config.log_subsystems) - 1] = '\0';
+          }
+      } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+          usage();
+          return 0;
+      } else if (argv[i][0] != '-') {
+          strncpy(cl->media_path, argv[i], sizeof(cl->media_path) - 1);
+          cl->media_path[sizeof(cl->media_path) - 1] = '\0';
+      }
+  }
+  return -1;
 }
 
 // Nueva función para forzar ventanas al fondo
 static void force_windows_to_background(void) {
-  if (debug) {
-      fprintf(stderr, NAME ": Forcing windows to background\n");
-  }
+  LOG_DEBUG(SUBSYS_X11, "Forcing windows to background\n");
 
   for (int i = 0; i < config.window_count; i++) {
       if (config.windows[i].window != None) {
@@ -1399,30 +8639,69 @@ static void force_windows_to_background(void) {
       }
   }
 
-  if (debug) {
-      fprintf(stderr, NAME ": Windows forced to background\n");
-  }
+  LOG_DEBUG(SUBSYS_X11, "Windows forced to background\n");
 }
 
-// MAIN FUNCTION COMPLETAMENTE REESCRITA Y MEJORADA
-int main(int argc, char **argv) {
-  int i;
-  bool daemon_mode = false;
-  char media_path[MAX_PATH] = {0};
-
-  // Initialize configuration with defaults
-  memset(&config, 0, sizeof(config));
+// Valores por defecto de todas las opciones. Solo toca opciones, no el estado
+// (ventanas, monitores, lista): la recarga parte de aquí igual que el arranque
+static void config_defaults(void) {
   strcpy(config.media_player, "mpv");
   config.media_playlist.duration = 30;
   config.media_playlist.shuffle = false;
   config.media_playlist.loop = true;
   config.multi_monitor = false;
+  config.logical_monitors = false;
   config.auto_resolution = true;
   config.playlist_mode = false;
   config.compositor_aware = false;
   config.auto_resize = true;  // Habilitar auto-resize por defecto
+  config.native_gif = true;
+  config.gif_memory_mb = 256;
+  config.loop_cache = false;
+  config.loop_cache_mb = 512;
+  config.image_cache_mb = 1024;
+  config.loop_cache_max_seconds = 20;
+  config.slideshow = false;
+  config.slideshow_fade_ms = 800;
+  config.pause_when_covered = true;
+  config.pause_when_blanked = true;
+  strcpy(config.idle_levels, "600:15,1800:5");
+  strcpy(config.battery_profile, "primary");
+  config.battery_fps = 15;
+  config.psi_governor = true;
+  config.psi_fps = 10;
+  config.adaptive_quality = true;
+  config.cgroups = true;
+  config.cgroup_cpu_percent = 0;
+  config.cgroup_cpu_weight = 0;
+  config.cgroup_memory_high_mb = 0;
+  config.cgroup_memory_max_mb = 0;
+  strcpy(config.player_sched, "idle");
+  config.player_nice = 0;
+  strcpy(config.player_ioprio, "idle");
+  config.player_cpus[0] = '\0';
+  config.decoder_threads = 0;
+  config.player_args[0] = '\0';
+  strcpy(config.profile, "balanced");
+  config.match_output = true;
+  config.metrics = true;
+  config.stats_segment = true;
+  config.control = true;
+  config.accounting_interval = 5;
+  config.log_level = LOG_LEVEL_WARN;
+  strcpy(config.log_subsystems, "all");
+  config.generator_fps = 15;
+  config.generator_scale = 4;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  config.generator_threads = cores > 4 ? 4 : (cores > 0 ? (int)cores : 1);
+  config.cgroup_parent[0] = '\0';
+  config.trace_file[0] = '\0';
+  memset(config.monitor_overrides, 0, sizeof(config.monitor_overrides));
+  config.monitor_override_count = 0;
+}
 
-  // Load default config
+// ~/.config/motionwall/config, antes de los argumentos
+static void load_default_config(void) {
   const char *home = getenv("HOME");
   if (home) {
       char default_config[MAX_PATH];
@@ -1433,46 +8712,53 @@ int main(int argc, char **argv) {
           }
       }
   }
+}
+
+// MAIN FUNCTION COMPLETAMENTE REESCRITA Y MEJORADA
+int main(int argc, char **argv) {
+  int i;
+  static command_line cl = { .sink_file = "/dev/null" };
+
+  daemon_stats.start_ms = monotonic_ms();
+
+  // Trazado de arranque, transiciones y reconfiguraciones, desde la carga
+  // de la configuración
+  init_tracing();
+
+  // Initialize configuration with defaults
+  memset(&config, 0, sizeof(config));
+  config_defaults();
+
+  // Load default config
+  load_default_config();
 
   // Parse command line arguments
-  for (i = 1; i < argc; i++) {
-      if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--multi-monitor") == 0) {
-          config.multi_monitor = true;
-      } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--player") == 0) {
-          if (++i < argc) {
-              strncpy(config.media_player, argv[i], sizeof(config.media_player) - 1);
-              config.media_player[sizeof(config.media_player) - 1] = '\0';
-          }
-      } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--shuffle") == 0) {
-          config.media_playlist.shuffle = true;
-      } else if (strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--loop") == 0) {
-          config.media_playlist.loop = true;
-      } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--duration") == 0) {
-          if (++i < argc) {
-              config.media_playlist.duration = atoi(argv[i]);
-          }
-      } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--config") == 0) {
-          if (++i < argc) {
-              load_config_file(argv[i]);
-          }
-      } else if (strcmp(argv[i], "--auto-res") == 0) {
-          config.auto_resolution = true;
-      } else if (strcmp(argv[i], "--auto-resize") == 0) {
-          config.auto_resize = true;
-      } else if (strcmp(argv[i], "--daemon") == 0) {
-          daemon_mode = true;
-      } else if (strcmp(argv[i], "--debug") == 0) {
-          debug = true;
-      } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-          usage();
-          return 0;
-      } else if (argv[i][0] != '-') {
-          strncpy(media_path, argv[i], sizeof(media_path) - 1);
-          media_path[sizeof(media_path) - 1] = '\0';
+  int status = parse_arguments(argc, argv, &cl);
+  if (status >= 0) return status;
+  saved_argc = argc;
+  saved_argv = argv;
+
+  // Nivel y subsistemas del log (cambiables luego con SIGRTMIN / SIGRTMIN+1)
+  log_level_setting = (debug && config.log_level < LOG_LEVEL_DEBUG) ? LOG_LEVEL_DEBUG : config.log_level;
+  if (!parse_log_subsystems(config.log_subsystems)) {
+      fprintf(stderr, NAME ": Error: Unknown log subsystem in '%s'\n", config.log_subsystems);
+      return 1;
+  }
+
+  // Modos de benchmark: no necesitan servidor X ni lock de instancia
+  if (cl.bench) {
+      if (strcmp(cl.bench, "generators") == 0) {
+          return bench_generators();
+      } else if (strcmp(cl.bench, "sinks") == 0) {
+          return bench_sinks(cl.sink_file);
+      } else if (strcmp(cl.bench, "sched") == 0) {
+          return bench_sched();
       }
+      fprintf(stderr, NAME ": Error: Unknown benchmark '%s'\n", cl.bench);
+      return 1;
   }
 
-  if (strlen(media_path) == 0) {
+  if (strlen(cl.media_path) == 0) {
       fprintf(stderr, NAME ": Error: No media file or directory specified\n");
       usage();
       return 1;
@@ -1492,14 +8778,14 @@ int main(int argc, char **argv) {
 
   char test_cmd[512];
   snprintf(test_cmd, sizeof(test_cmd), "which %s >/dev/null 2>&1", config.media_player);
-  if (system(test_cmd) != 0) {
+  if (!is_generator_item(cl.media_path) && system(test_cmd) != 0) {
       fprintf(stderr, NAME ": Error: Media player '%s' not found\n", config.media_player);
       fprintf(stderr, NAME ": Please install %s or specify another player with -p\n", config.media_player);
       return 1;
   }
 
   // Daemonize if requested
-  if (daemon_mode) {
+  if (cl.daemon_mode) {
       pid_t pid = fork();
       if (pid < 0) {
           perror("fork");
@@ -1516,7 +8802,7 @@ int main(int argc, char **argv) {
       }
 
       if (chdir("/") < 0) {
-          if (debug) perror("chdir");
+          LOG_DEBUG(SUBSYS_CORE, "chdir: %s\n", strerror(errno));
       }
       if (!debug) {
           close(STDIN_FILENO);
@@ -1525,12 +8811,19 @@ int main(int argc, char **argv) {
       }
   }
 
+  // Logger asíncrono, ya en el proceso definitivo
+  init_logger();
+
   // Initialize random seed for shuffle
   srand((unsigned int)time(NULL));
 
   // Set up signal handlers ANTES de inicializar X11
   signal(SIGTERM, signal_handler);
   signal(SIGINT, signal_handler);
+  signal(SIGUSR1, profile_signal_handler);
+
+  // Con la configuración leída se sabe si la traza se queda
+  configure_tracing();
   signal(SIGCHLD, SIG_IGN); // Prevent zombie processes
   signal(SIGPIPE, SIG_IGN); // Ignore broken pipe
 
@@ -1553,7 +8846,7 @@ int main(int argc, char **argv) {
   }
 
   // Create playlist
-  create_playlist(media_path);
+  create_playlist(cl.media_path);
   if (config.media_playlist.count == 0) {
       fprintf(stderr, NAME ": Error: No compatible media files found\n");
       cleanup_and_exit();
@@ -1603,29 +8896,69 @@ int main(int argc, char **argv) {
   // Small delay to let windows settle
   usleep(500000); // 500ms
 
+  // Cgroups v2 para contener a los reproductores
+  init_player_cgroups();
+
+  // ffprobe en segundo plano: las ventanas siguientes ya lo encuentran hecho
+  prefetch_media_probes();
+
   // Start media players - UNO POR VENTANA
   for (i = 0; i < config.window_count; i++) {
       start_media_player(i);
       usleep(200000); // 200ms between starts para evitar condiciones de carrera
   }
 
+  // Decodificar el resto de imágenes de la playlist en segundo plano
+  prefetch_image_cache();
+
   // Esperar a que los reproductores se establezcan
   sleep(2);
 
   // Forzar ventanas al fondo
   force_windows_to_background();
 
-  // Save current configuration
-  save_config_file();
+  // Guardar la configuración solo si se pidió: el archivo es del usuario
+  if (cl.save_config) {
+      save_config_file();
+  }
 
-  if (debug) {
-      fprintf(stderr, NAME ": Setup complete. Running with %d window(s) and %d player(s).\n",
-              config.window_count, config.window_count);
-      if (config.auto_resize) {
-          fprintf(stderr, NAME ": Auto-resize is enabled - will adapt to screen changes\n");
-      }
+  // Una sola imagen fija y sin auto-resize: el fondo ya está publicado en el
+  // pixmap raíz (retenido), no hace falta seguir residente
+  if (all_windows_static() && config.media_playlist.count == 1 && !config.auto_resize) {
+      LOG_DEBUG(SUBSYS_CORE, "Static image published on the root window, exiting\n");
+      cleanup_and_exit();
+  }
+
+  LOG_DEBUG(SUBSYS_CORE, "Setup complete. Running with %d window(s) and %d player(s).\n",
+            config.window_count, config.window_count);
+  if (config.auto_resize) {
+      LOG_DEBUG(SUBSYS_CORE, "Auto-resize is enabled - will adapt to screen changes\n");
   }
 
+  // Pantallas apagadas, salvapantallas e inactividad
+  init_power_monitoring();
+
+  // Perfil de batería, por uevents de power_supply
+  init_battery_monitoring();
+
+  // Gobernador de presión del sistema (PSI)
+  init_psi_governor();
+
+  // Métricas para Prometheus en un socket Unix
+  init_metrics_server();
+
+  // Órdenes de motionwall-ctl
+  init_control_server();
+
+  // Recarga en caliente con SIGHUP o al guardar el archivo de configuración
+  init_config_watch();
+
+  // Estadísticas en memoria compartida (motionwall-stat)
+  init_stats_segment();
+
+  // Eventos de la raíz para pausar el fondo cuando está tapado
+  if (config.pause_when_covered) select_occlusion_events();
+
   // MAIN LOOP COMPLETAMENTE REESCRITO CON DETECCIÓN DE CAMBIOS DE PANTALLA
   time_t last_change = time(NULL);
   time_t last_check = time(NULL);
@@ -1635,7 +8968,9 @@ int main(int argc, char **argv) {
   const int MAX_EVENTS_PER_CYCLE = 10; // Aumentado para manejar eventos RandR
 
   running = true;
+  in_main_loop = 1;
 
+  long long loop_awake_ms = monotonic_ms();
   while (running) {
       time_t now = time(NULL);
 
@@ -1654,8 +8989,8 @@ int main(int argc, char **argv) {
       if (display && XPending(display) > 0) {
           int pending_events = XPending(display);
 
-          if (debug && pending_events > 5) {
-              fprintf(stderr, NAME ": Processing %d pending events\n", pending_events);
+          if (pending_events > 5) {
+              LOG(LOG_LEVEL_TRACE, SUBSYS_X11, "Processing %d pending events\n", pending_events);
           }
 
           while (XPending(display) && events_processed < MAX_EVENTS_PER_CYCLE && running) {
@@ -1666,10 +9001,8 @@ int main(int argc, char **argv) {
               int result = XNextEvent(display, &event);
               if (result != 0) {
                   consecutive_errors++;
-                  if (debug) {
-                      fprintf(stderr, NAME ": XNextEvent error %d (consecutive: %d)\n",
-                              result, consecutive_errors);
-                  }
+                  LOG_DEBUG(SUBSYS_CORE, "XNextEvent error %d (consecutive: %d)\n",
+                            result, consecutive_errors);
 
                   if (consecutive_errors >= MAX_CONSECUTIVE_ERRORS) {
                       fprintf(stderr, NAME ": Too many X11 errors, exiting\n");
@@ -1687,29 +9020,59 @@ int main(int argc, char **argv) {
               // Manejo EXTENDIDO de eventos incluyendo RandR
               switch (event.type) {
                   case DestroyNotify:
-                      if (debug) {
-                          fprintf(stderr, NAME ": Window destroyed, exiting\n");
+                      // Con SubstructureNotifyMask en la raíz llegan también los
+                      // cierres de otros clientes: solo salir si es una ventana nuestra
+                      for (int i = 0; config.windows && i < config.window_count; i++) {
+                          if (config.windows[i].window == event.xdestroywindow.window) {
+                              LOG_DEBUG(SUBSYS_CORE, "Window destroyed, exiting\n");
+                              running = false;
+                              break;
+                          }
                       }
-                      running = false;
+                      if (running) occlusion_dirty = true;
                       break;
 
                   case ClientMessage:
                       if (event.xclient.message_type == ATOM(WM_PROTOCOLS)) {
-                          if (debug) {
-                              fprintf(stderr, NAME ": WM close request received\n");
-                          }
+                          LOG_DEBUG(SUBSYS_CORE, "WM close request received\n");
                           running = false;
                       }
                       break;
 
-                  case ConfigureNotify:
-                      // Solo log en debug
-                      if (debug) {
-                          fprintf(stderr, NAME ": Window configuration changed\n");
+                  case Expose:
+                      handle_expose_event(&event.xexpose);
+                      break;
+
+                  case VisibilityNotify:
+                      handle_visibility_event(&event.xvisibility);
+                      break;
+
+                  case PropertyNotify:
+                      // Cambió el apilamiento o la ventana activa: revisar qué está tapado
+                      if (event.xproperty.atom == ATOM(_NET_CLIENT_LIST_STACKING) ||
+                          event.xproperty.atom == ATOM(_NET_ACTIVE_WINDOW)) {
+                          occlusion_dirty = true;
                       }
                       break;
 
+                  case ConfigureNotify:
+                      // Un cliente (o su marco) se movió o cambió de tamaño
+                      occlusion_dirty = true;
+                      LOG(LOG_LEVEL_TRACE, SUBSYS_CORE, "Window configuration changed\n");
+                      break;
+
+                  case MapNotify:
+                  case UnmapNotify:
+                      occlusion_dirty = true;
+                      break;
+
                   default:
+                      // Salvapantallas activado o desactivado
+                      if (screensaver_event_base >= 0 &&
+                          event.type == screensaver_event_base + ScreenSaverNotify) {
+                          update_power_state();
+                          break;
+                      }
                       // Verificar si es un evento RandR
                       if (config.auto_resize && randr_event_base > 0) {
                           handle_randr_event(&event);
@@ -1736,24 +9099,9 @@ int main(int argc, char **argv) {
       // Handle playlist changes
       if (config.media_playlist.count > 1 && config.media_playlist.duration > 0) {
           if (now - last_change >= config.media_playlist.duration) {
-              if (debug) {
-                  fprintf(stderr, NAME ": Time to switch playlist item\n");
-              }
+              LOG_DEBUG(SUBSYS_CORE, "Time to switch playlist item\n");
 
-              // Terminar reproductores existentes de forma controlada
-              terminate_all_players();
-
-              // Cambiar playlist
-              playlist_next();
-
-              // Esperar antes de reiniciar
-              sleep(2);
-
-              // Reiniciar todos con nuevo medio
-              for (i = 0; i < config.window_count; i++) {
-                  start_media_player(i);
-                  usleep(200000); // 200ms between starts
-              }
+              switch_playlist_item(1);
 
               last_change = now;
           }
@@ -1763,25 +9111,100 @@ int main(int argc, char **argv) {
       // Esto es un respaldo en caso de que se pierdan eventos RandR
       static time_t last_manual_check = 0;
       if (config.auto_resize && (now - last_manual_check >= 30)) {
-          if (debug) {
-              fprintf(stderr, NAME ": Performing periodic screen configuration check\n");
-          }
+          LOG_DEBUG(SUBSYS_CORE, "Performing periodic screen configuration check\n");
 
           monitor_setup old_setup = config.monitors;
           detect_monitors();
 
           if (!compare_monitor_setups(&old_setup, &config.monitors)) {
-              if (debug) {
-                  fprintf(stderr, NAME ": Screen changes detected during periodic check\n");
-              }
+              LOG_DEBUG(SUBSYS_CORE, "Screen changes detected during periodic check\n");
               handle_screen_change();
           }
 
           last_manual_check = now;
       }
 
-      // SLEEP CRÍTICO para evitar busy waiting
-      usleep(100000); // 100ms - más frecuente para mejor respuesta a eventos RandR
+      // Ocultación: tras eventos de los clientes (agrupados) y, por si se
+      // pierde alguno, un repaso lento
+      static long long last_occlusion_check = 0;
+      long long since_occlusion = monotonic_ms() - last_occlusion_check;
+      if (config.pause_when_covered &&
+          ((occlusion_dirty && since_occlusion >= OCCLUSION_EVENT_MS) || since_occlusion >= OCCLUSION_CHECK_MS)) {
+          occlusion_dirty = false;
+          update_occlusion();
+          last_occlusion_check = monotonic_ms();
+      }
+
+      // DPMS e inactividad: más a menudo con fps limitados para volver
+      // enseguida a la velocidad normal al tocar el teclado o el ratón
+      static long long last_power_check = 0;
+      long long power_interval = idle_fps_cap > 0 ? IDLE_CHECK_THROTTLED_MS : IDLE_CHECK_MS;
+      if (monotonic_ms() - last_power_check >= power_interval) {
+          update_power_state();
+          last_power_check = monotonic_ms();
+      }
+
+      // Recuperación del gobernador PSI
+      service_psi_governor(monotonic_ms());
+
+      // Calidad por ventana según los frames que se pierden
+      update_quality_control(monotonic_ms());
+
+      // Coste de cada reproductor, por ventana y por elemento
+      sample_player_accounting(monotonic_ms());
+
+      // Contadores para motionwall-stat
+      publish_stats(monotonic_ms());
+
+      // Volcado de la traza pedido con SIGUSR2
+      if (trace_dump_pending) {
+          trace_dump_pending = 0;
+          dump_trace();
+      }
+
+      // Cambio de perfil pedido con SIGUSR1
+      if (profile_cycle_pending) {
+          profile_cycle_pending = 0;
+          cycle_profile();
+      }
+
+      // Recarga pedida con SIGHUP o por un cambio en el archivo
+      if (config_reload_pending) {
+          config_reload_pending = 0;
+          reload_configuration();
+      }
+
+      // motionwall-ctl next/prev sin monitor: cambio de lista completo
+      if (control_playlist_step) {
+          int step = control_playlist_step;
+          control_playlist_step = 0;
+          switch_playlist_item(step);
+          last_change = time(NULL);
+      }
+
+      // Algo bloqueó esta vuelta (esperas al cambiar de elemento o de pantalla,
+      // IPC lento...): los motores internos van a recuperar con frames perdidos
+      // que no dicen nada de su coste, así que esa muestra no se evalúa
+      long long loop_now = monotonic_ms();
+      if (loop_now - loop_awake_ms > QUALITY_STALL_MS) {
+          quality_stall_ms = loop_now;
+      }
+
+      // Avanzar motores internos (GIF nativo) según sus propios delays
+      long long next_deadline = service_inprocess_engines(loop_now);
+      long long metrics_deadline = expire_metrics_clients(loop_now);
+      if (metrics_deadline >= 0 && (next_deadline < 0 || metrics_deadline < next_deadline)) {
+          next_deadline = metrics_deadline;
+      }
+      long long control_deadline = expire_control_clients(loop_now);
+      if (control_deadline >= 0 && (next_deadline < 0 || control_deadline < next_deadline)) {
+          next_deadline = control_deadline;
+      }
+
+      // SLEEP CRÍTICO para evitar busy waiting: despertar con eventos X,
+      // el próximo frame o como máximo cada 100ms
+      wait_for_activity(next_deadline);
+      loop_awake_ms = monotonic_ms();
 
       // Verificación adicional de seguridad
       if (consecutive_errors >= MAX_CONSECUTIVE_ERRORS) {
@@ -1790,9 +9213,7 @@ int main(int argc, char **argv) {
       }
   }
 
-  if (debug) {
-      fprintf(stderr, NAME ": Main loop exited, cleaning up\n");
-  }
+  LOG_DEBUG(SUBSYS_CORE, "Main loop exited, cleaning up\n");
 
   cleanup_and_exit();
   return 0;